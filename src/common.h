@@ -21,16 +21,43 @@
 #ifndef COMMON_H_
 #define COMMON_H_
 
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
 #if defined(BOARD_A10)
 #include "hosts/a10.h"
+typedef a10_host board_host;
 #elif defined(BOARD_RPI)
 #include "hosts/rpi.h"
+typedef bcm2835_host board_host;
 #elif defined(BOARD_RPI2)
 #include "hosts/rpi2.h"
+typedef bcm2835_host board_host;
 #elif defined(BOARD_AM335X)
 #include "hosts/am335x.h"
+typedef am335x_host board_host;
+#elif defined(BOARD_ALL)
+#include "hosts/all.h"
 #endif
 
+#include "gpio.h"
+
+/* ICSP pins and options: the defaults of every Pic (see device.h) */
+extern int pic_clk, pic_data, pic_mclr;
+
+struct flags_struct {
+   int debug = 0;
+   int client = 0;
+   int noverify = 0;
+   int boot_only = 0;
+   int program_only = 0;
+   int fulldump = 0;
+   int nothread = 0;
+};
+
+extern struct flags_struct flags;
+
 #include "devices/device.h"
 
 using namespace std;
@@ -38,7 +65,31 @@ using namespace std;
 #define VERSION "0.2"
 
 /* Low-level functions */
-void delay_us(unsigned int howLong);
+inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+void delay_init(void);
+void delay_ns(unsigned int howLong);
+void delay_track(bool on);
+inline void delay_us(unsigned int howLong){ delay_ns(howLong*1000); }
+void timing_resolve(const unsigned int *profile, unsigned int *delays,
+					int count);
+void rt_enter(void);
+void rt_checkpoint(void);
+void rt_exit(void);
+bool rt_spawn(pthread_t *thread, void *(*fn)(void *), void *arg);
+void stats_init(void);
+void stats_report(void);
+bool speed_auto(Pic *pic, const char *family);
+void record_init(void);
+void record_start(const char *family);
+void record_stop(bool save);
+bool replay_session(void);
+void trace_init(void);
 void setup_io(void);
 void close_io(void);
 
@@ -55,18 +106,77 @@ void server_mode(int port);
 uint8_t send_file(char * filename);
 uint8_t receive_file(int sock, char * filename);
 
-extern volatile uint32_t *gpio;
-extern int pic_clk, pic_data, pic_mclr;
+/* ICSP timing presets (--timing) */
+#define TIMING_DATASHEET	0
+#define TIMING_SAFE			1
+#define TIMING_CUSTOM		2
 
-struct flags_struct {
-   int debug = 0;
-   int client = 0;
-   int noverify = 0;
-   int boot_only = 0;
-   int program_only = 0;
-   int fulldump = 0;
+struct timing_struct {
+   int preset = TIMING_SAFE;
+   unsigned int scale = 100;	// custom: percent of the datasheet edge timings
 };
 
-extern struct flags_struct flags;
+extern struct timing_struct timing;
+extern thread_local uint64_t delay_max_gap;
+extern void (*delay_hook)(unsigned int ns);
+
+/* real-time execution in program mode (--realtime) */
+struct realtime_struct {
+   int enabled = 0;
+   int cpu = -1;			// -1: last online CPU
+   int priority = 50;		// SCHED_FIFO priority
+};
+
+extern struct realtime_struct realtime;
+
+/* PGC edge timing statistics (--stats) */
+struct stats_struct {
+   int enabled = 0;
+   const char *file = 0;	// JSON output, stderr table if not set
+};
+
+extern struct stats_struct stats;
+
+/* automatic clock speed discovery (--speed) */
+struct speed_struct {
+   int autotune = 0;
+   int retune = 0;			// ignore the cached scale
+   unsigned int margin = 25;	// percent of the datasheet edge timings
+   const char *file = "/var/tmp/picberry-speed";
+};
+
+extern struct speed_struct speed;
+
+/* session record and replay (--record, --replay) */
+struct replay_struct {
+   const char *record = 0;	// file to record the session to
+   const char *file = 0;		// file to replay
+};
+
+extern struct replay_struct replay;
+
+/* GPIO trace to VCD (--trace) */
+struct trace_struct {
+   const char *file = 0;
+   unsigned int records = 1 << 20;	// ring buffer size
+};
+
+extern struct trace_struct trace;
+
+/* programming executive of the 16-bit families (--pe), see eicsp.h */
+struct pe_struct {
+   int off = 0;				// plain ICSP only
+   const char *file = 0;		// PE image to write to executive memory first
+};
+
+extern struct pe_struct pe;
+
+/* 4-wire JTAG transport of PIC32 (--transport=jtag), see pic32.cpp */
+struct jtag_struct {
+   int on = 0;				// JTAG instead of 2-wire 4-phase ICSP
+   int tms = 0, tdo = 0;	// TCK is pic_clk, TDI is pic_data
+};
+
+extern struct jtag_struct jtag;
 
 #endif /* COMMON_H_ */
@@ -0,0 +1,148 @@
+/*
+ * Raspberry Pi PIC Programmer using GPIO connector
+ * https://github.com/WallaceIT/picberry
+ * Copyright 2014 Francesco Valla
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <time.h>
+
+#include "common.h"
+
+/*
+ * Waits shorter than SPIN_THRESHOLD are done by counting loop iterations,
+ * calibrated once at startup; longer ones poll CLOCK_MONOTONIC_RAW, whose
+ * read cost is negligible compared to the wait itself.
+ */
+#define SPIN_THRESHOLD		2000	// ns
+#define CALIBRATION_LOOPS	200000
+#define CALIBRATION_RUNS	5
+
+/* sub-microsecond timings are clock/data edges, longer ones are waits */
+#define EDGE_LIMIT			1000	// ns
+
+struct timing_struct timing;
+
+/*
+ * Longest stall, in ns, per thread: the longest gap between two clock
+ * reads while polling, or with delay_track() on, the longest time between
+ * two waits beyond the length of the first one, which covers a
+ * preemption in the middle of a clock edge too
+ */
+thread_local uint64_t delay_max_gap;
+static thread_local bool track;
+static thread_local uint64_t track_last, track_len;
+
+/* called with every wait when set (session recording) */
+void (*delay_hook)(unsigned int ns);
+
+/* spin loop iterations per nanosecond, 16.16 fixed point */
+static uint32_t spin_per_ns = 1 << 16;
+
+static inline void spin(uint32_t loops)
+{
+	while (loops--)
+		__asm__ __volatile__("");
+}
+
+/* Measure the spin loop speed against CLOCK_MONOTONIC_RAW */
+void delay_init(void)
+{
+	uint64_t start, elapsed, best = ~0ULL;
+
+	/* keep the fastest run: slower ones were preempted */
+	for (int i = 0; i < CALIBRATION_RUNS; i++) {
+		start = now_ns();
+		spin(CALIBRATION_LOOPS);
+		elapsed = now_ns() - start;
+		if (elapsed < best)
+			best = elapsed;
+	}
+
+	if (best == 0)
+		best = 1;
+	spin_per_ns = (uint32_t)(((uint64_t)CALIBRATION_LOOPS << 16) / best);
+	if (spin_per_ns == 0)
+		spin_per_ns = 1;
+}
+
+/* Busy-wait for (at least) howLong nanoseconds */
+void delay_ns(unsigned int howLong)
+{
+	uint64_t now, last, end;
+
+	if (delay_hook)
+		delay_hook(howLong);
+
+	if (track) {
+		now = now_ns();
+		if (track_last && now - track_last > track_len + delay_max_gap)
+			delay_max_gap = now - track_last - track_len;
+		track_last = now;
+		track_len = howLong;
+	}
+
+	if (howLong == 0)
+		return;
+
+	if (howLong < SPIN_THRESHOLD) {
+		spin((uint32_t)(((uint64_t)howLong * spin_per_ns) >> 16) + 1);
+		return;
+	}
+
+	/* a long gap between two reads means that we were not running */
+	last = now_ns();
+	end = last + howLong;
+	while ((now = now_ns()) < end) {
+		if (now - last > delay_max_gap)
+			delay_max_gap = now - last;
+		last = now;
+	}
+}
+
+/* Measure the stalls between waits (costs a clock read per wait) */
+void delay_track(bool on)
+{
+	track = on;
+	track_last = 0;
+}
+
+/*
+ * Fill delays[] from a family timing profile for the selected preset.
+ * Only edge timings are affected: "safe" rounds them up to 1us, "custom"
+ * scales them; waits (entry, erase and write times) are never shortened.
+ */
+void timing_resolve(const unsigned int *profile, unsigned int *delays,
+					int count)
+{
+	for (int i = 0; i < count; i++) {
+		delays[i] = profile[i];
+		if (profile[i] == 0 || profile[i] >= EDGE_LIMIT)
+			continue;
+
+		switch (timing.preset) {
+			case TIMING_SAFE:
+				delays[i] = EDGE_LIMIT;
+				break;
+			case TIMING_CUSTOM:
+				delays[i] = profile[i] * timing.scale / 100;
+				break;
+			default:
+				break;
+		}
+	}
+}
@@ -43,10 +43,26 @@ class Pic{
 		char			name[25];
 		memory 			mem;
 
+		/*
+		 * Programming head: the ICSP pins, the options and the job state
+		 * of this instance. Pins and options start from the globals;
+		 * with --head every head has its own Pic, on its own thread.
+		 */
+		int				pic_clk, pic_data, pic_mclr;
+		flags_struct	flags;
+		unsigned int	counter;		// progress, percent
+		uint16_t		nvmcon;
+
 		Pic(uint8_t sf=0){
 			device_id=0;
 			device_rev=0;
 			subfamily=sf;
+			pic_clk=::pic_clk;
+			pic_data=::pic_data;
+			pic_mclr=::pic_mclr;
+			flags=::flags;
+			counter=0;
+			nvmcon=0;
 		};
 		virtual ~Pic(){};
 
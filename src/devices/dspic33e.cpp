@@ -25,204 +25,582 @@
 
 #include "dspic33e.h"
 
-/* delays (in microseconds; nanoseconds are rounded to 1us) */
-#define DELAY_P1   			1		// 200ns
-#define DELAY_P1A			1		// 80ns
-#define DELAY_P1B			1		// 80ns
-#define DELAY_P2			1		// 15ns
-#define DELAY_P3			1		// 15ns
-#define DELAY_P4			1		// 40ns
-#define DELAY_P4A			1		// 40ns
-#define DELAY_P5			1		// 20ns
-#define DELAY_P6			1		// 100ns
-#define DELAY_P7_DSPIC33E	25000	// 25ms
-#define DELAY_P7_PIC24FJ	50000	// 50ms
-#define DELAY_P8			12		// 12us
-#define DELAY_P9A			10		// 10us
-#define DELAY_P9B			15		// 15us - 23us max!
-#define DELAY_P10			1		// 400ns
-#define DELAY_P11_DSPIC33E	116000	// 116ms
-#define DELAY_P11_PIC24FJ	25000	// 25ms
-#define DELAY_P12_DSPIC33E	23000	// 23ms
-#define DELAY_P12_PIC24FJ	25000	// 25ms
-#define DELAY_P13_DSPIC33E	1600	// 1.6ms
-#define DELAY_P13_PIC24FJ	20		// 20us
-#define DELAY_P14			1		// 1us MAX!
-#define DELAY_P15			1		// 10ns
-#define DELAY_P16			0		// 0s
-#define DELAY_P17   		0		// 0s - 100ns MAX!
-#define DELAY_P18			1000	// 1ms
-#define DELAY_P19			1		// 25ns
-#define DELAY_P20			25000	// 25ms
-#define DELAY_P21			1		// 1us - 500us MAX!
+/* ICSP timing profile (datasheet values, in nanoseconds) */
+enum { P1, P1A, P1B, P2, P3, P4, P4A, P5, P6, P7_DSPIC33E, P7_PIC24FJ, P8,
+	P9A, P9B, P10, P11_DSPIC33E, P11_PIC24FJ, P12_DSPIC33E, P12_PIC24FJ,
+	P13_DSPIC33E, P13_PIC24FJ, P14, P15, P16, P17, P18, P19, P20, P21,
+	NUM_TIMINGS };
+
+static const unsigned int profile[NUM_TIMINGS] = {
+	200,			// P1: 200ns
+	80,				// P1A: 80ns
+	80,				// P1B: 80ns
+	15,				// P2: 15ns
+	15,				// P3: 15ns
+	40,				// P4: 40ns
+	40,				// P4A: 40ns
+	20,				// P5: 20ns
+	100,			// P6: 100ns
+	25000000,		// P7_DSPIC33E: 25ms
+	50000000,		// P7_PIC24FJ: 50ms
+	12000,			// P8: 12us
+	10000,			// P9A: 10us
+	15000,			// P9B: 15us - 23us max!
+	400,			// P10: 400ns
+	116000000,		// P11_DSPIC33E: 116ms
+	25000000,		// P11_PIC24FJ: 25ms
+	23000000,		// P12_DSPIC33E: 23ms
+	25000000,		// P12_PIC24FJ: 25ms
+	1600000,		// P13_DSPIC33E: 1.6ms
+	20000,			// P13_PIC24FJ: 20us
+	1000,			// P14: 1us MAX!
+	10,				// P15: 10ns
+	0,				// P16: 0s
+	0,				// P17: 0s - 100ns MAX!
+	1000000,		// P18: 1ms
+	25,				// P19: 25ns
+	25000000,		// P20: 25ms
+	1000			// P21: 1us - 500us MAX!
+};
+
+/* profile resolved for the selected --timing preset, by each head thread */
+static thread_local unsigned int delays[NUM_TIMINGS];
 
 #define ENTER_PROGRAM_KEY	0x4D434851
 
+#define ERASE_PAGE			0x800		/* erase page, in addresses */
+
 #define reset_pc() send_cmd(0x040200)
 #define send_nop() send_cmd(0x000000)
 
-static unsigned int counter=0;
-static uint16_t nvmcon;
+#define RETRY_ROWS	8	/* failed rows a gang target can have retried */
+
+/*
+ * A code memory row packed for write(): the literals of its 32 latch loads
+ * or, for a bit-sliced gang, their PGD masks (see gang_pack()).
+ */
+struct code_row {
+	uint32_t addr;
+	uint16_t lit[32][6];
+	uint32_t mask[32][6][16];
+};
+
+struct code_rows {
+	memory *mem;		// one per target, mem[0] only when not sliced
+	int targets;
+	uint32_t addr;		// next row to pack
+	uint32_t filled;	// progress: locations to program
+	uint32_t counter;	// progress: last %
+};
+
+/*
+ * Load the images of the other targets of a bit-sliced gang into image[],
+ * image[0] is mem (as are all of them when it is shared); false if any of
+ * them failed
+ */
+static bool load_images(memory *mem, memory *image)
+{
+	for (int t = 1; t < gang.n; t++) {
+		if (!gang.image[1]) {
+			image[t] = *mem;
+			continue;
+		}
+		image[t].program_memory_size = mem->program_memory_size;
+		image[t].code_memory_size = mem->code_memory_size;
+		image[t].location = (uint16_t*) calloc(mem->program_memory_size,
+											  sizeof(uint16_t));
+		image[t].filled = (bool*) calloc(mem->program_memory_size,
+										 sizeof(bool));
+		if (!image[t].location || !image[t].filled ||
+			!read_inhx(gang.image[t], &image[t]))
+			return false;
+	}
+	return true;
+}
+
+static void free_images(memory *image)
+{
+	for (int t = 1; t < GANG_MAX; t++) {
+		if (image[t].location == image[0].location)
+			continue;
+		free(image[t].location);
+		free(image[t].filled);
+		image[t].location = 0;
+		image[t].filled = 0;
+	}
+}
+
+/*
+ * Record that target t failed the verify of the row at addr; true once it
+ * failed more rows than are worth retrying
+ */
+static bool row_failed(uint32_t *failed, int t, uint32_t addr)
+{
+	if (failed[addr/256] & (1 << t))
+		return false;
+	failed[addr/256] |= 1 << t;
+	if (!gang.rows[t]++)
+		gang.first[t] = addr;
+	return gang.rows[t] > RETRY_ROWS;
+}
+
+/* The literals of the latch load of 8 words at addr */
+static void pack_lit(memory *mem, uint32_t addr, uint16_t *lit)
+{
+	uint32_t data[8];
+	uint16_t j;
+
+	for(j=0;j<8;j++){
+		if (mem->filled[addr+j]) data[j] = mem->location[addr+j];
+		else data[j] = 0xFFFF;
+		if(flags.debug)
+			fprintf(stderr,"\n  Writing 0x%04X to address 0x%06X ", data[j], addr+j );
+	}
+
+	lit[0] = data[0];								// MOV #<LSW0>, W0
+	lit[1] = (data[3] << 8) | (data[1] & 0x00FF);	// MOV #<MSB1:MSB0>, W1
+	lit[2] = data[2];								// MOV #<LSW1>, W2
+	lit[3] = data[4];								// MOV #<LSW2>, W3
+	lit[4] = (data[7] << 8) | (data[5] & 0x00FF);	// MOV #<MSB3:MSB2>, W4
+	lit[5] = data[6];								// MOV #<LSW3>, W5
+}
+
+/* Pack the next row that is not empty (on any target) (row_pipe packer) */
+static bool pack_code_row(void *ctx, code_row *row)
+{
+	code_rows *r = (code_rows *) ctx;
+	memory *mem = r->mem;
+	uint16_t lit[GANG_MAX][6], col[GANG_MAX];
+	uint32_t addr;
+	uint16_t k, p;
+	int t;
+	bool skip;
+
+	for (;; r->addr += 256) {
+		if (r->addr >= mem->code_memory_size)
+			return false;
+
+		skip = 1;
+		for(t=0; t<r->targets; t++)
+			for(k=0; k<256; k+=2)
+				if(mem[t].filled[r->addr+k]) skip = 0;
+		if(!skip)
+			break;
+	}
+
+	addr = row->addr = r->addr;
+	r->addr += 256;
+
+	for(p=0; p<32; p++){
+
+		if(r->targets == 1)
+			pack_lit(mem, addr, row->lit[p]);
+		else{
+			for(t=0; t<r->targets; t++)
+				pack_lit(&mem[t], addr, lit[t]);
+			for(k=0; k<6; k++){
+				for(t=0; t<r->targets; t++)
+					col[t] = lit[t][k];
+				gang_pack(col, row->mask[p][k]);
+			}
+		}
+
+		addr = addr+8;
+	}
+
+	return true;
+}
+
+/* Print the progress after a row is latched (row_pipe reporter) */
+static void report_code_row(void *ctx, const code_row *row)
+{
+	code_rows *r = (code_rows *) ctx;
+	uint32_t addr = row->addr+256;
+
+	if(r->counter != addr*100/r->filled){
+		if(flags.client)
+			fprintf(stdout,"@%03d", (addr*100/(r->filled+0x100)));
+		if(!flags.debug)
+			fprintf(stderr,"\b\b\b\b\b[%2d%%]", addr*100/(r->filled+0x100));
+		r->counter = addr*100/r->filled;
+	}
+}
 
 /* Send a 24-bit command to the PIC (LSB first) through a SIX instruction */
-void dspic33e::send_cmd(uint32_t cmd)
+template<class io>
+void dspic33e<io>::send_cmd(uint32_t cmd)
 {
 	uint8_t i;
+	int pgd = 0;			/* PGD level, cleared below */
 
-	GPIO_CLR(pic_data);
+	io::mark(OP_SEND_CMD, cmd);
+	io::clr(pic_data);
 
 	/* send the SIX = 0x0000 instruction */
 	for (i = 0; i < 4; i++) {
-		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
-		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P1A);
+		io::set(pic_clk);
+		delay_ns(delays[P1B]);
+		io::clr(pic_clk);
+		delay_ns(delays[P1A]);
 	}
 
-	delay_us(DELAY_P4);
+	delay_ns(delays[P4]);
 
 	/* send the 24-bit command */
 	for (i = 0; i < 24; i++) {
-		if ( (cmd >> i) & 0x00000001 )
-			GPIO_SET(pic_data);
-		else
-			GPIO_CLR(pic_data);
-		delay_us(DELAY_P1A);
-		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
-		GPIO_CLR(pic_clk);
+		delay_ns(delays[P1A]);
+		pgc_rise<io>(pic_clk, pic_data, (cmd >> i) & 0x01, pgd);
+		delay_ns(delays[P1B]);
+		io::clr(pic_clk);
 	}
 
-	delay_us(DELAY_P4A);
+	delay_ns(delays[P4A]);
 
 }
 
 /* Send five NOPs (should be with a frequency greater than 2MHz...) */
-inline void dspic33e::send_prog_nop(void)
+template<class io>
+inline void dspic33e<io>::send_prog_nop(void)
 {
 	uint8_t i;
 
-	GPIO_CLR(pic_data);
+	io::mark(OP_SEND_NOP);
+	io::clr(pic_data);
 
 	/* send 5 NOP commands */
 	for (i = 0; i < 140; i++) {
-		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1A);
-		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P1B);
+		io::set(pic_clk);
+		delay_ns(delays[P1A]);
+		io::clr(pic_clk);
+		delay_ns(delays[P1B]);
 	}
 }
 
 /* Read 16-bit data word from the PIC (LSB first) through a REGOUT inst */
-uint16_t dspic33e::read_data(void)
+template<class io>
+uint16_t dspic33e<io>::read_data(void)
 {
 	uint8_t i;
 	uint16_t data = 0;
+	int pgd = 0;			/* PGD level, cleared below */
 
-	GPIO_CLR(pic_data);
-	GPIO_CLR(pic_clk);
+	io::mark(OP_READ_DATA);
+	io::clr2(pic_data, pic_clk);
 
 	/* send the REGOUT=0x0001 instruction */
 	for (i = 0; i < 4; i++) {
-		if ( (0x0001 >> i) & 0x001 )
-			GPIO_SET(pic_data);
-		else
-			GPIO_CLR(pic_data);
-		delay_us(DELAY_P1A);
-		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
-		GPIO_CLR(pic_clk);
+		delay_ns(delays[P1A]);
+		pgc_rise<io>(pic_clk, pic_data, (0x0001 >> i) & 0x01, pgd);
+		delay_ns(delays[P1B]);
+		io::clr(pic_clk);
 	}
 
-	delay_us(DELAY_P4);
+	delay_ns(delays[P4]);
 
 	/* idle for 8 clock cycles, waiting for the data to be ready */
 	for (i = 0; i < 8; i++) {
-		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
-		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P1A);
+		io::set(pic_clk);
+		delay_ns(delays[P1B]);
+		io::clr(pic_clk);
+		delay_ns(delays[P1A]);
 	}
 
-	delay_us(DELAY_P5);
+	delay_ns(delays[P5]);
 
-	GPIO_IN(pic_data);
+	io::in(pic_data);
 
 	/* read a 16-bit data word */
 	for (i = 0; i < 16; i++) {
-		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
-		data |= ( GPIO_LEV(pic_data) & 0x00000001 ) << i;
-		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P1A);
+		io::set(pic_clk);
+		delay_ns(delays[P1B]);
+		data |= ( io::lev(pic_data) & 0x00000001 ) << i;
+		io::clr(pic_clk);
+		delay_ns(delays[P1A]);
 	}
 
-	delay_us(DELAY_P4A);
-	GPIO_OUT(pic_data);
+	delay_ns(delays[P4A]);
+	io::out(pic_data);
 	return data;
 }
 
+/* Compile send_cmd(cmd); bits 4..19 (a literal) from patch word slot */
+template<class io>
+void dspic33e<io>::wave_cmd(wave *w, uint32_t cmd, int slot)
+{
+	uint8_t i;
+
+	wave_emit(w, WAVE_MARK, cmd, 0, OP_SEND_CMD);
+	wave_write(w, pic_data, 0);
+
+	/* send the SIX = 0x0000 instruction */
+	for (i = 0; i < 4; i++) {
+		wave_emit(w, WAVE_SET, pic_clk);
+		wave_delay(w, delays[P1B]);
+		wave_emit(w, WAVE_CLR, pic_clk);
+		wave_delay(w, delays[P1A]);
+	}
+
+	wave_delay(w, delays[P4]);
+
+	/* send the 24-bit command */
+	for (i = 0; i < 24; i++) {
+		wave_delay(w, delays[P1A]);
+		if (slot >= 0 && i >= 4 && i < 20)
+			wave_rise_patch(w, pic_clk, pic_data, slot, i - 4);
+		else
+			wave_rise(w, pic_clk, pic_data, (cmd >> i) & 0x01);
+		wave_delay(w, delays[P1B]);
+		wave_emit(w, WAVE_CLR, pic_clk);
+	}
+
+	wave_delay(w, delays[P4A]);
+}
+
+/* Compile read_data() into result word */
+template<class io>
+void dspic33e<io>::wave_read_data(wave *w, int word)
+{
+	uint8_t i;
+
+	wave_emit(w, WAVE_MARK, 0, 0, OP_READ_DATA);
+	wave_emit(w, WAVE_CLR2, pic_data, pic_clk);
+	w->pgd = 0;
+
+	/* send the REGOUT=0x0001 instruction */
+	for (i = 0; i < 4; i++) {
+		wave_delay(w, delays[P1A]);
+		wave_rise(w, pic_clk, pic_data, (0x0001 >> i) & 0x01);
+		wave_delay(w, delays[P1B]);
+		wave_emit(w, WAVE_CLR, pic_clk);
+	}
+
+	wave_delay(w, delays[P4]);
+
+	/* idle for 8 clock cycles, waiting for the data to be ready */
+	for (i = 0; i < 8; i++) {
+		wave_emit(w, WAVE_SET, pic_clk);
+		wave_delay(w, delays[P1B]);
+		wave_emit(w, WAVE_CLR, pic_clk);
+		wave_delay(w, delays[P1A]);
+	}
+
+	wave_delay(w, delays[P5]);
+
+	wave_emit(w, WAVE_IN, pic_data);
+	w->pgd = -1;
+
+	/* read a 16-bit data word */
+	for (i = 0; i < 16; i++) {
+		wave_emit(w, WAVE_SET, pic_clk);
+		wave_delay(w, delays[P1B]);
+		wave_lev(w, pic_data, word, i);
+		wave_emit(w, WAVE_CLR, pic_clk);
+		wave_delay(w, delays[P1A]);
+	}
+
+	wave_delay(w, delays[P4A]);
+	wave_emit(w, WAVE_OUT, pic_data);
+}
+
+/* TBLRD sequence reading the four instruction words at W6 into W0:W5 */
+static const uint32_t row_tblrd[8] = {
+	0xBA1B96, 0xBADBB6, 0xBADBD6, 0xBA1BB6,
+	0xBA1B96, 0xBADBB6, 0xBADBD6, 0xBA0BB6
+};
+
+/* TBLWT sequence loading W0:W5 into the write latches at W7 */
+static const uint32_t row_tblwt[8] = {
+	0xBB0BB6, 0xBBDBB6, 0xBBEBB6, 0xBB1BB6,
+	0xBB0BB6, 0xBBDBB6, 0xBBEBB6, 0xBB1BB6
+};
+
+/* Fetch the next four memory locations to W0:W5 and read them out */
+template<class io>
+void dspic33e<io>::compile_row_read(void)
+{
+	int i, j;
+	wave *w = &row_read;
+
+	wave_cmd(w, 0xEB0380);	// CLR W7
+	wave_cmd(w, 0x000000);
+	for (i = 0; i < 8; i++) {
+		wave_cmd(w, row_tblrd[i]);
+		for (j = 0; j < 5; j++)
+			wave_cmd(w, 0x000000);
+	}
+
+	/* read six data words (16 bits each) */
+	for (i = 0; i < 6; i++) {
+		wave_cmd(w, 0x887C40 + i);
+		wave_cmd(w, 0x000000);
+		wave_read_data(w, i);
+		wave_cmd(w, 0x000000);
+	}
+
+	for (i = 0; i < 3; i++)
+		wave_cmd(w, 0x000000);
+	wave_cmd(w, 0x040200);	// reset_pc()
+	for (i = 0; i < 3; i++)
+		wave_cmd(w, 0x000000);
+}
+
+/* Load the six literals to W0:W5 and then to the write latches */
+template<class io>
+void dspic33e<io>::compile_row_latch(void)
+{
+	int i;
+	wave *w = &row_latch;
+
+	for (i = 0; i < 6; i++)
+		wave_cmd(w, 0x200000 | i, i);	// MOV #<patch i>, Wi
+
+	/* set_W6_and_load_latches */
+	wave_cmd(w, 0xEB0300);
+	wave_cmd(w, 0x000000);
+	for (i = 0; i < 8; i++) {
+		wave_cmd(w, row_tblwt[i]);
+		wave_cmd(w, 0x000000);
+		wave_cmd(w, 0x000000);
+	}
+}
+
 /* enter program mode */
-void dspic33e::enter_program_mode(void)
+template<class io>
+void dspic33e<io>::enter_program_mode(void)
+{
+	io::mark(OP_ENTER);
+	timing_resolve(profile, delays, NUM_TIMINGS);
+	pe_time = { delays[P1A], delays[P1B], delays[P9A], delays[P9B],
+				EICSP_TIMEOUT };
+	wave_reset(&row_read);
+	wave_reset(&row_latch);
+	wave_reset(&row_mov);
+
+	enter_mode(ENTER_PROGRAM_KEY);
+}
+
+/* Cycle MCLR and shift in key: ICSP or Enhanced ICSP (ENTER_EICSP_KEY) */
+template<class io>
+void dspic33e<io>::enter_mode(uint32_t key)
 {
 	int i;
 
-	GPIO_IN(pic_mclr);
-	GPIO_OUT(pic_mclr);
+	io::in(pic_mclr);
+	io::out(pic_mclr);
 
-	GPIO_CLR(pic_clk);
+	io::clr(pic_clk);
 
-	GPIO_CLR(pic_mclr);		/*  remove VDD from MCLR pin */
-	delay_us(DELAY_P6);
-	GPIO_SET(pic_mclr);		/*  apply VDD to MCLR pin */
-	delay_us(DELAY_P21);
-	GPIO_CLR(pic_mclr);		/* remove VDD from MCLR pin */
-	delay_us(DELAY_P18);
+	io::clr(pic_mclr);		/*  remove VDD from MCLR pin */
+	delay_ns(delays[P6]);
+	io::set(pic_mclr);		/*  apply VDD to MCLR pin */
+	delay_ns(delays[P21]);
+	io::clr(pic_mclr);		/* remove VDD from MCLR pin */
+	delay_ns(delays[P18]);
 
 	/* Shift in the "enter program mode" key sequence (MSB first) */
 	for (i = 31; i > -1; i--) {
-		if ( (ENTER_PROGRAM_KEY >> i) & 0x01 )
-			GPIO_SET(pic_data);
+		if ( (key >> i) & 0x01 )
+			io::set(pic_data);
 		else
-			GPIO_CLR(pic_data);
-		delay_us(DELAY_P1A);
-		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
-		GPIO_CLR(pic_clk);
+			io::clr(pic_data);
+		delay_ns(delays[P1A]);
+		io::set(pic_clk);
+		delay_ns(delays[P1B]);
+		io::clr(pic_clk);
 
 	}
-	GPIO_CLR(pic_data);
-	delay_us(DELAY_P19);
-	GPIO_SET(pic_mclr);
+	io::clr(pic_data);
+	delay_ns(delays[P19]);
+	io::set(pic_mclr);
 	if(subfamily == SF_DSPIC33E)
-		delay_us(DELAY_P7_DSPIC33E);
+		delay_ns(delays[P7_DSPIC33E]);
 	else if(subfamily == SF_PIC24FJ)
-		delay_us(DELAY_P7_PIC24FJ);
+		delay_ns(delays[P7_PIC24FJ]);
+
+	if(key != ENTER_PROGRAM_KEY)
+		return;
 
 	/* idle for 5 clock cycles */
 	for (i = 0; i < 5; i++) {
-		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
-		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P1A);
+		io::set(pic_clk);
+		delay_ns(delays[P1B]);
+		io::clr(pic_clk);
+		delay_ns(delays[P1A]);
 	}
 
 }
 
 /* exit program mode */
-void dspic33e::exit_program_mode(void)
+template<class io>
+void dspic33e<io>::exit_program_mode(void)
+{
+	io::clr2(pic_clk, pic_data);
+	delay_ns(delays[P16]);
+	io::clr(pic_mclr);		/* remove VDD from MCLR pin */
+	delay_ns(delays[P17]);	/* wait (at least) P17 */
+	io::set(pic_mclr);
+	io::in(pic_mclr);
+}
+
+/* Erase the page of program (or executive) memory at addr */
+template<class io>
+void dspic33e<io>::erase_page(uint32_t addr)
 {
-	GPIO_CLR(pic_clk);
-	GPIO_CLR(pic_data);
-	delay_us(DELAY_P16);
-	GPIO_CLR(pic_mclr);		/* remove VDD from MCLR pin */
-	delay_us(DELAY_P17);	/* wait (at least) P17 */
-	GPIO_SET(pic_mclr);
-	GPIO_IN(pic_mclr);
+	send_nop();
+	send_nop();
+	send_nop();
+	reset_pc();
+	send_nop();
+	send_nop();
+	send_nop();
+
+	/* Set the NVMCON to erase a page */
+	send_cmd(0x24003A);
+	send_cmd(0x88394A);
+	send_nop();
+	send_nop();
+
+	send_cmd(0x200002 | ((addr & 0x0000FFFF) << 4) );
+	send_cmd(0x200003 | ((addr & 0x00FF0000) >> 12) );
+	send_cmd(0x883963);
+	send_cmd(0x883952);
+
+	/* Initiate the erase cycle */
+	send_cmd(0x200551);
+	send_cmd(0x883971);
+	send_cmd(0x200AA1);
+	send_cmd(0x883971);
+	send_cmd(0xA8E729);
+	send_nop();
+	send_nop();
+	send_nop();
+
+	if(subfamily == SF_DSPIC33E)
+		delay_ns(delays[P12_DSPIC33E]);
+	else if(subfamily == SF_PIC24FJ)
+		delay_ns(delays[P12_PIC24FJ]);
+
+	do{
+		io::mark(OP_POLL);
+		send_nop();
+		send_cmd(0x803940);
+		send_nop();
+		send_cmd(0x887C40);
+		send_nop();
+		nvmcon = read_data();
+		send_nop();
+		send_nop();
+		send_nop();
+		reset_pc();
+		send_nop();
+		send_nop();
+		send_nop();
+	} while(io::poll((nvmcon & 0x8000) == 0x8000));
 }
 
 /* read the device ID and revision; returns only the id */
-bool dspic33e::read_device_id(void)
+template<class io>
+bool dspic33e<io>::read_device_id(void)
 {
 	bool found = 0;
 
@@ -278,12 +656,24 @@ bool dspic33e::read_device_id(void)
 }
 
 /* Check if the device is blank */
-uint8_t dspic33e::blank_check(void)
+template<class io>
+uint8_t dspic33e<io>::blank_check(void)
 {
 	uint32_t addr;
 	unsigned short i;
 	uint16_t data[8], raw_data[6];
 	uint8_t ret = 0;
+	int blank;
+
+	/* one QBLANK through the PE, ICSP if it fails */
+	if(use_pe){
+		pe_enter();
+		blank = eicsp_qblank<io>(pic_clk, pic_data, pe_timing(), 0,
+								 (mem.code_memory_size + 1) / 2);
+		pe_leave();
+		if(blank >= 0)
+			return blank ? 0 : 1;
+	}
 
 	if(!flags.debug) cerr << "[ 0%]";
 
@@ -307,73 +697,10 @@ uint8_t dspic33e::blank_check(void)
 			send_cmd(0x200006 | ((addr & 0x0000FFFF) << 4) );	// MOV #<DestAddress15:0>, W6
 		}
 
-		/* Fetch the next four memory locations and put them to W0:W5 */
-		send_cmd(0xEB0380);	// CLR W7
-		send_nop();
-		send_cmd(0xBA1B96);
-		send_nop();
-		send_nop();
-		send_nop();
-		send_nop();
-		send_nop();
-		send_cmd(0xBADBB6);
-		send_nop();
-		send_nop();
-		send_nop();
-		send_nop();
-		send_nop();
-		send_cmd(0xBADBD6);
-		send_nop();
-		send_nop();
-		send_nop();
-		send_nop();
-		send_nop();
-		send_cmd(0xBA1BB6);
-		send_nop();
-		send_nop();
-		send_nop();
-		send_nop();
-		send_nop();
-		send_cmd(0xBA1B96);
-		send_nop();
-		send_nop();
-		send_nop();
-		send_nop();
-		send_nop();
-		send_cmd(0xBADBB6);
-		send_nop();
-		send_nop();
-		send_nop();
-		send_nop();
-		send_nop();
-		send_cmd(0xBADBD6);
-		send_nop();
-		send_nop();
-		send_nop();
-		send_nop();
-		send_nop();
-		send_cmd(0xBA0BB6);
-		send_nop();
-		send_nop();
-		send_nop();
-		send_nop();
-		send_nop();
-
-		/* read six data words (16 bits each) */
-		for(i=0; i<6; i++){
-			send_cmd(0x887C40 + i);
-			send_nop();
-			raw_data[i] = read_data();
-			send_nop();
-		}
-
-		send_nop();
-		send_nop();
-		send_nop();
-		reset_pc();
-		send_nop();
-		send_nop();
-		send_nop();
+		/* Fetch the next four memory locations to W0:W5 and read them */
+		if (row_read.len == 0)
+			compile_row_read();
+		wave_play<io>(&row_read, 0, raw_data);
 
 		/* store data correctly */
 		data[0] = raw_data[0];
@@ -385,6 +712,8 @@ uint8_t dspic33e::blank_check(void)
 		data[7] = (raw_data[4] & 0xFF00) >> 8;
 		data[6] = raw_data[5];
 
+		io::mark(OP_ROW, addr);
+		rt_checkpoint();
 		if(counter != addr*100/mem.code_memory_size){
 			counter = addr*100/mem.code_memory_size;
 			fprintf(stderr, "\b\b\b\b\b[%2d%%]", counter);	
@@ -420,7 +749,8 @@ uint8_t dspic33e::blank_check(void)
 }
 
 /* Bulk erase the chip */
-void dspic33e::bulk_erase(void)
+template<class io>
+void dspic33e<io>::bulk_erase(void)
 {
 
     send_nop();
@@ -446,12 +776,13 @@ void dspic33e::bulk_erase(void)
 	send_nop();
 
 	if(subfamily == SF_DSPIC33E)
-		delay_us(DELAY_P11_DSPIC33E);
+		delay_ns(delays[P11_DSPIC33E]);
 	else if(subfamily == SF_PIC24FJ)
-		delay_us(DELAY_P11_PIC24FJ);
+		delay_ns(delays[P11_PIC24FJ]);
 
 	/* wait while the erase operation completes */
 	do{
+		io::mark(OP_POLL);
 		send_cmd(0x803940);
 		send_nop();		
 		send_cmd(0x887C40);
@@ -464,13 +795,14 @@ void dspic33e::bulk_erase(void)
 		send_nop();
 		send_nop();
 		send_nop();
-	} while((nvmcon & 0x8000) == 0x8000);
+	} while(io::poll((nvmcon & 0x8000) == 0x8000));
 	
 	if(flags.client) fprintf(stdout, "@FIN");
 }
 
 /* Read PIC memory and write the contents to a .hex file */
-void dspic33e::read(char *outfile, uint32_t start, uint32_t count)
+template<class io>
+void dspic33e<io>::read(char *outfile, uint32_t start, uint32_t count)
 {
 	uint32_t addr, startaddr, stopaddr;
 	uint16_t data[8], raw_data[6];
@@ -497,8 +829,15 @@ void dspic33e::read(char *outfile, uint32_t start, uint32_t count)
 	send_nop();
 	send_nop();
 
+	if(use_pe){
+		pe_enter();
+		eicsp_read<io>(pic_clk, pic_data, pe_timing(), &mem, startaddr,
+					   stopaddr, counter);
+		pe_leave();
+	}
+
 	/* Output data to W0:W5; repeat until all desired code memory is read. */
-	for(addr=startaddr; addr < stopaddr; addr=addr+8) {
+	for(addr=startaddr; !use_pe && addr < stopaddr; addr=addr+8) {
 
 		if((addr & 0x0000FFFF) == 0 || startaddr != 0){
 			send_cmd(0x200000 | ((addr & 0x00FF0000) >> 12) );	// MOV #<DestAddress23:16>, W0
@@ -507,73 +846,10 @@ void dspic33e::read(char *outfile, uint32_t start, uint32_t count)
 			startaddr = 0;
 		}
 
-		/* Fetch the next four memory locations and put them to W0:W5 */
-		send_cmd(0xEB0380);	// CLR W7
-		send_nop();
-		send_cmd(0xBA1B96);
-		send_nop();
-		send_nop();
-		send_nop();
-		send_nop();
-		send_nop();
-		send_cmd(0xBADBB6);
-		send_nop();
-		send_nop();
-		send_nop();
-		send_nop();
-		send_nop();
-		send_cmd(0xBADBD6);
-		send_nop();
-		send_nop();
-		send_nop();
-		send_nop();
-		send_nop();
-		send_cmd(0xBA1BB6);
-		send_nop();
-		send_nop();
-		send_nop();
-		send_nop();
-		send_nop();
-		send_cmd(0xBA1B96);
-		send_nop();
-		send_nop();
-		send_nop();
-		send_nop();
-		send_nop();
-		send_cmd(0xBADBB6);
-		send_nop();
-		send_nop();
-		send_nop();
-		send_nop();
-		send_nop();
-		send_cmd(0xBADBD6);
-		send_nop();
-		send_nop();
-		send_nop();
-		send_nop();
-		send_nop();
-		send_cmd(0xBA0BB6);
-		send_nop();
-		send_nop();
-		send_nop();
-		send_nop();
-		send_nop();
-
-		/* read six data words (16 bits each) */
-		for(i=0; i<6; i++){
-			send_cmd(0x887C40 + i);
-			send_nop();
-			raw_data[i] = read_data();
-			send_nop();
-		}
-
-		send_nop();
-		send_nop();
-		send_nop();
-		reset_pc();
-		send_nop();
-		send_nop();
-		send_nop();
+		/* Fetch the next four memory locations to W0:W5 and read them */
+		if (row_read.len == 0)
+			compile_row_read();
+		wave_play<io>(&row_read, 0, raw_data);
 
 		/* store data correctly */
 		data[0] = raw_data[0];
@@ -601,6 +877,8 @@ void dspic33e::read(char *outfile, uint32_t start, uint32_t count)
 			}
 		}
 
+		io::mark(OP_ROW, addr);
+		rt_checkpoint();
 		if(counter != addr*100/stopaddr){
 			counter = addr*100/stopaddr;
 			if(flags.client)
@@ -655,15 +933,263 @@ void dspic33e::read(char *outfile, uint32_t start, uint32_t count)
 	write_inhx(&mem, outfile);
 }
 
+/* Point NVMADR to a code row and load it into the write latches */
+template<class io>
+void dspic33e<io>::latch_row(code_row *row)
+{
+	uint32_t addr = row->addr;
+	uint16_t p;
+
+	/* Set the NVMADRU/NVMADR register-pair to point to the correct row */
+	send_cmd(0x200002 | ((addr & 0x0000FFFF) << 4) );
+	send_cmd(0x200003 | ((addr & 0x00FF0000) >> 12) );
+	send_cmd(0x883963);
+	send_cmd(0x883952);
+
+	send_cmd(0x200FAC);
+	send_cmd(0x8802AC);
+	send_cmd(0x200007);
+
+	/* load W0:W5, set_W6_and_load_latches */
+	for(p=0; p<32; p++)
+		if(gang_slice<io>::sliced && gang.n > 1)
+			wave_play_gang<io>(&row_latch, row->mask[p], 0);
+		else
+			wave_play<io>(&row_latch, row->lit[p], 0);
+}
+
+/* Program the latched row and wait for the end of the write cycle */
+template<class io>
+void dspic33e<io>::program_row(void)
+{
+	/* Set the NVMCON to program 128 instruction words */
+	send_cmd(0x24002A);
+	send_cmd(0x88394A);
+	send_nop();
+	send_nop();
+
+	/* Initiate the write cycle */
+	send_cmd(0x200551);
+	send_cmd(0x883971);
+	send_cmd(0x200AA1);
+	send_cmd(0x883971);
+	send_cmd(0xA8E729);
+	send_prog_nop();	// FIXME: timing???
+
+	if(subfamily == SF_DSPIC33E)
+		delay_ns(delays[P13_DSPIC33E]);
+	else if(subfamily == SF_PIC24FJ)
+		delay_ns(delays[P13_PIC24FJ]);
+
+	do{
+		io::mark(OP_POLL);
+		send_nop();
+		send_cmd(0x803940);
+		send_nop();
+		send_cmd(0x887C40);
+		send_nop();
+		nvmcon = read_data();
+		send_nop();
+		send_nop();
+		send_nop();
+		reset_pc();
+		send_nop();
+		send_nop();
+		send_nop();
+	} while(io::poll((nvmcon & 0x8000) == 0x8000));
+}
+
+/* Write the row of m at addr (128 instructions) */
+template<class io>
+void dspic33e<io>::write_row(memory *m, uint32_t addr)
+{
+	code_rows one = { m, 1, addr };
+	code_row row;
+
+	if (row_latch.len == 0)
+		compile_row_latch();
+
+	if(pack_code_row(&one, &row)){
+		latch_row(&row);
+		program_row();
+	}
+}
+
+/*
+ * Read back the 8 words at addr and compare them with the image of each
+ * target in want (a bit per target); the targets that differ
+ */
+template<class io>
+uint32_t dspic33e<io>::verify_block(uint32_t addr, memory *image, uint32_t want)
+{
+	bool sliced = gang_slice<io>::sliced && gang.n > 1;
+	int targets = sliced ? gang.n : 1;
+	uint32_t data[8], raw_data[6], level[6][16], bad = 0;
+	uint16_t raw[6][GANG_MAX];
+	uint16_t i;
+	int t;
+
+	send_cmd(0x200000 | ((addr & 0x00FF0000) >> 12) );	// MOV #<DestAddress23:16>, W0
+	send_cmd(0x8802A0);									// MOV W0, TBLPAG
+	send_cmd(0x200006 | ((addr & 0x0000FFFF) << 4) );	// MOV #<DestAddress15:0>, W6
+
+	if(sliced){
+		/* fetch and read the four words of every target at once */
+		wave_play_gang<io>(&row_read, 0, level);
+		for(i=0; i<6; i++)
+			gang_unpack(level[i], raw[i]);
+	}
+	else{
+		/* Fetch the next four memory locations and put them to W0:W5 */
+		send_cmd(0xEB0380);	// CLR W7
+		send_nop();
+		send_cmd(0xBA1B96);
+		send_nop();
+		send_nop();
+		send_nop();
+		send_nop();
+		send_nop();
+		send_cmd(0xBADBB6);
+		send_nop();
+		send_nop();
+		send_nop();
+		send_nop();
+		send_nop();
+		send_cmd(0xBADBD6);
+		send_nop();
+		send_nop();
+		send_nop();
+		send_nop();
+		send_nop();
+		send_cmd(0xBA1BB6);
+		send_nop();
+		send_nop();
+		send_nop();
+		send_nop();
+		send_nop();
+		send_cmd(0xBA1B96);
+		send_nop();
+		send_nop();
+		send_nop();
+		send_nop();
+		send_nop();
+		send_cmd(0xBADBB6);
+		send_nop();
+		send_nop();
+		send_nop();
+		send_nop();
+		send_nop();
+		send_cmd(0xBADBD6);
+		send_nop();
+		send_nop();
+		send_nop();
+		send_nop();
+		send_nop();
+		send_cmd(0xBA0BB6);
+		send_nop();
+		send_nop();
+		send_nop();
+		send_nop();
+		send_nop();
+
+		/* read six data words (16 bits each) */
+		for(i=0; i<6; i++){
+			send_cmd(0x887C40 + i);
+			send_nop();
+			raw_data[i] = read_data();
+			send_nop();
+		}
+
+		send_nop();
+		send_nop();
+		send_nop();
+		reset_pc();
+		send_nop();
+		send_nop();
+		send_nop();
+	}
+
+	for(t=0; t<targets; t++){
+		if(!(want & (1 << t)))
+			continue;
+		if(sliced)
+			for(i=0; i<6; i++)
+				raw_data[i] = raw[i][t];
+
+		/* store data correctly */
+		data[0] = raw_data[0];
+		data[1] = raw_data[1] & 0x00FF;
+		data[3] = (raw_data[1] & 0xFF00) >> 8;
+		data[2] = raw_data[2];
+		data[4] = raw_data[3];
+		data[5] = raw_data[4] & 0x00FF;
+		data[7] = (raw_data[4] & 0xFF00) >> 8;
+		data[6] = raw_data[5];
+
+		for(i=0; i<8; i++){
+			if (flags.debug)
+				fprintf(stderr, "\n addr = 0x%06X data = 0x%04X", (addr+i), data[i]);
+
+			if(image[t].filled[addr+i] && data[i] != image[t].location[addr+i]){
+				if(!sliced){
+					fprintf(stderr,"\n\n ERROR at address %06X: written %04X but %04X read!\n\n",
+									addr+i, image[t].location[addr+i], data[i]);
+					return 1;
+				}
+				/* counted per target, see gang_report() */
+				gang.verify[t]++;
+				bad |= 1 << t;
+			}
+		}
+	}
+
+	return bad;
+}
+
+/* Write the code rows of image (one per target) over ICSP */
+template<class io>
+void dspic33e<io>::write_rows(memory *image, int targets,
+							  unsigned int filled_locations)
+{
+	code_rows rows = { image, targets, 0, filled_locations, counter };
+	row_pipe<code_row> pipe(pack_code_row, &rows, report_code_row);
+	code_row *row;
+	uint32_t addr;
+
+	if (row_latch.len == 0)
+		compile_row_latch();
+
+	while ((row = pipe.next())) {
+		latch_row(row);
+		addr = row->addr+256;
+		pipe.done();
+		program_row();
+
+		io::mark(OP_ROW, addr);
+		rt_checkpoint();
+	};
+}
+
 /* Write contents of the .hex file to the PIC */
-void dspic33e::write(char *infile)
+template<class io>
+void dspic33e<io>::write(char *infile)
 {
-	uint16_t i,j,p;
+	uint16_t i;
 	uint16_t k;
-	bool skip;
-	uint32_t data[8],raw_data[6];
+	int t;
+	bool skip, written;
 	uint32_t addr = 0;
 
+	/* a gang is written and verified bit-sliced, each target on its own */
+	bool sliced = gang_slice<io>::sliced && gang.n > 1;
+	int targets = sliced ? gang.n : 1;
+	uint32_t live = (1 << targets) - 1, bad;
+	uint32_t *failed;		// the targets that failed each row
+	uint16_t word[GANG_MAX];
+	uint32_t mask[1][16];
+	memory image[GANG_MAX] = {};
+	code_row redo;
+
 	unsigned int filled_locations=1;
 
 	const char *regname[] = {"FGS","FOSCSEL","FOSC","FWDT","FPOR",
@@ -671,6 +1197,13 @@ void dspic33e::write(char *infile)
 
 	filled_locations = read_inhx(infile, &mem);
 	if(!filled_locations) return;
+	image[0] = mem;
+	if(sliced && !load_images(&mem, image)){
+		free_images(image);
+		return;
+	}
+	failed = (uint32_t*) calloc((mem.code_memory_size+ERASE_PAGE)/256,
+							   sizeof(uint32_t));
 
 	bulk_erase();
 
@@ -688,118 +1221,19 @@ void dspic33e::write(char *infile)
 	if(flags.client) fprintf(stdout, "@000");
 	counter=0;
 
-	for (addr = 0; addr < mem.code_memory_size; ){
-
-		skip = 1;
-
-		for(k=0; k<256; k+=2)
-			if(mem.filled[addr+k]) skip = 0;
-
-		if(skip){
-			addr=addr+256;
-			continue;
-		}
-
-		/* Set the NVMADRU/NVMADR register-pair to point to the correct row */
-		send_cmd(0x200002 | ((addr & 0x0000FFFF) << 4) );
-		send_cmd(0x200003 | ((addr & 0x00FF0000) >> 12) );
-		send_cmd(0x883963);
-		send_cmd(0x883952);
-
-		send_cmd(0x200FAC);
-		send_cmd(0x8802AC);
-		send_cmd(0x200007);
-
-		for(p=0; p<32; p++){
-
-			for(j=0;j<8;j++){
-				if (mem.filled[addr+j]) data[j] = mem.location[addr+j];
-				else data[j] = 0xFFFF;
-				if(flags.debug)
-					fprintf(stderr,"\n  Writing 0x%04X to address 0x%06X ", data[j], addr+j );
-			}
-
-			send_cmd(0x200000 | (data[0] << 4));										// MOV #<LSW0>, W0
-			send_cmd(0x200001 | (0x00FFFF & ((data[3] << 8) | (data[1] & 0x00FF))) <<4);// MOV #<MSB1:MSB0>, W1
-			send_cmd(0x200002 | (data[2] << 4));										// MOV #<LSW1>, W2
-			send_cmd(0x200003 | (data[4] << 4));										// MOV #<LSW2>, W3
-			send_cmd(0x200004 | (0x00FFFF & ((data[7] << 8) | (data[5] & 0x00FF))) <<4);// MOV #<MSB3:MSB2>, W4
-			send_cmd(0x200005 | (data[6] << 4));										// MOV #<LSW3>, W5
-
-			/* set_W6_and_load_latches */
-			send_cmd(0xEB0300);
-			send_nop();
-			send_cmd(0xBB0BB6);
-			send_nop();
-			send_nop();
-			send_cmd(0xBBDBB6);
-			send_nop();
-			send_nop();
-			send_cmd(0xBBEBB6);
-			send_nop();
-			send_nop();
-			send_cmd(0xBB1BB6);
-			send_nop();
-			send_nop();
-			send_cmd(0xBB0BB6);
-			send_nop();
-			send_nop();
-			send_cmd(0xBBDBB6);
-			send_nop();
-			send_nop();
-			send_cmd(0xBBEBB6);
-			send_nop();
-			send_nop();
-			send_cmd(0xBB1BB6);
-			send_nop();
-			send_nop();
-
-			addr = addr+8;
-		}
-		
-		/* Set the NVMCON to program 128 instruction words */
-		send_cmd(0x24002A);
-		send_cmd(0x88394A);
-		send_nop();
-		send_nop();
-
-		/* Initiate the write cycle */
-		send_cmd(0x200551);
-		send_cmd(0x883971);
-		send_cmd(0x200AA1);
-		send_cmd(0x883971);
-		send_cmd(0xA8E729);
-		send_prog_nop();	// FIXME: timing???
-
-		if(subfamily == SF_DSPIC33E)
-			delay_us(DELAY_P13_DSPIC33E);
-		else if(subfamily == SF_PIC24FJ)
-			delay_us(DELAY_P13_PIC24FJ);
-
-		do{
-			send_nop();
-			send_cmd(0x803940);
-			send_nop();
-			send_cmd(0x887C40);
-			send_nop();
-			nvmcon = read_data();
-			send_nop();
-			send_nop();
-			send_nop();
-			reset_pc();
-			send_nop();
-			send_nop();
-			send_nop();
-		} while((nvmcon & 0x8000) == 0x8000);
-
-		if(counter != addr*100/filled_locations){
-			if(flags.client)
-				fprintf(stdout,"@%03d", (addr*100/(filled_locations+0x100)));
-			if(!flags.debug)
-				fprintf(stderr,"\b\b\b\b\b[%2d%%]", addr*100/(filled_locations+0x100));
-			counter = addr*100/filled_locations;
+	if(use_pe){
+		pe_enter();
+		written = eicsp_write<io>(pic_clk, pic_data, pe_timing(), &mem, 128,
+								  filled_locations, counter);
+		pe_leave();
+		if(!written){
+			free(failed);
+			free_images(image);
+			return;
 		}
-	};
+	}
+	else
+		write_rows(image, targets, filled_locations);
 
 	if(!flags.debug) cerr << "\b\b\b\b\b\b";
 	if(flags.client) fprintf(stdout, "@100");
@@ -824,11 +1258,26 @@ void dspic33e::write(char *infile)
 
 	addr = 0x00F80004;
 
+	if(sliced && row_mov.len == 0)
+		wave_cmd(&row_mov, 0x200000, 0);
+
 	for(i=0; i<8; i++){
 
-		if(mem.filled[addr]){
+		skip = 1;
+		for(t=0; t<targets; t++)
+			if(image[t].filled[addr]) skip = 0;
+
+		if(!skip){
 
-			send_cmd(0x200000 | ((0x0000FFFF & mem.location[addr]) << 4));
+			if(sliced){
+				for(t=0; t<targets; t++)
+					word[t] = image[t].filled[addr] ?
+							  image[t].location[addr] : 0xFFFF;
+				gang_pack(word, mask[0]);
+				wave_play_gang<io>(&row_mov, mask, 0);
+			}
+			else
+				send_cmd(0x200000 | ((0x0000FFFF & mem.location[addr]) << 4));
 
 			send_cmd(0xBB0B80);
 			send_nop();
@@ -855,9 +1304,10 @@ void dspic33e::write(char *infile)
 			send_nop();
 			send_nop();
 
-			delay_us(DELAY_P20);
+			delay_ns(delays[P20]);
 
 			do{
+				io::mark(OP_POLL);
 				send_nop();
 				send_cmd(0x803940);
 				send_nop();
@@ -871,7 +1321,7 @@ void dspic33e::write(char *infile)
 				send_nop();
 				send_nop();
 				send_nop();
-			} while((nvmcon & 0x8000) == 0x8000);
+			} while(io::poll((nvmcon & 0x8000) == 0x8000));
 
 			if(flags.debug)
 				fprintf(stderr,"\n - %s set to 0x%01x",
@@ -888,7 +1338,13 @@ void dspic33e::write(char *infile)
 	delay_us(100000);
 
 	/* VERIFY CODE MEMORY */
-	if(!flags.noverify){
+	if(!flags.noverify && use_pe){
+		pe_enter();
+		eicsp_verify<io>(pic_clk, pic_data, pe_timing(), &mem,
+						 filled_locations, counter);
+		pe_leave();
+	}
+	else if(!flags.noverify){
 		if(!flags.debug) cerr << "[ 0%]";
 		if(flags.client) fprintf(stdout, "@000");
 		counter = 0;
@@ -901,78 +1357,66 @@ void dspic33e::write(char *infile)
 		send_nop();
 		send_nop();
 
+		if(sliced && row_read.len == 0)
+			compile_row_read();
+
 		for(addr=0; addr < mem.code_memory_size; addr=addr+8) {
 
 			skip=1;
 
-			for(k=0; k<8; k+=2)
-				if(mem.filled[addr+k])
-					skip = 0;
+			for(t=0; t<targets; t++)
+				for(k=0; k<8; k+=2)
+					if(image[t].filled[addr+k])
+						skip = 0;
 
 			if(skip) continue;
 
-			send_cmd(0x200000 | ((addr & 0x00FF0000) >> 12) );	// MOV #<DestAddress23:16>, W0
-			send_cmd(0x8802A0);									// MOV W0, TBLPAG
-			send_cmd(0x200006 | ((addr & 0x0000FFFF) << 4) );	// MOV #<DestAddress15:0>, W6
+			bad = verify_block(addr, image, live);
+			if(bad && !sliced){
+				free(failed);
+				free_images(image);
+				return;
+			}
+			for(t=0; t<targets; t++)
+				if((bad & (1 << t)) && row_failed(failed, t, addr & ~0xFF)){
+					/* too many to retry: out of the gang for good */
+					gang.dropped[t] = true;
+					live &= ~(1 << t);
+					gang_slice<io>::select(live);
+				}
 
-			/* Fetch the next four memory locations and put them to W0:W5 */
-			send_cmd(0xEB0380);	// CLR W7
-			send_nop();
-			send_cmd(0xBA1B96);
-			send_nop();
-			send_nop();
-			send_nop();
-			send_nop();
-			send_nop();
-			send_cmd(0xBADBB6);
-			send_nop();
-			send_nop();
-			send_nop();
-			send_nop();
-			send_nop();
-			send_cmd(0xBADBD6);
-			send_nop();
-			send_nop();
-			send_nop();
-			send_nop();
-			send_nop();
-			send_cmd(0xBA1BB6);
-			send_nop();
-			send_nop();
-			send_nop();
-			send_nop();
-			send_nop();
-			send_cmd(0xBA1B96);
-			send_nop();
-			send_nop();
-			send_nop();
-			send_nop();
-			send_nop();
-			send_cmd(0xBADBB6);
-			send_nop();
-			send_nop();
-			send_nop();
-			send_nop();
-			send_nop();
-			send_cmd(0xBADBD6);
-			send_nop();
-			send_nop();
-			send_nop();
-			send_nop();
-			send_nop();
-			send_cmd(0xBA0BB6);
-			send_nop();
-			send_nop();
-			send_nop();
-			send_nop();
-			send_nop();
+			io::mark(OP_ROW, addr);
+			rt_checkpoint();
+			if(counter != addr*100/filled_locations){
+				if(flags.client)
+					fprintf(stdout,"@%03d", (addr*100/(filled_locations+0x100)));
+				if(!flags.debug)
+					fprintf(stderr,"\b\b\b\b\b[%2d%%]", addr*100/(filled_locations+0x100));
+				counter = addr*100/filled_locations;
+			}
+		}
 
-			/* read six data words (16 bits each) */
-			for(i=0; i<6; i++){
-				send_cmd(0x887C40 + i);
-				send_nop();
-				raw_data[i] = read_data();
-				send_nop();
+		if(!flags.debug) cerr << "\b\b\b\b\b";
+
+		/*
+		 * RETRY the pages with failed rows, each on the targets that failed
+		 * them only: erase the page, write all of its rows again, verify
+		 */
+		for(addr=0; sliced && addr < mem.code_memory_size; addr=addr+ERASE_PAGE){
+			uint32_t retry = 0;
+
+			for(k=0; k<ERASE_PAGE; k+=256)
+				retry |= failed[(addr+k)/256];
+			retry &= live;
+			if(!retry) continue;
+			gang_slice<io>::select(retry);
+
+			erase_page(addr);
+
+			code_rows one = { image, targets, addr };
+			while(pack_code_row(&one, &redo) && redo.addr < addr+ERASE_PAGE){
+				latch_row(&redo);
+				program_row();
 			}
 
 			send_nop();
@@ -983,48 +1427,42 @@ void dspic33e::write(char *infile)
 			send_nop();
 			send_nop();
 
-			/* store data correctly */
-			data[0] = raw_data[0];
-			data[1] = raw_data[1] & 0x00FF;
-			data[3] = (raw_data[1] & 0xFF00) >> 8;
-			data[2] = raw_data[2];
-			data[4] = raw_data[3];
-			data[5] = raw_data[4] & 0x00FF;
-			data[7] = (raw_data[4] & 0xFF00) >> 8;
-			data[6] = raw_data[5];
-
-			for(i=0; i<8; i++){
-				if (flags.debug)
-					fprintf(stderr, "\n addr = 0x%06X data = 0x%04X", (addr+i), data[i]);
-
-				if(mem.filled[addr+i] && data[i] != mem.location[addr+i]){
-					fprintf(stderr,"\n\n ERROR at address %06X: written %04X but %04X read!\n\n",
-									addr+i, mem.location[addr+i], data[i]);
-					return;
-				}
-
+			bad = 0;
+			for(k=0; k<ERASE_PAGE; k+=8){
+				skip = 1;
+				for(t=0; t<targets; t++)
+					for(i=0; i<8; i+=2)
+						if(image[t].filled[addr+k+i])
+							skip = 0;
+				if(!skip)
+					bad |= verify_block(addr+k, image, retry);
 			}
 
-			if(counter != addr*100/filled_locations){
-				if(flags.client)
-					fprintf(stdout,"@%03d", (addr*100/(filled_locations+0x100)));
-				if(!flags.debug)
-					fprintf(stderr,"\b\b\b\b\b[%2d%%]", addr*100/(filled_locations+0x100));
-				counter = addr*100/filled_locations;
-			}
+			for(t=0; t<targets; t++)
+				if(bad & (1 << t)){
+					gang.dropped[t] = true;
+					live &= ~(1 << t);
+				}
+				else if(retry & (1 << t))
+					for(k=0; k<ERASE_PAGE; k+=256)
+						if(failed[(addr+k)/256] & (1 << t))
+							gang.fixed[t]++;
 		}
-
-		if(!flags.debug) cerr << "\b\b\b\b\b";
 		if(flags.client) fprintf(stdout, "@FIN");
 	}
 	else{
 		if(flags.client) fprintf(stdout, "@FIN");
 	}
 
+	if(sliced)
+		gang_slice<io>::select((1 << targets) - 1);
+	free(failed);
+	free_images(image);
 }
 
 /* write to screen the configuration registers, without saving them anywhere */
-void dspic33e::dump_configuration_registers(void)
+template<class io>
+void dspic33e<io>::dump_configuration_registers(void)
 {
 	const char *regname[] = {"FGS","FOSCSEL","FOSC","FWDT","FPOR",
 							"FICD","FAS","FUID0"};
@@ -1066,3 +1504,4 @@ void dspic33e::dump_configuration_registers(void)
 	send_nop();
 }
 
+INSTANTIATE_DEVICE(dspic33e)
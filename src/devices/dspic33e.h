@@ -21,6 +21,9 @@
 #include <iostream>
 
 #include "../common.h"
+#include "../wave.h"
+#include "../pipe.h"
+#include "../eicsp.h"
 #include "device.h"
 
 using namespace std;
@@ -28,15 +31,23 @@ using namespace std;
 #define SF_DSPIC33E		0x00
 #define SF_PIC24FJ		0x01
 
-class dspic33e : public Pic{
+struct code_row;
+
+template<class io>
+class dspic33e : public Pic, public eicsp_device {
 
 	public:
-		dspic33e(uint8_t sf){
+		dspic33e(uint8_t sf) : eicsp_device(0x800, 256){
 			subfamily=sf;
 		};
+		~dspic33e(){
+			wave_free(&row_read);
+			wave_free(&row_latch);
+			wave_free(&row_mov);
+		};
 		void enter_program_mode(void);
 		void exit_program_mode(void);
-		bool setup_pe(void){return true;};
+		bool setup_pe(void){ return pe_setup<io>(pic_clk, pic_data); };
 		bool read_device_id(void);
 		void bulk_erase(void);
 		void dump_configuration_registers(void);
@@ -49,6 +60,27 @@ class dspic33e : public Pic{
 		inline void send_prog_nop(void);
 		uint16_t read_data(void);
 
+		/* compiled row sequences, see wave.h */
+		wave row_read = {};		// fetch and read 8 words
+		wave row_latch = {};	// load 8 words into the write latches
+		wave row_mov = {};		// MOV #<literal>, W0 (bit-sliced gang)
+		void wave_cmd(wave *w, uint32_t cmd, int slot = -1);
+		void wave_read_data(wave *w, int word);
+		void compile_row_read(void);
+		void compile_row_latch(void);
+
+		/* parts of write(), shared with the retry of failed gang rows */
+		void latch_row(code_row *row);
+		void program_row(void);
+		void write_row(memory *m, uint32_t addr);
+		uint32_t verify_block(uint32_t addr, memory *image, uint32_t want);
+		void write_rows(memory *image, int targets,
+						unsigned int filled_locations);
+
+		/* Enhanced ICSP, through the programming executive (eicsp.h) */
+		void enter_mode(uint32_t key);
+		void erase_page(uint32_t addr);
+
 		/*
 		* DEVICES SECTION
 		*                       ID       NAME           	  MEMSIZE
@@ -25,181 +25,203 @@
 
 #include "dspic33f.h"
 
-/* delays (in microseconds; nanoseconds are rounded to 1us) */
-#define DELAY_P1   		1		// 200ns
-#define DELAY_P1A		1		// 80ns
-#define DELAY_P1B		1		// 80ns
-#define DELAY_P2		1		// 15ns
-#define DELAY_P3		1		// 15ns
-#define DELAY_P4		1		// 40ns
-#define DELAY_P4A		1		// 40ns
-#define DELAY_P5		1		// 20ns
-#define DELAY_P6		1		// 100ns
-#define DELAY_P7		25000	// 25ms
-#define DELAY_P8		12		// 12us
-#define DELAY_P9A		10		// 10us
-#define DELAY_P9B		15		// 15us - 23us max!
-#define DELAY_P10		1		// 400ns
-#define DELAY_P11		330000	// 330ms
-#define DELAY_P12		19500	// 19.5ms
-#define DELAY_P13		1280	// 1.28ms
-#define DELAY_P14		1		// 1us MAX!
-#define DELAY_P15		1		// 10ns
-#define DELAY_P16		0		// 0s
-#define DELAY_P17   	0		// 0s - 100ns MAX!
-#define DELAY_P18		1		// 1us
-#define DELAY_P19		1		// 25ns
-#define DELAY_P20		1		// 1us - 25ms MAX!
-#define DELAY_P21		1		// 1us - 500us MAX!
+/* ICSP timing profile (datasheet values, in nanoseconds) */
+enum { P1, P1A, P1B, P2, P3, P4, P4A, P5, P6, P7, P8, P9A, P9B, P10, P11,
+	P12, P13, P14, P15, P16, P17, P18, P19, P20, P21, NUM_TIMINGS };
+
+static const unsigned int profile[NUM_TIMINGS] = {
+	200,			// P1: 200ns
+	80,				// P1A: 80ns
+	80,				// P1B: 80ns
+	15,				// P2: 15ns
+	15,				// P3: 15ns
+	40,				// P4: 40ns
+	40,				// P4A: 40ns
+	20,				// P5: 20ns
+	100,			// P6: 100ns
+	25000000,		// P7: 25ms
+	12000,			// P8: 12us
+	10000,			// P9A: 10us
+	15000,			// P9B: 15us - 23us max!
+	400,			// P10: 400ns
+	330000000,		// P11: 330ms
+	19500000,		// P12: 19.5ms
+	1280000,		// P13: 1.28ms
+	1000,			// P14: 1us MAX!
+	10,				// P15: 10ns
+	0,				// P16: 0s
+	0,				// P17: 0s - 100ns MAX!
+	1000,			// P18: 1us
+	25,				// P19: 25ns
+	1000,			// P20: 1us - 25ms MAX!
+	1000			// P21: 1us - 500us MAX!
+};
+
+/* profile resolved for the selected --timing preset, by each head thread */
+static thread_local unsigned int delays[NUM_TIMINGS];
 
 #define ENTER_PROGRAM_KEY	0x4D434851
 
+#define ERASE_PAGE			0x400		/* erase page, in addresses */
+
 #define reset_pc() send_cmd(0x040200)
 #define send_nop() send_cmd(0x000000)
 
-static unsigned int counter=0;
-static uint16_t nvmcon;
 
 /* Send a 24-bit command to the PIC (LSB first) through a SIX instruction */
-void dspic33f::send_cmd(uint32_t cmd)
+template<class io>
+void dspic33f<io>::send_cmd(uint32_t cmd)
 {
 	uint8_t i;
+	int pgd = 0;			/* PGD level, cleared below */
 
-	GPIO_CLR(pic_data);
+	io::mark(OP_SEND_CMD, cmd);
+	io::clr(pic_data);
 
 	/* send the SIX = 0x0000 instruction */
 	for (i = 0; i < 4; i++) {
-		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
-		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P1A);
+		io::set(pic_clk);
+		delay_ns(delays[P1B]);
+		io::clr(pic_clk);
+		delay_ns(delays[P1A]);
 	}
 
-	delay_us(DELAY_P4);
+	delay_ns(delays[P4]);
 
 	/* send the 24-bit command */
 	for (i = 0; i < 24; i++) {
-		if ( (cmd >> i) & 0x00000001 )
-			GPIO_SET(pic_data);
-		else
-			GPIO_CLR(pic_data);
-		delay_us(DELAY_P1A);
-		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
-		GPIO_CLR(pic_clk);
+		delay_ns(delays[P1A]);
+		pgc_rise<io>(pic_clk, pic_data, (cmd >> i) & 0x01, pgd);
+		delay_ns(delays[P1B]);
+		io::clr(pic_clk);
 	}
 
-	delay_us(DELAY_P4A);
+	delay_ns(delays[P4A]);
 
 }
 
 /* Read 16-bit data word from the PIC (LSB first) through a REGOUT inst */
-uint16_t dspic33f::read_data(void)
+template<class io>
+uint16_t dspic33f<io>::read_data(void)
 {
 	uint8_t i;
 	uint16_t data = 0;
+	int pgd = 0;			/* PGD level, cleared below */
 
-	GPIO_CLR(pic_data);
-	GPIO_CLR(pic_clk);
+	io::mark(OP_READ_DATA);
+	io::clr2(pic_data, pic_clk);
 
 	/* send the REGOUT=0x0001 instruction */
 	for (i = 0; i < 4; i++) {
-		if ( (0x0001 >> i) & 0x001 )
-			GPIO_SET(pic_data);
-		else
-			GPIO_CLR(pic_data);
-		delay_us(DELAY_P1A);
-		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
-		GPIO_CLR(pic_clk);
+		delay_ns(delays[P1A]);
+		pgc_rise<io>(pic_clk, pic_data, (0x0001 >> i) & 0x01, pgd);
+		delay_ns(delays[P1B]);
+		io::clr(pic_clk);
 	}
 
-	delay_us(DELAY_P4);
+	delay_ns(delays[P4]);
 
 	/* idle for 8 clock cycles, waiting for the data to be ready */
 	for (i = 0; i < 8; i++) {
-		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
-		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P1A);
+		io::set(pic_clk);
+		delay_ns(delays[P1B]);
+		io::clr(pic_clk);
+		delay_ns(delays[P1A]);
 	}
 
-	delay_us(DELAY_P5);
+	delay_ns(delays[P5]);
 
-	GPIO_IN(pic_data);
+	io::in(pic_data);
 
 	/* read a 16-bit data word */
 	for (i = 0; i < 16; i++) {
-		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
-		data |= ( GPIO_LEV(pic_data) & 0x00000001 ) << i;
-		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P1A);
+		io::set(pic_clk);
+		delay_ns(delays[P1B]);
+		data |= ( io::lev(pic_data) & 0x00000001 ) << i;
+		io::clr(pic_clk);
+		delay_ns(delays[P1A]);
 	}
 
-	delay_us(DELAY_P4A);
-	GPIO_OUT(pic_data);
+	delay_ns(delays[P4A]);
+	io::out(pic_data);
 	return data;
 }
 
 /* enter program mode */
-void dspic33f::enter_program_mode(void)
+template<class io>
+void dspic33f<io>::enter_program_mode(void)
+{
+	io::mark(OP_ENTER);
+	timing_resolve(profile, delays, NUM_TIMINGS);
+	pe_time = { delays[P1A], delays[P1B], delays[P9A], delays[P9B],
+				EICSP_TIMEOUT };
+
+	enter_mode(ENTER_PROGRAM_KEY);
+}
+
+/* Cycle MCLR and shift in key: ICSP or Enhanced ICSP (ENTER_EICSP_KEY) */
+template<class io>
+void dspic33f<io>::enter_mode(uint32_t key)
 {
 	int i;
 
-	GPIO_IN(pic_mclr);
-	GPIO_OUT(pic_mclr);
+	io::in(pic_mclr);
+	io::out(pic_mclr);
 
-	GPIO_CLR(pic_clk);
+	io::clr(pic_clk);
 
-	GPIO_CLR(pic_mclr);		/*  remove VDD from MCLR pin */
-	delay_us(DELAY_P6);
-	GPIO_SET(pic_mclr);		/*  apply VDD to MCLR pin */
-	delay_us(DELAY_P21);
-	GPIO_CLR(pic_mclr);		/* remove VDD from MCLR pin */
-	delay_us(DELAY_P18);
+	io::clr(pic_mclr);		/*  remove VDD from MCLR pin */
+	delay_ns(delays[P6]);
+	io::set(pic_mclr);		/*  apply VDD to MCLR pin */
+	delay_ns(delays[P21]);
+	io::clr(pic_mclr);		/* remove VDD from MCLR pin */
+	delay_ns(delays[P18]);
 
 	/* Shift in the "enter program mode" key sequence (MSB first) */
 	for (i = 31; i > -1; i--) {
-		if ( (ENTER_PROGRAM_KEY >> i) & 0x01 )
-			GPIO_SET(pic_data);
+		if ( (key >> i) & 0x01 )
+			io::set(pic_data);
 		else
-			GPIO_CLR(pic_data);
-		delay_us(DELAY_P1A);
-		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
-		GPIO_CLR(pic_clk);
+			io::clr(pic_data);
+		delay_ns(delays[P1A]);
+		io::set(pic_clk);
+		delay_ns(delays[P1B]);
+		io::clr(pic_clk);
 
 	}
-	GPIO_CLR(pic_data);
-	delay_us(DELAY_P19);
-	GPIO_SET(pic_mclr);
-	delay_us(DELAY_P7);
+	io::clr(pic_data);
+	delay_ns(delays[P19]);
+	io::set(pic_mclr);
+	delay_ns(delays[P7]);
+
+	if(key != ENTER_PROGRAM_KEY)
+		return;
 
 	/* idle for 5 clock cycles */
 	for (i = 0; i < 5; i++) {
-		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
-		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P1A);
+		io::set(pic_clk);
+		delay_ns(delays[P1B]);
+		io::clr(pic_clk);
+		delay_ns(delays[P1A]);
 	}
 
 }
 
 /* exit program mode */
-void dspic33f::exit_program_mode(void)
+template<class io>
+void dspic33f<io>::exit_program_mode(void)
 {
-	GPIO_CLR(pic_clk);
-	GPIO_CLR(pic_data);
-	delay_us(DELAY_P16);
-	GPIO_CLR(pic_mclr);		/* remove VDD from MCLR pin */
-	delay_us(DELAY_P17);	/* wait (at least) P17 */
-	GPIO_SET(pic_mclr);
-	GPIO_IN(pic_mclr);
+	io::clr2(pic_clk, pic_data);
+	delay_ns(delays[P16]);
+	io::clr(pic_mclr);		/* remove VDD from MCLR pin */
+	delay_ns(delays[P17]);	/* wait (at least) P17 */
+	io::set(pic_mclr);
+	io::in(pic_mclr);
 }
 
 /* read the device ID and revision; returns only the id */
-bool dspic33f::read_device_id(void)
+template<class io>
+bool dspic33f<io>::read_device_id(void)
 {
 	bool found = 0;
 
@@ -244,12 +266,24 @@ bool dspic33f::read_device_id(void)
 }
 
 /* check if the device is blank */
-uint8_t dspic33f::blank_check(void)
+template<class io>
+uint8_t dspic33f<io>::blank_check(void)
 {
 	uint32_t addr;
 	unsigned short i;
 	uint16_t data[8], raw_data[6];
 	uint8_t ret = 0;
+	int blank;
+
+	/* read back through the PE when there is one, ICSP if it fails */
+	if(use_pe){
+		pe_enter();
+		blank = eicsp_blank<io>(pic_clk, pic_data, pe_timing(),
+								mem.code_memory_size);
+		pe_leave();
+		if(blank >= 0)
+			return blank;
+	}
 
 	if(!flags.debug) cerr << "[ 0%]";
 
@@ -319,6 +353,8 @@ uint8_t dspic33f::blank_check(void)
 		data[7] = (raw_data[4] & 0xFF00) >> 8;
 		data[6] = raw_data[5];
 
+		io::mark(OP_ROW, addr);
+		rt_checkpoint();
 		if(counter != addr*100/mem.code_memory_size){
 			counter = addr*100/mem.code_memory_size;
 			fprintf(stderr, "\b\b\b\b\b[%2d%%]", counter);
@@ -346,7 +382,8 @@ uint8_t dspic33f::blank_check(void)
 }
 
 /* Bulk erase the chip */
-void dspic33f::bulk_erase(void)
+template<class io>
+void dspic33f<io>::bulk_erase(void)
 {
 
     reset_pc();
@@ -364,19 +401,216 @@ void dspic33f::bulk_erase(void)
 
 	/* wait while the erase operation completes */
 	do{
+		io::mark(OP_POLL);
 		send_cmd(0x803B00);
 		send_cmd(0x883C20);
 		send_nop();
 		nvmcon = read_data();
 		reset_pc();
 		send_nop();
-	} while((nvmcon & 0x8000) == 0x8000);
+	} while(io::poll((nvmcon & 0x8000) == 0x8000));
 
 	if(flags.client) fprintf(stdout, "@FIN");
 }
 
+/* Erase the page of program (or executive) memory at addr */
+template<class io>
+void dspic33f<io>::erase_page(uint32_t addr)
+{
+	reset_pc();
+	reset_pc();
+	send_nop();
+
+	/* Set the NVMCON to erase a page */
+	send_cmd(0x24042A);
+	send_cmd(0x883B0A);
+
+	/* Select the page with a dummy table write */
+	send_cmd(0x200000 | ((addr & 0x00FF0000) >> 12) );	// MOV #<DestAddress23:16>, W0
+	send_cmd(0x880190);									// MOV W0, TBLPAG
+	send_cmd(0x200001 | ((addr & 0x0000FFFF) << 4) );	// MOV #<DestAddress15:0>, W1
+	send_cmd(0xBB0881);									// TBLWTL W1, [W1]
+	send_nop();
+	send_nop();
+
+	send_cmd(0xA8E761);
+	send_nop();
+	send_nop();
+	send_nop();
+	send_nop();
+
+	do{
+		io::mark(OP_POLL);
+		send_cmd(0x803B00);
+		send_cmd(0x883C20);
+		send_nop();
+		nvmcon = read_data();
+		reset_pc();
+		send_nop();
+	} while(io::poll((nvmcon & 0x8000) == 0x8000));
+}
+
+/* Write the row of m at addr (64 instructions) */
+template<class io>
+void dspic33f<io>::write_row(memory *m, uint32_t addr)
+{
+	uint32_t data[8];
+	uint8_t j, p;
+
+	/* Set the NVMCON to program 64 instructions */
+	send_cmd(0x24001A);
+	send_cmd(0x883B0A);
+
+	send_cmd(0x200000 | ((addr & 0x00FF0000) >> 12) );
+	send_cmd(0x880190);
+	send_cmd(0x200007 | ((addr & 0x0000FFFF) << 4) );
+
+	for(p=0; p<16; p++){
+
+		for(j=0;j<8;j++){
+			if (m->filled[addr+j]) data[j] = m->location[addr+j];
+			else data[j] = 0xFFFF;
+			if(flags.debug)
+				fprintf(stderr,"\n  Writing 0x%04X to address 0x%06X ", data[j], addr+j );
+		}
+
+		send_cmd(0x200000 | (data[0] << 4));										// MOV #<LSW0>, W0
+		send_cmd(0x200001 | (0x00FFFF & ((data[3] << 8) | (data[1] & 0x00FF))) <<4);// MOV #<MSB1:MSB0>, W1
+		send_cmd(0x200002 | (data[2] << 4));										// MOV #<LSW1>, W2
+		send_cmd(0x200003 | (data[4] << 4));										// MOV #<LSW2>, W3
+		send_cmd(0x200004 | (0x00FFFF & ((data[7] << 8) | (data[5] & 0x00FF))) <<4);// MOV #<MSB3:MSB2>, W4
+		send_cmd(0x200005 | (data[6] << 4));										// MOV #<LSW3>, W5
+
+		/* set_W6_and_load_latches */
+		send_cmd(0xEB0300);
+		send_nop();
+		send_cmd(0xBB0BB6);
+		send_nop();
+		send_nop();
+		send_cmd(0xBBDBB6);
+		send_nop();
+		send_nop();
+		send_cmd(0xBBEBB6);
+		send_nop();
+		send_nop();
+		send_cmd(0xBB1BB6);
+		send_nop();
+		send_nop();
+		send_cmd(0xBB0BB6);
+		send_nop();
+		send_nop();
+		send_cmd(0xBBDBB6);
+		send_nop();
+		send_nop();
+		send_cmd(0xBBEBB6);
+		send_nop();
+		send_nop();
+		send_cmd(0xBB1BB6);
+		send_nop();
+		send_nop();
+
+		addr = addr+8;
+	}
+
+	send_cmd(0xA8E761);
+	send_nop();
+	send_nop();
+	send_nop();
+	send_nop();
+
+	do{
+		io::mark(OP_POLL);
+		send_cmd(0x803B00);
+		send_cmd(0x883C20);
+		send_nop();
+		nvmcon = read_data();
+		reset_pc();
+		send_nop();
+	} while(io::poll((nvmcon & 0x8000) == 0x8000));
+}
+
+/*
+ * Read the next four instructions (eight locations) at TBLPAG:W6 into
+ * data, W6 moves past them
+ */
+template<class io>
+void dspic33f<io>::read_block(uint16_t *data)
+{
+	uint16_t raw_data[6];
+	uint8_t i;
+
+	/* Fetch the next four memory locations and put them to W0:W5 */
+	send_cmd(0xEB0380);
+	send_nop();
+	send_cmd(0xBA1B96);
+	send_nop();
+	send_nop();
+	send_cmd(0xBADBB6);
+	send_nop();
+	send_nop();
+	send_cmd(0xBADBD6);
+	send_nop();
+	send_nop();
+	send_cmd(0xBA1BB6);
+	send_nop();
+	send_nop();
+	send_cmd(0xBA1B96);
+	send_nop();
+	send_nop();
+	send_cmd(0xBADBB6);
+	send_nop();
+	send_nop();
+	send_cmd(0xBADBD6);
+	send_nop();
+	send_nop();
+	send_cmd(0xBA0BB6);
+	send_nop();
+	send_nop();
+
+	/* read six data words (16 bits each) */
+	for(i=0; i<6; i++){
+		send_cmd(0x883C20 + i);
+		send_nop();
+		send_nop();
+		raw_data[i] = read_data();
+		send_nop();
+	}
+
+	reset_pc();
+	send_nop();
+
+	/* store data correctly */
+	data[0] = raw_data[0];
+	data[1] = raw_data[1] & 0x00FF;
+	data[3] = (raw_data[1] & 0xFF00) >> 8;
+	data[2] = raw_data[2];
+	data[4] = raw_data[3];
+	data[5] = raw_data[4] & 0x00FF;
+	data[7] = (raw_data[4] & 0xFF00) >> 8;
+	data[6] = raw_data[5];
+}
+
+/* want if the 8 locations at addr differ from image, 0 otherwise */
+template<class io>
+uint32_t dspic33f<io>::verify_block(uint32_t addr, memory *image, uint32_t want)
+{
+	uint16_t data[8];
+	uint8_t i;
+
+	send_cmd(0x200000 | ((addr & 0x00FF0000) >> 12) );	// MOV #<DestAddress23:16>, W0
+	send_cmd(0x880190);									// MOV W0, TBLPAG
+	send_cmd(0x200006 | ((addr & 0x0000FFFF) << 4) );	// MOV #<DestAddress15:0>, W6
+	read_block(data);
+
+	for(i=0; i<8; i++)
+		if(image->filled[addr+i] && data[i] != image->location[addr+i])
+			return want;
+	return 0;
+}
+
 /* Read PIC memory and write the contents to a .hex file */
-void dspic33f::read(char *outfile, uint32_t start, uint32_t count)
+template<class io>
+void dspic33f<io>::read(char *outfile, uint32_t start, uint32_t count)
 {
 	uint32_t addr, startaddr, stopaddr;
 	uint16_t data[8], raw_data[6];
@@ -399,8 +633,15 @@ void dspic33f::read(char *outfile, uint32_t start, uint32_t count)
 	reset_pc();
 	send_nop();
 
+	if(use_pe){
+		pe_enter();
+		eicsp_read<io>(pic_clk, pic_data, pe_timing(), &mem, startaddr,
+					   stopaddr, counter);
+		pe_leave();
+	}
+
 	/* Output data to W0:W5; repeat until all desired code memory is read. */
-	for(addr=startaddr; addr < stopaddr; addr=addr+8) {
+	for(addr=startaddr; !use_pe && addr < stopaddr; addr=addr+8) {
 
 		if((addr & 0x0000FFFF) == 0 || startaddr != 0){
 			send_cmd(0x200000 | ((addr & 0x00FF0000) >> 12) );	// MOV #<DestAddress23:16>, W0
@@ -475,6 +716,8 @@ void dspic33f::read(char *outfile, uint32_t start, uint32_t count)
 			}
 		}
 
+		io::mark(OP_ROW, addr);
+		rt_checkpoint();
 		if(counter != addr*100/stopaddr){
 			counter = addr*100/stopaddr;
 			if(flags.client)
@@ -515,11 +758,12 @@ void dspic33f::read(char *outfile, uint32_t start, uint32_t count)
 }
 
 /* Write contents of the .hex file to the PIC */
-void dspic33f::write(char *infile)
+template<class io>
+void dspic33f<io>::write(char *infile)
 {
-	uint8_t i,j,k,p;
-	bool skip, skipped=0;
-	uint32_t data[8],raw_data[6];
+	uint8_t i,k;
+	bool skip, skipped=0, written;
+	uint16_t data[8];
 	uint32_t addr = 0;
 
 	unsigned int filled_locations=1;
@@ -542,11 +786,20 @@ void dspic33f::write(char *infile)
 	if(flags.client) fprintf(stdout, "@000");
 	counter=0;
 
-	send_nop();
-	send_cmd(0x24001A);
-	send_cmd(0x883B0A);
+	if(use_pe){
+		pe_enter();
+		written = eicsp_write<io>(pic_clk, pic_data, pe_timing(), &mem, 64,
+								  filled_locations, counter);
+		pe_leave();
+		if(!written) return;
+
+		/* exit reset vector */
+		reset_pc();
+		reset_pc();
+		send_nop();
+	}
 
-	for (addr = 0; addr < mem.code_memory_size; ){
+	for (addr = 0; !use_pe && addr < mem.code_memory_size; ){
 
 		skip = 1;
 
@@ -558,72 +811,11 @@ void dspic33f::write(char *infile)
 			continue;
 		}
 
-		send_cmd(0x200000 | ((addr & 0x00FF0000) >> 12) );
-		send_cmd(0x880190);
-		send_cmd(0x200007 | ((addr & 0x0000FFFF) << 4) );
-
-		for(p=0; p<16; p++){
-
-			for(j=0;j<8;j++){
-				if (mem.filled[addr+j]) data[j] = mem.location[addr+j];
-				else data[j] = 0xFFFF;
-				if(flags.debug)
-					fprintf(stderr,"\n  Writing 0x%04X to address 0x%06X ", data[j], addr+j );
-			}
-
-			send_cmd(0x200000 | (data[0] << 4));										// MOV #<LSW0>, W0
-			send_cmd(0x200001 | (0x00FFFF & ((data[3] << 8) | (data[1] & 0x00FF))) <<4);// MOV #<MSB1:MSB0>, W1
-			send_cmd(0x200002 | (data[2] << 4));										// MOV #<LSW1>, W2
-			send_cmd(0x200003 | (data[4] << 4));										// MOV #<LSW2>, W3
-			send_cmd(0x200004 | (0x00FFFF & ((data[7] << 8) | (data[5] & 0x00FF))) <<4);// MOV #<MSB3:MSB2>, W4
-			send_cmd(0x200005 | (data[6] << 4));										// MOV #<LSW3>, W5
-
-			/* set_W6_and_load_latches */
-			send_cmd(0xEB0300);
-			send_nop();
-			send_cmd(0xBB0BB6);
-			send_nop();
-			send_nop();
-			send_cmd(0xBBDBB6);
-			send_nop();
-			send_nop();
-			send_cmd(0xBBEBB6);
-			send_nop();
-			send_nop();
-			send_cmd(0xBB1BB6);
-			send_nop();
-			send_nop();
-			send_cmd(0xBB0BB6);
-			send_nop();
-			send_nop();
-			send_cmd(0xBBDBB6);
-			send_nop();
-			send_nop();
-			send_cmd(0xBBEBB6);
-			send_nop();
-			send_nop();
-			send_cmd(0xBB1BB6);
-			send_nop();
-			send_nop();
-
-			addr = addr+8;
-		}
-
-		send_cmd(0xA8E761);
-		send_nop();
-		send_nop();
-		send_nop();
-		send_nop();
-
-		do{
-			send_cmd(0x803B00);
-			send_cmd(0x883C20);
-			send_nop();
-			nvmcon = read_data();
-			reset_pc();
-			send_nop();
-		} while((nvmcon & 0x8000) == 0x8000);
+		write_row(&mem, addr);
+		addr = addr+128;
 
+		io::mark(OP_ROW, addr);
+		rt_checkpoint();
 		if(counter != addr*100/filled_locations){
 			counter = addr*100/filled_locations;
 			if(flags.client)
@@ -665,13 +857,14 @@ void dspic33f::write(char *infile)
 			send_nop();
 			send_nop();
 			do{
+				io::mark(OP_POLL);
 				send_cmd(0x803B00);
 				send_cmd(0x883C20);
 				send_nop();
 				nvmcon = read_data();
 				reset_pc();
 				send_nop();
-			} while((nvmcon & 0x8000) == 0x8000);
+			} while(io::poll((nvmcon & 0x8000) == 0x8000));
 
 			if(flags.debug)
 				fprintf(stderr,"\n - %s set to 0x%02x",
@@ -682,7 +875,13 @@ void dspic33f::write(char *infile)
 	if(flags.debug) cerr << endl;
 
 	/* VERIFY CODE MEMORY */
-	if(!flags.noverify){
+	if(!flags.noverify && use_pe){
+		pe_enter();
+		eicsp_verify<io>(pic_clk, pic_data, pe_timing(), &mem,
+						 filled_locations, counter);
+		pe_leave();
+	}
+	else if(!flags.noverify){
 		if(!flags.debug) cerr << "[ 0%]";
 		if(flags.client) fprintf(stdout, "@000");
 		counter = 0;
@@ -709,55 +908,7 @@ void dspic33f::write(char *infile)
 			}
 			else skipped=0;
 
-			/* Fetch the next four memory locations and put them to W0:W5 */
-			send_cmd(0xEB0380);
-			send_nop();
-			send_cmd(0xBA1B96);
-			send_nop();
-			send_nop();
-			send_cmd(0xBADBB6);
-			send_nop();
-			send_nop();
-			send_cmd(0xBADBD6);
-			send_nop();
-			send_nop();
-			send_cmd(0xBA1BB6);
-			send_nop();
-			send_nop();
-			send_cmd(0xBA1B96);
-			send_nop();
-			send_nop();
-			send_cmd(0xBADBB6);
-			send_nop();
-			send_nop();
-			send_cmd(0xBADBD6);
-			send_nop();
-			send_nop();
-			send_cmd(0xBA0BB6);
-			send_nop();
-			send_nop();
-
-			/* read six data words (16 bits each) */
-			for(i=0; i<6; i++){
-				send_cmd(0x883C20 + i);
-				send_nop();
-				send_nop();
-				raw_data[i] = read_data();
-				send_nop();
-			}
-
-			reset_pc();
-			send_nop();
-
-			/* store data correctly */
-			data[0] = raw_data[0];
-			data[1] = raw_data[1] & 0x00FF;
-			data[3] = (raw_data[1] & 0xFF00) >> 8;
-			data[2] = raw_data[2];
-			data[4] = raw_data[3];
-			data[5] = raw_data[4] & 0x00FF;
-			data[7] = (raw_data[4] & 0xFF00) >> 8;
-			data[6] = raw_data[5];
+			read_block(data);
 
 			for(i=0; i<8; i++){
 				if (flags.debug)
@@ -772,6 +923,8 @@ void dspic33f::write(char *infile)
 
 			}
 
+			io::mark(OP_ROW, addr);
+			rt_checkpoint();
 			if(counter != addr*100/filled_locations){
 				if(flags.client)
 					fprintf(stdout,"@%03d", (addr*100/(filled_locations+0x100)));
@@ -791,7 +944,8 @@ void dspic33f::write(char *infile)
 }
 
 /* write to screen the configuration registers, without saving them anywhere */
-void dspic33f::dump_configuration_registers(void)
+template<class io>
+void dspic33f<io>::dump_configuration_registers(void)
 {
 	const char *regname[] = {"FBS","FSS","FGS","FOSCSEL","FOSC","FWDT","FPOR",
 							"FICD","FUID0","FUID1","FUID2","FUID3"};
@@ -821,3 +975,4 @@ void dspic33f::dump_configuration_registers(void)
 	send_nop();
 }
 
+INSTANTIATE_DEVICE(dspic33f)
@@ -25,19 +25,27 @@
 
 #include "pic10f322.h"
 
-/* delays (in microseconds) */
-#define DELAY_SETUP	1
-#define	DELAY_HOLD	1
-#define DELAY_TENTS	1
-#define DELAY_TENTH	250
-#define DELAY_TCKH	1
-#define DELAY_TCKL 	1
-#define DELAY_TCO 	1
-#define DELAY_TDLY	1
-#define DELAY_TERAB	5000
-#define DELAY_TEXIT	1
-#define DELAY_TPINT_DATA	2500
-#define DELAY_TPINT_CONF	5000
+/* ICSP timing profile (datasheet values, in nanoseconds) */
+enum { SETUP, HOLD, TENTS, TENTH, TCKH, TCKL, TCO, TDLY, TERAB, TEXIT,
+	TPINT_DATA, TPINT_CONF, NUM_TIMINGS };
+
+static const unsigned int profile[NUM_TIMINGS] = {
+	100,			// SETUP: 100ns
+	100,			// HOLD: 100ns
+	100,			// TENTS: 100ns
+	250000,			// TENTH: 250us
+	100,			// TCKH: 100ns
+	100,			// TCKL: 100ns
+	80,				// TCO: 80ns
+	1000,			// TDLY: 1us
+	5000000,		// TERAB: 5ms
+	1000,			// TEXIT: 1us
+	2500000,		// TPINT_DATA: 2.5ms
+	5000000			// TPINT_CONF: 5ms
+};
+
+/* profile resolved for the selected --timing preset, by each head thread */
+static thread_local unsigned int delays[NUM_TIMINGS];
 
 /* commands for programming */
 #define COMM_LOAD_CONFIG	0x00
@@ -50,130 +58,138 @@
 
 #define ENTER_PROGRAM_KEY	0x4D434850
 
-void pic10f322::enter_program_mode(void)
+template<class io>
+void pic10f322<io>::enter_program_mode(void)
 {
 	int i;
 
-	GPIO_IN(pic_mclr);
-	GPIO_OUT(pic_mclr);
+	io::mark(OP_ENTER);
+	timing_resolve(profile, delays, NUM_TIMINGS);
 
-	GPIO_SET(pic_mclr);			/* apply VDD to MCLR pin */
-	delay_us(DELAY_TENTS);	/* wait TENTS */
-	GPIO_CLR(pic_mclr);			/* remove VDD from MCLR pin */
-	GPIO_CLR(pic_clk);
-	delay_us(DELAY_TENTH);		/* wait TENTH */
+	io::in(pic_mclr);
+	io::out(pic_mclr);
+
+	io::set(pic_mclr);			/* apply VDD to MCLR pin */
+	delay_ns(delays[TENTS]);	/* wait TENTS */
+	io::clr(pic_mclr);			/* remove VDD from MCLR pin */
+	io::clr(pic_clk);
+	delay_ns(delays[TENTH]);		/* wait TENTH */
 	/* Shift in the "enter program mode" key sequence (LSB! first) */
 	for (i = 0; i < 32; i++) {
 		if ( (ENTER_PROGRAM_KEY >> i) & 0x01 )
-			GPIO_SET(pic_data);
+			io::set(pic_data);
 		else
-			GPIO_CLR(pic_data);
+			io::clr(pic_data);
 
-		delay_us(DELAY_TCKL);	/* Setup time */
-		GPIO_SET(pic_clk);
-		delay_us(DELAY_TCKH);	/* Hold time */
-		GPIO_CLR(pic_clk);
+		delay_ns(delays[TCKL]);	/* Setup time */
+		io::set(pic_clk);
+		delay_ns(delays[TCKH]);	/* Hold time */
+		io::clr(pic_clk);
 
 	}
-	GPIO_CLR(pic_data);
+	io::clr(pic_data);
 
 	//Last clock(Don't care data)
-	delay_us(DELAY_TCKL);	/* Setup time */
-	GPIO_SET(pic_clk);
-	delay_us(DELAY_TCKH);	/* Hold time */
-	GPIO_CLR(pic_clk);
+	delay_ns(delays[TCKL]);	/* Setup time */
+	io::set(pic_clk);
+	delay_ns(delays[TCKH]);	/* Hold time */
+	io::clr(pic_clk);
 
 }
 
-void pic10f322::exit_program_mode(void)
+template<class io>
+void pic10f322<io>::exit_program_mode(void)
 {
 
-	GPIO_CLR(pic_clk);			/* stop clock on PGC */
-	GPIO_CLR(pic_data);			/* clear data pin PGD */
+	io::clr2(pic_clk, pic_data);	/* stop clock on PGC, clear data pin PGD */
 
-	GPIO_IN(pic_mclr);
+	io::in(pic_mclr);
 }
 
 /* Send a 4-bit command to the PIC (LSB first) */
-void pic10f322::send_cmd(uint8_t cmd, unsigned int delay)
+template<class io>
+void pic10f322<io>::send_cmd(uint8_t cmd, unsigned int delay)
 {
 	int i;
+	int pgd = 0;			/* every transfer leaves PGD low */
 
+	io::mark(OP_SEND_CMD, cmd);
 	for (i = 0; i < 6; i++) {
-		GPIO_SET(pic_clk);
-		if ( (cmd >> i) & 0x01 )
-			GPIO_SET(pic_data);
-		else
-			GPIO_CLR(pic_data);
-		delay_us(DELAY_TCKH);	/* Setup time */
-		GPIO_CLR(pic_clk);
-		delay_us(DELAY_TCKL);	/* Hold time */
+		pgc_rise<io>(pic_clk, pic_data, (cmd >> i) & 0x01, pgd);
+		delay_ns(delays[TCKH]);	/* Setup time */
+		io::clr(pic_clk);
+		delay_ns(delays[TCKL]);	/* Hold time */
 	}
-	GPIO_CLR(pic_data);
-	delay_us(delay);
+	if (pgd)
+		io::clr(pic_data);
+	delay_ns(delay);
 }
 
 /* Read 8-bit data from the PIC (LSB first) */
-uint16_t pic10f322::read_data(void)
+template<class io>
+uint16_t pic10f322<io>::read_data(void)
 {
 	uint8_t i;
 	uint16_t data = 0x0000;
 
-	GPIO_IN(pic_data);
+	io::mark(OP_READ_DATA);
+	io::in(pic_data);
 
 	for (i = 0; i < 16; i++) {
-		GPIO_SET(pic_clk);
-		delay_us(DELAY_TCKH);
-		delay_us(DELAY_TCO);	/* Wait for data to be valid */
-		data |= ( GPIO_LEV(pic_data) & 0x00000001 ) << i;
-		GPIO_CLR(pic_clk);
-		delay_us(DELAY_TCKL);
+		io::set(pic_clk);
+		delay_ns(delays[TCKH]);
+		delay_ns(delays[TCO]);	/* Wait for data to be valid */
+		data |= ( io::lev(pic_data) & 0x00000001 ) << i;
+		io::clr(pic_clk);
+		delay_ns(delays[TCKL]);
 	}
 
-	GPIO_IN(pic_data);
-	GPIO_OUT(pic_data);
+	io::in(pic_data);
+	io::out(pic_data);
 	data >>= 1;
 	return data;
 }
 
 /* Load 16-bit data to the PIC (LSB first) */
-void pic10f322::write_data(uint16_t data)
+template<class io>
+void pic10f322<io>::write_data(uint16_t data)
 {
 	int i;
+	int pgd = 0;			/* every transfer leaves PGD low */
+	io::mark(OP_WRITE_DATA, data);
 	data <<= 1;
 
 	for (i = 0; i < 16; i++) {
-		GPIO_SET(pic_clk);
-		if ( (data >> i) & 0x0001 )
-			GPIO_SET(pic_data);
-		else
-			GPIO_CLR(pic_data);
-		delay_us(DELAY_SETUP);	/* Setup time */
-		GPIO_CLR(pic_clk);
-		delay_us(DELAY_HOLD);	/* Hold time */
+		pgc_rise<io>(pic_clk, pic_data, (data >> i) & 0x0001, pgd);
+		delay_ns(delays[SETUP]);	/* Setup time */
+		io::clr(pic_clk);
+		delay_ns(delays[HOLD]);	/* Hold time */
 	}
-	GPIO_CLR(pic_data);
+	if (pgd)
+		io::clr(pic_data);
 }
 
 /* set Table Pointer */
-void pic10f322::reset_mem_location(void)
+template<class io>
+void pic10f322<io>::reset_mem_location(void)
 {
-	send_cmd(COMM_RESET_ADDR, DELAY_TDLY);
+	send_cmd(COMM_RESET_ADDR, delays[TDLY]);
 }
 
 /* Read PIC device id word */
-bool pic10f322::read_device_id(void)
+template<class io>
+bool pic10f322<io>::read_device_id(void)
 {
 	uint16_t id;
 	bool found = 0, found2 = 0;
 
-	send_cmd(COMM_LOAD_CONFIG, DELAY_TDLY);
+	send_cmd(COMM_LOAD_CONFIG, delays[TDLY]);
 	write_data(0x00);
 
 	for(int i=0; i < 6; i++){
-		send_cmd(COMM_INC_ADDR, DELAY_TDLY);
+		send_cmd(COMM_INC_ADDR, delays[TDLY]);
 	}
-	send_cmd(COMM_READ_FROM_PROG, DELAY_TDLY);
+	send_cmd(COMM_READ_FROM_PROG, delays[TDLY]);
 	id = read_data();
 	device_id = (id >> 5) & 0x1ff;
 	device_rev = id & 0x1f;
@@ -205,7 +221,8 @@ bool pic10f322::read_device_id(void)
 }
 
 /* Blank Check */
-uint8_t pic10f322::blank_check(void)
+template<class io>
+uint8_t pic10f322<io>::blank_check(void)
 {
 	unsigned int lcounter = 0;
 
@@ -218,9 +235,9 @@ uint8_t pic10f322::blank_check(void)
 	reset_mem_location();
 
 	for(addr = 0; addr < mem.code_memory_size; addr++){
-		send_cmd(COMM_READ_FROM_PROG, DELAY_TDLY);
+		send_cmd(COMM_READ_FROM_PROG, delays[TDLY]);
 		data = read_data() & 0x3FFF;
-		send_cmd(COMM_INC_ADDR, DELAY_TDLY);
+		send_cmd(COMM_INC_ADDR, delays[TDLY]);
 
 		if(data != 0x3FFF) {
 			fprintf(stderr, "Chip not Blank! Address: 0x%x, Read: 0x%x.\n",  addr, data);
@@ -228,6 +245,8 @@ uint8_t pic10f322::blank_check(void)
 			break;
 		}
 
+		io::mark(OP_ROW, addr);
+		rt_checkpoint();
 		if(lcounter != addr*100/mem.code_memory_size){
 			lcounter = addr*100/mem.code_memory_size;
 			fprintf(stderr, "\b\b\b\b\b[%2d%%]", lcounter);
@@ -235,18 +254,18 @@ uint8_t pic10f322::blank_check(void)
 	}
 
 	/* Read Confuguration Fuses */
-	send_cmd(COMM_LOAD_CONFIG, DELAY_TDLY);
+	send_cmd(COMM_LOAD_CONFIG, delays[TDLY]);
 	write_data(0x00);
 
 	addr = 0x2000;
 	if((detailed_subfamily == SF_PIC12F1822) || (detailed_subfamily == SF_PIC16LF1826))
 		addr = 0x8000;
 	for(int i = 0; i < 7; i++){
-		send_cmd(COMM_INC_ADDR, DELAY_TDLY);
+		send_cmd(COMM_INC_ADDR, delays[TDLY]);
 		addr++;
 	}
 	/* Config Word 1 */
-	send_cmd(COMM_READ_FROM_PROG, DELAY_TDLY);
+	send_cmd(COMM_READ_FROM_PROG, delays[TDLY]);
 
 	data = read_data() & 0x3FFF;
 
@@ -257,8 +276,8 @@ uint8_t pic10f322::blank_check(void)
 	/* Config Word 2 */
 	if((detailed_subfamily == SF_PIC12F1822) || (detailed_subfamily == SF_PIC16LF1826)){
 		addr++;
-		send_cmd(COMM_INC_ADDR, DELAY_TDLY);
-		send_cmd(COMM_READ_FROM_PROG, DELAY_TDLY);
+		send_cmd(COMM_INC_ADDR, delays[TDLY]);
+		send_cmd(COMM_READ_FROM_PROG, delays[TDLY]);
 		
 		data = read_data() & 0x3FFF;
 
@@ -275,15 +294,17 @@ uint8_t pic10f322::blank_check(void)
 }
 
 /* Bulk erase the chip */
-void pic10f322::bulk_erase(void)
+template<class io>
+void pic10f322<io>::bulk_erase(void)
 {
-	send_cmd(COMM_RESET_ADDR, DELAY_TDLY);
-	send_cmd(COMM_BULK_ERASE, DELAY_TERAB);
+	send_cmd(COMM_RESET_ADDR, delays[TDLY]);
+	send_cmd(COMM_BULK_ERASE, delays[TERAB]);
 	if(flags.client) fprintf(stdout, "@FIN");
 }
 
 /* Read PIC memory and write the contents to a .hex file */
-void pic10f322::read(char *outfile, uint32_t start, uint32_t count)
+template<class io>
+void pic10f322<io>::read(char *outfile, uint32_t start, uint32_t count)
 {
 	uint16_t addr, data = 0x0000;
 
@@ -296,9 +317,9 @@ void pic10f322::read(char *outfile, uint32_t start, uint32_t count)
 	reset_mem_location();
 
 	for (addr = 0; addr < mem.code_memory_size; addr++) {
-		send_cmd(COMM_READ_FROM_PROG, DELAY_TDLY);
+		send_cmd(COMM_READ_FROM_PROG, delays[TDLY]);
 		data = read_data() & 0x3FFF;
-		send_cmd(COMM_INC_ADDR, DELAY_TDLY);
+		send_cmd(COMM_INC_ADDR, delays[TDLY]);
 
 		if (flags.debug)
 			fprintf(stderr, "  addr = 0x%04X  data = 0x%04X\n", addr, data);
@@ -308,6 +329,8 @@ void pic10f322::read(char *outfile, uint32_t start, uint32_t count)
 			mem.filled[addr]      = 1;
 		}
 
+		io::mark(OP_ROW, addr);
+		rt_checkpoint();
 		if(lcounter != addr*100/mem.code_memory_size){
 			if(flags.client)
 				fprintf(stderr,"RED@%2d\n", (addr*100/mem.code_memory_size));
@@ -317,18 +340,18 @@ void pic10f322::read(char *outfile, uint32_t start, uint32_t count)
 		}
 	}
 	/* Read Confuguration Fuses */
-	send_cmd(COMM_LOAD_CONFIG, DELAY_TDLY);
+	send_cmd(COMM_LOAD_CONFIG, delays[TDLY]);
 	write_data(0x00);
 
 	addr = 0x2000;
 	if((detailed_subfamily == SF_PIC12F1822) || (detailed_subfamily == SF_PIC16LF1826))
 		addr = 0x8000;
 	for(int i = 0; i < 7; i++){
-		send_cmd(COMM_INC_ADDR, DELAY_TDLY);
+		send_cmd(COMM_INC_ADDR, delays[TDLY]);
 		addr++;
 	}
 	/* Config Word 1 */
-	send_cmd(COMM_READ_FROM_PROG, DELAY_TDLY);
+	send_cmd(COMM_READ_FROM_PROG, delays[TDLY]);
 
 	data = read_data() & 0x3FFF;
 
@@ -343,8 +366,8 @@ void pic10f322::read(char *outfile, uint32_t start, uint32_t count)
 	if((detailed_subfamily == SF_PIC12F1822) || (detailed_subfamily == SF_PIC16LF1826)){
 		uint16_t mask = 0x3FFF;
 		addr++;
-		send_cmd(COMM_INC_ADDR, DELAY_TDLY);
-		send_cmd(COMM_READ_FROM_PROG, DELAY_TDLY);
+		send_cmd(COMM_INC_ADDR, delays[TDLY]);
+		send_cmd(COMM_READ_FROM_PROG, delays[TDLY]);
 		
 		if(detailed_subfamily == SF_PIC12F1822)
 			mask = 0x3703;
@@ -367,7 +390,8 @@ void pic10f322::read(char *outfile, uint32_t start, uint32_t count)
 }
 
 /* Bulk erase the chip, and then write contents of the .hex file to the PIC */
-void pic10f322::write(char *infile)
+template<class io>
+void pic10f322<io>::write(char *infile)
 {
 	int i;
 	uint16_t data, fileconf;
@@ -392,38 +416,40 @@ void pic10f322::write(char *infile)
 			if (mem.filled[addr+i]) {
 				if (flags.debug)
 					fprintf(stderr, "  Writing 0x%04X to address 0x%06X \n", mem.location[addr + i], (addr+i) );
-				send_cmd(COMM_LOAD_FOR_PROG, DELAY_TDLY);
+				send_cmd(COMM_LOAD_FOR_PROG, delays[TDLY]);
 				write_data(mem.location[addr+i]);
 			}
 			else {
 				if (flags.debug)
 					fprintf(stderr, "  Writing 0x3FFF to address 0x%06X \n", (addr+i) );
-				send_cmd(COMM_LOAD_FOR_PROG, DELAY_TDLY);
+				send_cmd(COMM_LOAD_FOR_PROG, delays[TDLY]);
 				write_data(0x3FFF);			/* write 0x3FFF in empty locations */
 			};
-			send_cmd(COMM_INC_ADDR, DELAY_TDLY);
+			send_cmd(COMM_INC_ADDR, delays[TDLY]);
 		}
 
 		/* write the last 2 bytes and start programming */
 		if (mem.filled[addr+latch_size-1]) {
 			if (flags.debug)
 				fprintf(stderr, "  Writing 0x%04X to address 0x%06X and then start programming...\n", mem.location[addr+latch_size-1], (addr+latch_size-1));
-			send_cmd(COMM_LOAD_FOR_PROG, DELAY_TDLY);
+			send_cmd(COMM_LOAD_FOR_PROG, delays[TDLY]);
 			write_data(mem.location[addr+latch_size-1]);
 		}
 		else {
 			if (flags.debug)
 				fprintf(stderr, "  Writing 0x3FFF to address 0x%06X and then start programming...\n", (addr+latch_size-1));
-			send_cmd(COMM_LOAD_FOR_PROG, DELAY_TDLY);
+			send_cmd(COMM_LOAD_FOR_PROG, delays[TDLY]);
 			write_data(0x3FFF);			         /* write 0x3FFF in empty locations */
 		};
 
 		/* Programming Sequence */
-		send_cmd(COMM_BEGIN_IN_TIMED_PROG, DELAY_TPINT_DATA);
+		send_cmd(COMM_BEGIN_IN_TIMED_PROG, delays[TPINT_DATA]);
 		/* end of Programming Sequence */
 
-		send_cmd(COMM_INC_ADDR, DELAY_TDLY);
+		send_cmd(COMM_INC_ADDR, delays[TDLY]);
 
+		io::mark(OP_ROW, addr);
+		rt_checkpoint();
 		if(lcounter != addr*100/mem.code_memory_size){
 			lcounter = addr*100/mem.code_memory_size;
 			if(flags.client)
@@ -439,31 +465,31 @@ void pic10f322::write(char *infile)
 	/* Write Confuguration Fuses
 	 * Writing User ID is not implemented.
 	 */
-	send_cmd(COMM_LOAD_CONFIG, DELAY_TDLY);
+	send_cmd(COMM_LOAD_CONFIG, delays[TDLY]);
 	write_data(0x00);
 
 	addr = 0x2000;
 	if((detailed_subfamily == SF_PIC12F1822) || (detailed_subfamily == SF_PIC16LF1826))
 		addr = 0x8000;
 	for(i = 0; i < 7; i++){
-		send_cmd(COMM_INC_ADDR, DELAY_TDLY);
+		send_cmd(COMM_INC_ADDR, delays[TDLY]);
 		addr++;
 	}
 	if(mem.filled[addr]){
-		send_cmd(COMM_LOAD_FOR_PROG, DELAY_TDLY);
+		send_cmd(COMM_LOAD_FOR_PROG, delays[TDLY]);
 		write_data(mem.location[addr]);
 
-		send_cmd(COMM_BEGIN_IN_TIMED_PROG, DELAY_TPINT_CONF);
+		send_cmd(COMM_BEGIN_IN_TIMED_PROG, delays[TPINT_CONF]);
 	}
 
 	if((detailed_subfamily == SF_PIC12F1822) || (detailed_subfamily == SF_PIC16LF1826)){
 		addr++;
-		send_cmd(COMM_INC_ADDR, DELAY_TDLY);
+		send_cmd(COMM_INC_ADDR, delays[TDLY]);
 		if(mem.filled[addr]){
-			send_cmd(COMM_LOAD_FOR_PROG, DELAY_TDLY);
+			send_cmd(COMM_LOAD_FOR_PROG, delays[TDLY]);
 			write_data(mem.location[addr]);
 
-			send_cmd(COMM_BEGIN_IN_TIMED_PROG, DELAY_TPINT_CONF);
+			send_cmd(COMM_BEGIN_IN_TIMED_PROG, delays[TPINT_CONF]);
 		}
 	}
 	/* Verify Code Memory and Configuration Word */
@@ -475,9 +501,9 @@ void pic10f322::write(char *infile)
 		reset_mem_location();
 
 		for (addr = 0; addr < mem.code_memory_size; addr++) {
-			send_cmd(COMM_READ_FROM_PROG, DELAY_TDLY);
+			send_cmd(COMM_READ_FROM_PROG, delays[TDLY]);
 			data = read_data() & 0x3FFF;
-			send_cmd(COMM_INC_ADDR, DELAY_TDLY);
+			send_cmd(COMM_INC_ADDR, delays[TDLY]);
 
 			if (flags.debug)
 				fprintf(stderr, "addr = 0x%06X:  pic = 0x%04X, file = 0x%04X\n",
@@ -488,6 +514,8 @@ void pic10f322::write(char *infile)
 						addr, data, mem.location[addr]);
 				return;
 			}
+			io::mark(OP_ROW, addr);
+			rt_checkpoint();
 			if(lcounter != addr*100/mem.code_memory_size){
 				lcounter = addr*100/mem.code_memory_size;
 				if(flags.client)
@@ -498,18 +526,18 @@ void pic10f322::write(char *infile)
 		}
 
 		/* Read Confuguration Fuses */
-		send_cmd(COMM_LOAD_CONFIG, DELAY_TDLY);
+		send_cmd(COMM_LOAD_CONFIG, delays[TDLY]);
 		write_data(0x00);
 
 		addr = 0x2000;
 		if((detailed_subfamily == SF_PIC12F1822) || (detailed_subfamily == SF_PIC16LF1826))
 			addr = 0x8000;
 		for(int i = 0; i < 7; i++){
-			send_cmd(COMM_INC_ADDR, DELAY_TDLY);
+			send_cmd(COMM_INC_ADDR, delays[TDLY]);
 			addr++;
 		}
 
-		send_cmd(COMM_READ_FROM_PROG, DELAY_TDLY);
+		send_cmd(COMM_READ_FROM_PROG, delays[TDLY]);
 
 		/* NOTE: It is impossible to program LVP bit when Low-Voltage Programming.
 		 * We will ignore LVP bit in Configuration Fuse by using 0x3EFF mask.
@@ -530,8 +558,8 @@ void pic10f322::write(char *infile)
 		if((detailed_subfamily == SF_PIC12F1822) || (detailed_subfamily == SF_PIC16LF1826)){
 			uint16_t mask = 0x3FFF;
 			addr++;
-			send_cmd(COMM_INC_ADDR, DELAY_TDLY);
-			send_cmd(COMM_READ_FROM_PROG, DELAY_TDLY);
+			send_cmd(COMM_INC_ADDR, delays[TDLY]);
+			send_cmd(COMM_READ_FROM_PROG, delays[TDLY]);
 			
 			if(detailed_subfamily == SF_PIC12F1822)
 				mask = 0x3703;
@@ -558,20 +586,23 @@ void pic10f322::write(char *infile)
 }
 
 /* Dum configuration words */
-void pic10f322::dump_configuration_registers(void)
+template<class io>
+void pic10f322<io>::dump_configuration_registers(void)
 {
-	send_cmd(COMM_LOAD_CONFIG, DELAY_TDLY);
+	send_cmd(COMM_LOAD_CONFIG, delays[TDLY]);
 	write_data(0x00);
 
 	for(int i=0; i < 7; i++){
-		send_cmd(COMM_INC_ADDR, DELAY_TDLY);
+		send_cmd(COMM_INC_ADDR, delays[TDLY]);
 	}
-	send_cmd(COMM_READ_FROM_PROG, DELAY_TDLY);
+	send_cmd(COMM_READ_FROM_PROG, delays[TDLY]);
 	cout << "Configuration Words:" << endl;
 	fprintf(stdout, " - CONFIG1 = 0x%2x.\n", (read_data() & 0x3FFF));
 	if((detailed_subfamily == SF_PIC12F1822) || (detailed_subfamily == SF_PIC16LF1826)){
-		send_cmd(COMM_INC_ADDR, DELAY_TDLY);
-		send_cmd(COMM_READ_FROM_PROG, DELAY_TDLY);
+		send_cmd(COMM_INC_ADDR, delays[TDLY]);
+		send_cmd(COMM_READ_FROM_PROG, delays[TDLY]);
 		fprintf(stdout, " - CONFIG2 = 0x%2x.\n", (read_data() & 0x3FFF));
 	}
 }
+
+INSTANTIATE_DEVICE(pic10f322)
@@ -35,6 +35,7 @@ struct detailed_subfamily_t{
 	uint8_t		latch_size;
 };
 
+template<class io>
 class pic10f322: public Pic{
 
 	public:
@@ -25,26 +25,34 @@
 
 #include "pic18fj.h"
 
-/* delays (in microseconds) */
-#define DELAY_P1   	1
-#define DELAY_P2   	1
-#define DELAY_P2A  	1
-#define DELAY_P2B  	1
-#define DELAY_P3   	1
-#define DELAY_P4   	1
-#define DELAY_P5   	1
-#define DELAY_P5A  	1
-#define DELAY_P6   	1
-#define DELAY_P9  	3400
-#define DELAY_P10  	54000
-#define DELAY_P11  	524000
-#define DELAY_P12  	400
-#define DELAY_P13  	1
-#define DELAY_P14  	1
-#define DELAY_P16  	1
-#define DELAY_P17  	3
-#define DELAY_P19	4000
-#define DELAY_P20	1
+/* ICSP timing profile (datasheet values, in nanoseconds) */
+enum { P1, P2, P2A, P2B, P3, P4, P5, P5A, P6, P9, P10, P11, P12, P13, P14,
+	P16, P17, P19, P20, NUM_TIMINGS };
+
+static const unsigned int profile[NUM_TIMINGS] = {
+	1000,			// P1: 1us
+	100,			// P2: 100ns
+	40,				// P2A: 40ns
+	40,				// P2B: 40ns
+	15,				// P3: 15ns
+	15,				// P4: 15ns
+	40,				// P5: 40ns
+	40,				// P5A: 40ns
+	20,				// P6: 20ns
+	3400000,		// P9: 3.4ms
+	54000000,		// P10: 54ms
+	524000000,		// P11: 524ms
+	400000,			// P12: 400us
+	100,			// P13: 100ns
+	10,				// P14: 10ns
+	1000,			// P16: 1us
+	3000,			// P17: 3us
+	4000000,		// P19: 4ms
+	50				// P20: 50ns
+};
+
+/* profile resolved for the selected --timing preset, by each head thread */
+static thread_local unsigned int delays[NUM_TIMINGS];
 
 /* commands for programming */
 #define COMM_CORE_INSTRUCTION 				0x00
@@ -62,123 +70,130 @@
 
 unsigned int lcounter = 0;
 
-void pic18fj::enter_program_mode(void)
+template<class io>
+void pic18fj<io>::enter_program_mode(void)
 {
 	int i;
 
-	GPIO_IN(pic_mclr);
-	GPIO_OUT(pic_mclr);
+	io::mark(OP_ENTER);
+	timing_resolve(profile, delays, NUM_TIMINGS);
 
-	GPIO_CLR(pic_mclr);			/* remove VDD from MCLR pin */
-	delay_us(DELAY_P13);	/* wait P13 */
-	GPIO_SET(pic_mclr);			/* apply VDD to MCLR pin */
+	io::in(pic_mclr);
+	io::out(pic_mclr);
+
+	io::clr(pic_mclr);			/* remove VDD from MCLR pin */
+	delay_ns(delays[P13]);	/* wait P13 */
+	io::set(pic_mclr);			/* apply VDD to MCLR pin */
 	delay_us(10);		/* wait (no minimum time requirement) */
-	GPIO_CLR(pic_mclr);			/* remove VDD from MCLR pin */
-	delay_us(DELAY_P19);	/* wait P19 */
+	io::clr(pic_mclr);			/* remove VDD from MCLR pin */
+	delay_ns(delays[P19]);	/* wait P19 */
 
-	GPIO_CLR(pic_clk);
+	io::clr(pic_clk);
 	/* Shift in the "enter program mode" key sequence (MSB first) */
 	for (i = 31; i > -1; i--) {
 		if ( (ENTER_PROGRAM_KEY >> i) & 0x01 )
-			GPIO_SET(pic_data);
+			io::set(pic_data);
 		else
-			GPIO_CLR(pic_data);
-		delay_us(DELAY_P2B);	/* Setup time */
-		GPIO_SET(pic_clk);
-		delay_us(DELAY_P2A);	/* Hold time */
-		GPIO_CLR(pic_clk);
+			io::clr(pic_data);
+		delay_ns(delays[P2B]);	/* Setup time */
+		io::set(pic_clk);
+		delay_ns(delays[P2A]);	/* Hold time */
+		io::clr(pic_clk);
 
 	}
-	GPIO_CLR(pic_data);
-	delay_us(DELAY_P20);	/* Wait P20 */
-	GPIO_SET(pic_mclr);			/* apply VDD to MCLR pin */
-	delay_us(DELAY_P12);	/* Wait (at least) P12 */
+	io::clr(pic_data);
+	delay_ns(delays[P20]);	/* Wait P20 */
+	io::set(pic_mclr);			/* apply VDD to MCLR pin */
+	delay_ns(delays[P12]);	/* Wait (at least) P12 */
 }
 
-void pic18fj::exit_program_mode(void)
+template<class io>
+void pic18fj<io>::exit_program_mode(void)
 {
 
-	GPIO_CLR(pic_clk);			/* stop clock on PGC */
-	GPIO_CLR(pic_data);			/* clear data pin PGD */
-	delay_us(DELAY_P16);	/* wait P16 */
-	GPIO_CLR(pic_mclr);			/* remove VDD from MCLR pin */
-	delay_us(DELAY_P17);	/* wait (at least) P17 */
-	GPIO_SET(pic_mclr);
-	GPIO_IN(pic_mclr);
+	io::clr2(pic_clk, pic_data);	/* stop clock on PGC, clear data pin PGD */
+	delay_ns(delays[P16]);	/* wait P16 */
+	io::clr(pic_mclr);			/* remove VDD from MCLR pin */
+	delay_ns(delays[P17]);	/* wait (at least) P17 */
+	io::set(pic_mclr);
+	io::in(pic_mclr);
 }
 
 /* Send a 4-bit command to the PIC (LSB first) */
-void pic18fj::send_cmd(uint8_t cmd)
+template<class io>
+void pic18fj<io>::send_cmd(uint8_t cmd)
 {
 	int i;
+	int pgd = 0;			/* every transfer leaves PGD low */
 
+	io::mark(OP_SEND_CMD, cmd);
 	for (i = 0; i < 4; i++) {
-		GPIO_SET(pic_clk);
-		if ( (cmd >> i) & 0x01 )
-			GPIO_SET(pic_data);
-		else
-			GPIO_CLR(pic_data);
-		delay_us(DELAY_P2B);	/* Setup time */
-		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P2A);	/* Hold time */
+		pgc_rise<io>(pic_clk, pic_data, (cmd >> i) & 0x01, pgd);
+		delay_ns(delays[P2B]);	/* Setup time */
+		io::clr(pic_clk);
+		delay_ns(delays[P2A]);	/* Hold time */
 	}
-	GPIO_CLR(pic_data);
-	delay_us(DELAY_P5);
+	if (pgd)
+		io::clr(pic_data);
+	delay_ns(delays[P5]);
 }
 
 /* Read 8-bit data from the PIC (LSB first) */
-uint16_t pic18fj::read_data(void)
+template<class io>
+uint16_t pic18fj<io>::read_data(void)
 {
 	uint8_t i;
 	uint16_t data = 0x0000;
 
+	io::mark(OP_READ_DATA);
 	for (i = 0; i < 8; i++) {
-		GPIO_SET(pic_clk);
-		delay_us(DELAY_P2B);
-		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P2A);
+		io::set(pic_clk);
+		delay_ns(delays[P2B]);
+		io::clr(pic_clk);
+		delay_ns(delays[P2A]);
 	}
 
-	delay_us(DELAY_P6);	/* wait for the data... */
+	delay_ns(delays[P6]);	/* wait for the data... */
 
-	GPIO_IN(pic_data);
+	io::in(pic_data);
 
 	for (i = 0; i < 8; i++) {
-		GPIO_SET(pic_clk);
-		delay_us(DELAY_P14);	/* Wait for data to be valid */
-		data |= ( GPIO_LEV(pic_data) & 0x00000001 ) << i;
-		delay_us(DELAY_P2B);
-		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P2A);
+		io::set(pic_clk);
+		delay_ns(delays[P14]);	/* Wait for data to be valid */
+		data |= ( io::lev(pic_data) & 0x00000001 ) << i;
+		delay_ns(delays[P2B]);
+		io::clr(pic_clk);
+		delay_ns(delays[P2A]);
 	}
 
-	delay_us(DELAY_P5A);
-	GPIO_IN(pic_data);
-	GPIO_OUT(pic_data);
+	delay_ns(delays[P5A]);
+	io::in(pic_data);
+	io::out(pic_data);
 	return data;
 }
 
 /* Load 16-bit data to the PIC (LSB first) */
-void pic18fj::write_data(uint16_t data)
+template<class io>
+void pic18fj<io>::write_data(uint16_t data)
 {
 	int i;
+	int pgd = 0;			/* every transfer leaves PGD low */
 
+	io::mark(OP_WRITE_DATA, data);
 	for (i = 0; i < 16; i++) {
-		GPIO_SET(pic_clk);
-		if ( (data >> i) & 0x0001 )
-			GPIO_SET(pic_data);
-		else
-			GPIO_CLR(pic_data);
-		delay_us(DELAY_P2B);	/* Setup time */
-		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P2A);	/* Hold time */
+		pgc_rise<io>(pic_clk, pic_data, (data >> i) & 0x0001, pgd);
+		delay_ns(delays[P2B]);	/* Setup time */
+		io::clr(pic_clk);
+		delay_ns(delays[P2A]);	/* Hold time */
 	}
-	GPIO_CLR(pic_data);
-	delay_us(DELAY_P5A);
+	if (pgd)
+		io::clr(pic_data);
+	delay_ns(delays[P5A]);
 }
 
 /* set Table Pointer */
-void pic18fj::goto_mem_location(uint32_t data)
+template<class io>
+void pic18fj<io>::goto_mem_location(uint32_t data)
 {
 
 	data = data & 0x00FFFFFF;	/* set the MSB byte to zero (it should already be zero)	*/
@@ -198,7 +213,8 @@ void pic18fj::goto_mem_location(uint32_t data)
 }
 
 /* Read PIC device id word, located at 0x3FFFFE:0x3FFFFF */
-bool pic18fj::read_device_id(void)
+template<class io>
+bool pic18fj<io>::read_device_id(void)
 {
 	uint16_t id;
 	bool found = 0;
@@ -230,7 +246,8 @@ bool pic18fj::read_device_id(void)
 }
 
 /* Blank Check */
-uint8_t pic18fj::blank_check(void)
+template<class io>
+uint8_t pic18fj<io>::blank_check(void)
 {
 	uint16_t addr, data;
 	uint8_t ret = 0;
@@ -253,6 +270,8 @@ uint8_t pic18fj::blank_check(void)
 			break;
 		}
 
+		io::mark(OP_ROW, addr);
+		rt_checkpoint();
 		if(lcounter != addr*100/mem.code_memory_size){
 			lcounter = addr*100/mem.code_memory_size;
 			fprintf(stderr, "\b\b\b\b\b[%2d%%]", lcounter);
@@ -266,7 +285,8 @@ uint8_t pic18fj::blank_check(void)
 }
 
 /* Bulk erase the chip */
-void pic18fj::bulk_erase(void)
+template<class io>
+void pic18fj<io>::bulk_erase(void)
 {
 
 	goto_mem_location(0x3C0004);
@@ -276,14 +296,15 @@ void pic18fj::bulk_erase(void)
 	write_data(0x0000);                 /* NOP */
 	send_cmd(COMM_CORE_INSTRUCTION);
 	write_data(0x0000);                 /* NOP */
-	GPIO_CLR(pic_data);	                /* Hold PGD low until erase completes. */
-	delay_us(DELAY_P11);
-	delay_us(DELAY_P10);
+	io::clr(pic_data);	                /* Hold PGD low until erase completes. */
+	delay_ns(delays[P11]);
+	delay_ns(delays[P10]);
 	if(flags.client) fprintf(stdout, "@FIN");
 }
 
 /* Read PIC memory and write the contents to a .hex file */
-void pic18fj::read(char *outfile, uint32_t start, uint32_t count)
+template<class io>
+void pic18fj<io>::read(char *outfile, uint32_t start, uint32_t count)
 {
 	uint16_t addr, data = 0x0000;
 
@@ -310,6 +331,8 @@ void pic18fj::read(char *outfile, uint32_t start, uint32_t count)
 			mem.filled[addr]      = 1;
 		}
 
+		io::mark(OP_ROW, addr);
+		rt_checkpoint();
 		if(lcounter != addr*100/mem.code_memory_size){
 			if(flags.client)
 				fprintf(stderr,"RED@%2d\n", (addr*100/mem.code_memory_size));
@@ -325,7 +348,8 @@ void pic18fj::read(char *outfile, uint32_t start, uint32_t count)
 }
 
 /* Bulk erase the chip, and then write contents of the .hex file to the PIC */
-void pic18fj::write(char *infile)
+template<class io>
+void pic18fj<io>::write(char *infile)
 {
 	int i;
 	uint16_t data;
@@ -379,19 +403,21 @@ void pic18fj::write(char *infile)
 		};
 
 		/* Programming Sequence */
-		GPIO_CLR(pic_data);
+		io::clr(pic_data);
 		for (i = 0; i < 3; i++) {
-			GPIO_SET(pic_clk);
-			delay_us(DELAY_P2B);       /* Setup time */
-			GPIO_CLR(pic_clk);
-			delay_us(DELAY_P2A);       /* Hold time */
+			io::set(pic_clk);
+			delay_ns(delays[P2B]);       /* Setup time */
+			io::clr(pic_clk);
+			delay_ns(delays[P2A]);       /* Hold time */
 		}
-		GPIO_SET(pic_clk);
-		delay_us(DELAY_P9);        /* Programming time */
-		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P5);
+		io::set(pic_clk);
+		delay_ns(delays[P9]);        /* Programming time */
+		io::clr(pic_clk);
+		delay_ns(delays[P5]);
 		write_data(0x0000);
 		/* end of Programming Sequence */
+		io::mark(OP_ROW, addr);
+		rt_checkpoint();
 		if(lcounter != addr*100/filled_locations){
 			lcounter = addr*100/filled_locations;
 			if(flags.client)
@@ -428,6 +454,8 @@ void pic18fj::write(char *infile)
 						addr*2, data, mem.location[addr]);
 				break;
 			}
+			io::mark(OP_ROW, addr);
+			rt_checkpoint();
 			if(lcounter != addr*100/filled_locations){
 				lcounter = addr*100/filled_locations;
 				if(flags.client)
@@ -447,7 +475,8 @@ void pic18fj::write(char *infile)
 }
 
 /* Dum configuration words */
-void pic18fj::dump_configuration_registers(void)
+template<class io>
+void pic18fj<io>::dump_configuration_registers(void)
 {
 
 	cout << "Configuration Words:" << endl;
@@ -464,3 +493,5 @@ void pic18fj::dump_configuration_registers(void)
 
 	cout << endl;
 }
+
+INSTANTIATE_DEVICE(pic18fj)
@@ -25,6 +25,7 @@
 
 using namespace std;
 
+template<class io>
 class pic18fj: public Pic{
 
 	public:
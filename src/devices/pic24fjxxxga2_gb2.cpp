@@ -25,155 +25,174 @@
 
 #include "pic24fjxxxga2_gb2.h"
 
-/* delays (in microseconds; nanoseconds are rounded to 1us) */
-#define DELAY_P1   			1		// 100ns
-#define DELAY_P1A			1		// 40ns
-#define DELAY_P1B			1		// 40ns
-#define DELAY_P2			1		// 15ns
-#define DELAY_P3			1		// 15ns
-#define DELAY_P4			1		// 40ns
-#define DELAY_P4A			1		// 40ns
-#define DELAY_P5			1		// 20ns
-#define DELAY_P6			1		// 100ns
-#define DELAY_P7			25000		// 25ms
-#define DELAY_P8			12		// 12us
-#define DELAY_P9			40		// 40us
-#define DELAY_P10			1		// 400ns
-#define DELAY_P11			20000		// 20ms
-#define DELAY_P12			20000		// 20ms
-#define DELAY_P13			2000		// 2ms
-#define DELAY_P14			1		// 1us MAX!
-#define DELAY_P15			1		// 10ns
-#define DELAY_P16			0		// 0s
-#define DELAY_P17   			1		// 100ns
-#define DELAY_P18			10000		// 10ms
-#define DELAY_P19			1000		// 1ms
-#define DELAY_P20			23		// 23us
-#define DELAY_P21			1		// 8ns
+/* ICSP timing profile (datasheet values, in nanoseconds) */
+enum { P1, P1A, P1B, P2, P3, P4, P4A, P5, P6, P7, P8, P9, P10, P11, P12,
+	P13, P14, P15, P16, P17, P18, P19, P20, P21, NUM_TIMINGS };
+
+static const unsigned int profile[NUM_TIMINGS] = {
+	100,			// P1: 100ns
+	40,				// P1A: 40ns
+	40,				// P1B: 40ns
+	15,				// P2: 15ns
+	15,				// P3: 15ns
+	40,				// P4: 40ns
+	40,				// P4A: 40ns
+	20,				// P5: 20ns
+	100,			// P6: 100ns
+	25000000,		// P7: 25ms
+	12000,			// P8: 12us
+	40000,			// P9: 40us
+	400,			// P10: 400ns
+	20000000,		// P11: 20ms
+	20000000,		// P12: 20ms
+	2000000,		// P13: 2ms
+	1000,			// P14: 1us MAX!
+	10,				// P15: 10ns
+	0,				// P16: 0s
+	100,			// P17: 100ns
+	10000000,		// P18: 10ms
+	1000000,		// P19: 1ms
+	23000,			// P20: 23us
+	8				// P21: 8ns
+};
+
+/* profile resolved for the selected --timing preset, by each head thread */
+static thread_local unsigned int delays[NUM_TIMINGS];
 
 #define ENTER_PROGRAM_KEY	0x4D434851
 
 #define reset_pc() send_cmd(0x040200)
 #define send_nop() send_cmd(0x000000)
 
-static unsigned int counter=0;
-static uint16_t nvmcon;
 
 /* Send a 24-bit command to the PIC (LSB first) through a SIX instruction */
-void pic24fjxxxga2_gb2::send_cmd(uint32_t cmd)
+template<class io>
+void pic24fjxxxga2_gb2<io>::send_cmd(uint32_t cmd)
 {
 	uint8_t i;
+	int pgd = 0;			/* PGD level, cleared below */
 
-	GPIO_CLR(pic_data);
+	io::mark(OP_SEND_CMD, cmd);
+	io::clr(pic_data);
 
 	/* send the SIX = 0x0000 instruction */
 	for (i = 0; i < 4; i++) {
-		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
-		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P1A);
+		io::set(pic_clk);
+		delay_ns(delays[P1B]);
+		io::clr(pic_clk);
+		delay_ns(delays[P1A]);
 	}
 
-	delay_us(DELAY_P4);
+	delay_ns(delays[P4]);
 
 	/* send the 24-bit command */
 	for (i = 0; i < 24; i++) {
-		if ( (cmd >> i) & 0x00000001 )
-			GPIO_SET(pic_data);
-		else
-			GPIO_CLR(pic_data);
-		delay_us(DELAY_P1A);
-		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
-		GPIO_CLR(pic_clk);
+		delay_ns(delays[P1A]);
+		pgc_rise<io>(pic_clk, pic_data, (cmd >> i) & 0x01, pgd);
+		delay_ns(delays[P1B]);
+		io::clr(pic_clk);
 	}
 
-	delay_us(DELAY_P4A);
+	delay_ns(delays[P4A]);
 }
 
 /* Read 16-bit data word from the PIC (LSB first) through a REGOUT inst */
-uint16_t pic24fjxxxga2_gb2::read_data(void)
+template<class io>
+uint16_t pic24fjxxxga2_gb2<io>::read_data(void)
 {
 	uint8_t i;
 	uint16_t data = 0;
+	int pgd = 0;			/* PGD level, cleared below */
 
-	GPIO_CLR(pic_data);
-	GPIO_CLR(pic_clk);
+	io::mark(OP_READ_DATA);
+	io::clr2(pic_data, pic_clk);
 
 	/* send the REGOUT=0x0001 instruction */
 	for (i = 0; i < 4; i++) {
-		if ( (0x0001 >> i) & 0x001 )
-			GPIO_SET(pic_data);
-		else
-			GPIO_CLR(pic_data);
-		delay_us(DELAY_P1A);
-		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
-		GPIO_CLR(pic_clk);
+		delay_ns(delays[P1A]);
+		pgc_rise<io>(pic_clk, pic_data, (0x0001 >> i) & 0x01, pgd);
+		delay_ns(delays[P1B]);
+		io::clr(pic_clk);
 	}
 
-	delay_us(DELAY_P4);
+	delay_ns(delays[P4]);
 
 	/* idle for 8 clock cycles, waiting for the data to be ready */
 	for (i = 0; i < 8; i++) {
-		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
-		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P1A);
+		io::set(pic_clk);
+		delay_ns(delays[P1B]);
+		io::clr(pic_clk);
+		delay_ns(delays[P1A]);
 	}
 
-	delay_us(DELAY_P5);
+	delay_ns(delays[P5]);
 
-	GPIO_IN(pic_data);
+	io::in(pic_data);
 
 	/* read a 16-bit data word */
 	for (i = 0; i < 16; i++) {
-		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
-		data |= ( GPIO_LEV(pic_data) & 0x00000001 ) << i;
-		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P1A);
+		io::set(pic_clk);
+		delay_ns(delays[P1B]);
+		data |= ( io::lev(pic_data) & 0x00000001 ) << i;
+		io::clr(pic_clk);
+		delay_ns(delays[P1A]);
 	}
 
-	delay_us(DELAY_P4A);
-	GPIO_OUT(pic_data);
+	delay_ns(delays[P4A]);
+	io::out(pic_data);
 	return data;
 }
 
 /* Enter program mode */
-void pic24fjxxxga2_gb2::enter_program_mode(void)
+template<class io>
+void pic24fjxxxga2_gb2<io>::enter_program_mode(void)
+{
+	io::mark(OP_ENTER);
+	timing_resolve(profile, delays, NUM_TIMINGS);
+	pe_time = { delays[P1A], delays[P1B], delays[P8], delays[P9],
+				EICSP_TIMEOUT };
+
+	enter_mode(ENTER_PROGRAM_KEY);
+}
+
+/* Cycle MCLR and shift in key: ICSP or Enhanced ICSP (ENTER_EICSP_KEY) */
+template<class io>
+void pic24fjxxxga2_gb2<io>::enter_mode(uint32_t key)
 {
 	int i;
 
-	GPIO_OUT(pic_mclr);
-	GPIO_OUT(pic_data);
+	io::out(pic_mclr);
+	io::out(pic_data);
 
-	GPIO_CLR(pic_clk);
+	io::clr(pic_clk);
 
-	GPIO_CLR(pic_mclr);		/*  remove VDD from MCLR pin */
-	delay_us(DELAY_P6);
-	GPIO_SET(pic_mclr);		/*  apply VDD to MCLR pin */
-	delay_us(DELAY_P21);
-	GPIO_CLR(pic_mclr);		/* remove VDD from MCLR pin */
-	delay_us(DELAY_P18);
+	io::clr(pic_mclr);		/*  remove VDD from MCLR pin */
+	delay_ns(delays[P6]);
+	io::set(pic_mclr);		/*  apply VDD to MCLR pin */
+	delay_ns(delays[P21]);
+	io::clr(pic_mclr);		/* remove VDD from MCLR pin */
+	delay_ns(delays[P18]);
 
 	/* Shift in the "enter program mode" key sequence (MSB first) */
 	for (i = 31; i > -1; i--) {
-		if ( (ENTER_PROGRAM_KEY >> i) & 0x01 )
-			GPIO_SET(pic_data);
+		if ( (key >> i) & 0x01 )
+			io::set(pic_data);
 		else
-			GPIO_CLR(pic_data);
-		delay_us(DELAY_P1A);
-		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
-		GPIO_CLR(pic_clk);
+			io::clr(pic_data);
+		delay_ns(delays[P1A]);
+		io::set(pic_clk);
+		delay_ns(delays[P1B]);
+		io::clr(pic_clk);
 
 	}
 
-	GPIO_CLR(pic_data);
-	delay_us(DELAY_P19);
-	GPIO_SET(pic_mclr);
-	delay_us(DELAY_P7);
+	io::clr(pic_data);
+	delay_ns(delays[P19]);
+	io::set(pic_mclr);
+	delay_ns(delays[P7]);
+
+	if (key != ENTER_PROGRAM_KEY)
+		return;
 
 	/*
 	 * Coming out of Reset, ther first 4-bit control code is always forced
@@ -182,26 +201,27 @@ void pic24fjxxxga2_gb2::enter_program_mode(void)
 	 * SIX command instead of the normal 4-bit SIX command.
 	 */
 	for (i = 0; i < 5; i++) {
-		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1A);
-		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P1B);
+		io::set(pic_clk);
+		delay_ns(delays[P1A]);
+		io::clr(pic_clk);
+		delay_ns(delays[P1B]);
 	}
 }
 
 /* Exit program mode */
-void pic24fjxxxga2_gb2::exit_program_mode(void)
+template<class io>
+void pic24fjxxxga2_gb2<io>::exit_program_mode(void)
 {
-	GPIO_CLR(pic_clk);
-	GPIO_CLR(pic_data);
-	delay_us(DELAY_P16);
-	GPIO_CLR(pic_mclr);	/* remove VDD from MCLR pin */
-	delay_us(DELAY_P17);	/* wait (at least) P17 */
-	GPIO_IN(pic_mclr);
+	io::clr2(pic_clk, pic_data);
+	delay_ns(delays[P16]);
+	io::clr(pic_mclr);	/* remove VDD from MCLR pin */
+	delay_ns(delays[P17]);	/* wait (at least) P17 */
+	io::in(pic_mclr);
 }
 
 /* Read the device ID and revision; returns only the id */
-bool pic24fjxxxga2_gb2::read_device_id(void)
+template<class io>
+bool pic24fjxxxga2_gb2<io>::read_device_id(void)
 {
 	bool found = 0;
 
@@ -266,12 +286,24 @@ bool pic24fjxxxga2_gb2::read_device_id(void)
 }
 
 /* Check if the device is blank */
-uint8_t pic24fjxxxga2_gb2::blank_check(void)
+template<class io>
+uint8_t pic24fjxxxga2_gb2<io>::blank_check(void)
 {
 	uint32_t addr;
 	unsigned short i;
 	uint16_t data[8], raw_data[6];
 	uint8_t ret = 0;
+	int blank;
+
+	/* read back through the PE when there is one, ICSP if it fails */
+	if (use_pe) {
+		pe_enter();
+		blank = eicsp_blank<io>(pic_clk, pic_data, pe_timing(),
+								mem.code_memory_size);
+		pe_leave();
+		if (blank >= 0)
+			return blank;
+	}
 
 	if(!flags.debug)
 	  cerr << "[ 0%]";
@@ -345,6 +377,8 @@ uint8_t pic24fjxxxga2_gb2::blank_check(void)
 		data[7] = (raw_data[4] & 0xFF00) >> 8;
 		data[6] = raw_data[5];
 
+		io::mark(OP_ROW, addr);
+		rt_checkpoint();
 		if(counter != addr * 100 / mem.code_memory_size){
 			counter = addr * 100 / mem.code_memory_size;
 			fprintf(stderr, "\b\b\b\b\b[%2d%%]", counter);
@@ -381,7 +415,8 @@ uint8_t pic24fjxxxga2_gb2::blank_check(void)
 }
 
 /* Bulk erase the chip */
-void pic24fjxxxga2_gb2::bulk_erase(void)
+template<class io>
+void pic24fjxxxga2_gb2<io>::bulk_erase(void)
 {
 	/* Exit the Reset vector */
 	send_nop();
@@ -408,10 +443,11 @@ void pic24fjxxxga2_gb2::bulk_erase(void)
 	send_nop();
 	send_nop();
 
-	delay_us(DELAY_P11);
+	delay_ns(delays[P11]);
 
 	/* Wait while the erase operation completes */
 	do {
+		io::mark(OP_POLL);
 		reset_pc();
 		send_nop();
 		send_cmd(0x803B02); // MOV NVMCON, W2
@@ -419,14 +455,59 @@ void pic24fjxxxga2_gb2::bulk_erase(void)
 		send_nop();
 		nvmcon = read_data(); // Clock out contents of the VISI register
 		send_nop();
-	} while((nvmcon & 0x8000) == 0x8000);
+	} while(io::poll((nvmcon & 0x8000) == 0x8000));
 
 	if(flags.client)
 		fprintf(stdout, "@FIN");
 }
 
+/* Erase the page of program (or executive) memory at addr */
+template<class io>
+void pic24fjxxxga2_gb2<io>::erase_page(uint32_t addr)
+{
+	/* Exit the Reset vector */
+	send_nop();
+	reset_pc();
+	send_nop();
+
+	/* Set the NVMCON to erase a page */
+	send_cmd(0x24042A); // MOV #0x4042, W10
+	send_cmd(0x883B0A); // MOV W10, NVMCON
+
+	/* Set TBLPAG and perform dummy table write to select the page */
+	send_cmd(0x200000 | ((addr & 0x00FF0000) >> 12) ); // MOV #<PAGEVAL>, W0
+	send_cmd(0x8802A0); // MOV W0, TBLPAG
+	send_cmd(0x200001 | ((addr & 0x0000FFFF) << 4) ); // MOV #<PageAddress15:0>, W1
+	send_cmd(0xBB0881); // TBLWTL W1,[W1]
+	send_nop();
+	send_nop();
+
+	/* Initiate the erase cycle */
+	send_cmd(0xA8E761); // BSET NVMCON, #WR
+	send_nop();
+	send_nop();
+
+	delay_ns(delays[P12]);
+
+	/* Wait while the erase operation completes */
+	do {
+		io::mark(OP_POLL);
+		reset_pc();
+		send_nop();
+		send_cmd(0x803B02); // MOV NVMCON, W2
+		send_cmd(0x883C22); // MOV W2, VISI
+		send_nop();
+		nvmcon = read_data(); // Clock out contents of the VISI register
+		send_nop();
+	} while (io::poll((nvmcon & 0x8000) == 0x8000));
+
+	reset_pc();
+	send_nop();
+}
+
 /* Read PIC memory and write the contents to a .hex file */
-void pic24fjxxxga2_gb2::read(char *outfile, uint32_t start, uint32_t count)
+template<class io>
+void pic24fjxxxga2_gb2<io>::read(char *outfile, uint32_t start, uint32_t count)
 {
 	uint32_t addr, startaddr, stopaddr;
 	uint16_t data[8], raw_data[6];
@@ -452,7 +533,14 @@ void pic24fjxxxga2_gb2::read(char *outfile, uint32_t start, uint32_t count)
 	send_nop();
 
 	/* Output data to W0:W5; repeat until all desired code memory is read. */
-	for (addr = startaddr; addr < stopaddr; addr = addr + 8) {
+	if (use_pe) {
+		pe_enter();
+		eicsp_read<io>(pic_clk, pic_data, pe_timing(), &mem, startaddr,
+					   stopaddr, counter);
+		pe_leave();
+	}
+
+	for (addr = startaddr; !use_pe && addr < stopaddr; addr = addr + 8) {
 		if((addr & 0x0000FFFF) == 0 || startaddr != 0) {
 			send_cmd(0x200000 | ((addr & 0x00FF0000) >> 12) ); // MOV #<DestAddress23:16>, W0
 			send_cmd(0x8802A0); // MOV W0, TBLPAG
@@ -530,6 +618,8 @@ void pic24fjxxxga2_gb2::read(char *outfile, uint32_t start, uint32_t count)
 			}
 		}
 
+		io::mark(OP_ROW, addr);
+		rt_checkpoint();
 		if (counter != addr * 100 / stopaddr) {
 			counter = addr * 100 / stopaddr;
 			if (flags.client)
@@ -579,13 +669,180 @@ void pic24fjxxxga2_gb2::read(char *outfile, uint32_t start, uint32_t count)
 	write_inhx(&mem, outfile);
 }
 
+/* Program the row of 64 instructions at addr from the image in m */
+template<class io>
+void pic24fjxxxga2_gb2<io>::write_row(memory *m, uint32_t addr)
+{
+	uint32_t data[8];
+	uint16_t j, p;
+
+	/* Set the NVMCON to program 64 instruction words */
+	send_cmd(0x24001A); // MOV #0x4001, W10
+	send_cmd(0x883B0A); // MOV W10, NVMCON
+
+	/* Initialize the Write Pointer (W7) for TBLWT instruction */
+	send_cmd(0x200000 | ((addr & 0x00FF0000) >> 12) ); // MOV #<DestinationAddress23:16>, W0
+	send_cmd(0x8802A0);
+	send_cmd(0x200007 | ((addr & 0x0000FFFF) << 4) ); // MOV #<DestinationAddress15:0>, W7
+
+	for (p = 0; p < 16; p++) {
+		for (j = 0; j < 8; j++) {
+			if (m->filled[addr + j])
+				data[j] = m->location[addr + j];
+			else
+				data[j] = 0xFFFF;
+			if (flags.debug)
+				fprintf(stderr,"\n  Writing 0x%04X to address 0x%06X ", data[j], addr + j);
+		}
+
+		send_cmd(0x200000 | (data[0] << 4)); // MOV #<LSW0>, W0
+		send_cmd(0x200001 | (0x00FFFF & ((data[3] << 8) | (data[1] & 0x00FF))) <<4); // MOV #<MSB1:MSB0>, W1
+		send_cmd(0x200002 | (data[2] << 4)); // MOV #<LSW1>, W2
+		send_cmd(0x200003 | (data[4] << 4)); // MOV #<LSW2>, W3
+		send_cmd(0x200004 | (0x00FFFF & ((data[7] << 8) | (data[5] & 0x00FF))) <<4); // MOV #<MSB3:MSB2>, W4
+		send_cmd(0x200005 | (data[6] << 4)); // MOV #<LSW3>, W5
+
+		/* Set the Read Pointer (W6) and load the (next set of) write latches */
+		send_cmd(0xEB0300); // CLR W6
+		send_nop();
+		send_cmd(0xBB0BB6); // TBLWTL [W6++], [W7]
+		send_nop();
+		send_nop();
+		send_cmd(0xBBDBB6); // TBLWTH.B [W6++], [W7++]
+		send_nop();
+		send_nop();
+		send_cmd(0xBBEBB6); // TBLWTH.B [W6++], [++W7]
+		send_nop();
+		send_nop();
+		send_cmd(0xBB1BB6); // TBLWTL [W6++], [W7++]
+		send_nop();
+		send_nop();
+		send_cmd(0xBB0BB6); // TBLWTL [W6++], [W7]
+		send_nop();
+		send_nop();
+		send_cmd(0xBBDBB6); // TBLWTH.B [W6++], [W7++]
+		send_nop();
+		send_nop();
+		send_cmd(0xBBEBB6); // TBLWTH.B [W6++], [++W7]
+		send_nop();
+		send_nop();
+		send_cmd(0xBB1BB6); // TBLWTL [W6++], [W7++]
+		send_nop();
+		send_nop();
+
+		addr = addr + 8;
+	}
+
+	/* Initiate the write cycle */
+	send_cmd(0xA8E761); // BSET NVMCON, #WR
+	send_nop();
+	send_nop();
+
+	delay_ns(delays[P13]);
+
+	/* Wait while the erase operation completes */
+	do {
+		io::mark(OP_POLL);
+		reset_pc();
+		send_nop();
+		send_cmd(0x803B02); // MOV NVMCON, W2
+		send_cmd(0x883C22); // MOV W2, VISI
+		send_nop();
+		nvmcon = read_data(); // Clock out contents of the VISI register
+		send_nop();
+	} while (io::poll((nvmcon & 0x8000) == 0x8000));
+
+	reset_pc();
+	send_nop();
+}
+
+/* Read the 8 locations at addr into data */
+template<class io>
+void pic24fjxxxga2_gb2<io>::read_block(uint32_t addr, uint32_t *data)
+{
+	uint32_t raw_data[6];
+	uint16_t i;
+
+	send_cmd(0x200000 | ((addr & 0x00FF0000) >> 12) ); // MOV #<DestAddress23:16>, W0
+	send_cmd(0x8802A0); // MOV W0, TBLPAG
+	send_cmd(0x200006 | ((addr & 0x0000FFFF) << 4) ); // MOV #<DestAddress15:0>, W6
+
+	/* Fetch the next four memory locations and put them to W0:W5 */
+
+	/* Initialize the Write Pointer (w7) to point to the VISI register */
+	send_cmd(0x207847); // MOV #VISI, W7
+	send_nop();
+
+	send_cmd(0xEB0380); // CLR W7
+	send_nop();
+	send_cmd(0xBA1B96); // TBLRDL [W6], [W7++]
+	send_nop();
+	send_nop();
+	send_cmd(0xBADBB6); // TBLRDH.B [W6++], [W7++]
+	send_nop();
+	send_nop();
+	send_cmd(0xBADBD6); // TBLRDH.B [++W6], [W7++]
+	send_nop();
+	send_nop();
+	send_cmd(0xBA1BB6); // TBLRDL [W6++], [W7++]
+	send_nop();
+	send_nop();
+	send_cmd(0xBA1B96); // TBLRDL [W6], [W7++]
+	send_nop();
+	send_nop();
+	send_cmd(0xBADBB6); // TBLRDH.B [W6++], [W7++]
+	send_nop();
+	send_nop();
+	send_cmd(0xBADBD6); // TBLRDH.B [++W6], [W7++]
+	send_nop();
+	send_nop();
+	send_cmd(0xBA0BB6); // TBLRDL [W6++], [W7]
+	send_nop();
+	send_nop();
+
+	/* Read six data words (16 bits each) */
+	for (i = 0; i < 6; i++) {
+		send_cmd(0x883C20 + i); // MOV (W0 + i), VISI
+		send_nop();
+		raw_data[i] = read_data();
+		send_nop();
+	}
+
+	reset_pc();
+	send_nop();
+
+	/* store data correctly */
+	data[0] = raw_data[0];
+	data[1] = raw_data[1] & 0x00FF;
+	data[3] = (raw_data[1] & 0xFF00) >> 8;
+	data[2] = raw_data[2];
+	data[4] = raw_data[3];
+	data[5] = raw_data[4] & 0x00FF;
+	data[7] = (raw_data[4] & 0xFF00) >> 8;
+	data[6] = raw_data[5];
+}
+
+/* want if the 8 locations at addr differ from image, 0 otherwise */
+template<class io>
+uint32_t pic24fjxxxga2_gb2<io>::verify_block(uint32_t addr, memory *image, uint32_t want)
+{
+	uint32_t data[8];
+
+	read_block(addr, data);
+	for (uint16_t i = 0; i < 8; i++)
+		if (image->filled[addr + i] && data[i] != image->location[addr + i])
+			return want;
+	return 0;
+}
+
 /* Write contents of the .hex file to the PIC */
-void pic24fjxxxga2_gb2::write(char *infile)
+template<class io>
+void pic24fjxxxga2_gb2<io>::write(char *infile)
 {
-	uint16_t i,j,p;
+	uint16_t i;
 	uint16_t k;
-	bool skip;
-	uint32_t data[8], raw_data[6];
+	bool skip, written;
+	uint32_t data[8];
 	uint32_t addr = 0;
 
 	unsigned int filled_locations=1;
@@ -604,16 +861,20 @@ void pic24fjxxxga2_gb2::write(char *infile)
 	reset_pc();
 	send_nop();
 
-	/* Set the NVMCON to program 64 instruction words */
-	send_cmd(0x24001A); // MOV #0x4001, W10
-	send_cmd(0x883B0A); // MOV W10, NVMCON
-
 	if (!flags.debug) cerr << "[ 0%]";
 	if (flags.client) fprintf(stdout, "@000");
 
 	counter = 0;
 
-	for (addr = 0; addr < mem.code_memory_size; ){
+	if (use_pe) {
+		pe_enter();
+		written = eicsp_write<io>(pic_clk, pic_data, pe_timing(), &mem, 64,
+								  filled_locations, counter);
+		pe_leave();
+		if (!written) return;
+	}
+
+	for (addr = 0; !use_pe && addr < mem.code_memory_size; ){
 
 		skip = 1;
 
@@ -625,80 +886,11 @@ void pic24fjxxxga2_gb2::write(char *infile)
 			continue;
 		}
 
-		/* Initialize the Write Pointer (W7) for TBLWT instruction */
-		send_cmd(0x200000 | ((addr & 0x00FF0000) >> 12) ); // MOV #<DestinationAddress23:16>, W0
-		send_cmd(0x8802A0);
-		send_cmd(0x200007 | ((addr & 0x0000FFFF) << 4) ); // MOV #<DestinationAddress15:0>, W7
-
-		for (p = 0; p < 16; p++) {
-			for (j = 0; j < 8; j++) {
-				if (mem.filled[addr + j])
-					data[j] = mem.location[addr + j];
-				else
-					data[j] = 0xFFFF;
-				if (flags.debug)
-					fprintf(stderr,"\n  Writing 0x%04X to address 0x%06X ", data[j], addr + j);
-			}
-
-			send_cmd(0x200000 | (data[0] << 4)); // MOV #<LSW0>, W0
-			send_cmd(0x200001 | (0x00FFFF & ((data[3] << 8) | (data[1] & 0x00FF))) <<4); // MOV #<MSB1:MSB0>, W1
-			send_cmd(0x200002 | (data[2] << 4)); // MOV #<LSW1>, W2
-			send_cmd(0x200003 | (data[4] << 4)); // MOV #<LSW2>, W3
-			send_cmd(0x200004 | (0x00FFFF & ((data[7] << 8) | (data[5] & 0x00FF))) <<4); // MOV #<MSB3:MSB2>, W4
-			send_cmd(0x200005 | (data[6] << 4)); // MOV #<LSW3>, W5
-
-			/* Set the Read Pointer (W6) and load the (next set of) write latches */
-			send_cmd(0xEB0300); // CLR W6
-			send_nop();
-			send_cmd(0xBB0BB6); // TBLWTL [W6++], [W7]
-			send_nop();
-			send_nop();
-			send_cmd(0xBBDBB6); // TBLWTH.B [W6++], [W7++]
-			send_nop();
-			send_nop();
-			send_cmd(0xBBEBB6); // TBLWTH.B [W6++], [++W7]
-			send_nop();
-			send_nop();
-			send_cmd(0xBB1BB6); // TBLWTL [W6++], [W7++]
-			send_nop();
-			send_nop();
-			send_cmd(0xBB0BB6); // TBLWTL [W6++], [W7]
-			send_nop();
-			send_nop();
-			send_cmd(0xBBDBB6); // TBLWTH.B [W6++], [W7++]
-			send_nop();
-			send_nop();
-			send_cmd(0xBBEBB6); // TBLWTH.B [W6++], [++W7]
-			send_nop();
-			send_nop();
-			send_cmd(0xBB1BB6); // TBLWTL [W6++], [W7++]
-			send_nop();
-			send_nop();
-
-			addr = addr + 8;
-		}
-
-		/* Initiate the write cycle */
-		send_cmd(0xA8E761); // BSET NVMCON, #WR
-		send_nop();
-		send_nop();
-
-		delay_us(DELAY_P13);
-
-		/* Wait while the erase operation completes */
-		do {
-			reset_pc();
-			send_nop();
-			send_cmd(0x803B02); // MOV NVMCON, W2
-			send_cmd(0x883C22); // MOV W2, VISI
-			send_nop();
-			nvmcon = read_data(); // Clock out contents of the VISI register
-			send_nop();
-		} while ((nvmcon & 0x8000) == 0x8000);
-
-		reset_pc();
-		send_nop();
+		write_row(&mem, addr);
+		addr = addr + 128;
 
+		io::mark(OP_ROW, addr);
+		rt_checkpoint();
 		if (counter != addr * 100 / filled_locations) {
 			if (flags.client)
 				fprintf(stdout,"@%03d", (addr * 100 / (filled_locations + 0x80)));
@@ -767,10 +959,11 @@ void pic24fjxxxga2_gb2::write(char *infile)
 			send_nop();
 			send_nop();
 
-			delay_us(DELAY_P20);
+			delay_ns(delays[P20]);
 
 			/* Wait while the erase operation completes */
 			do {
+				io::mark(OP_POLL);
 				reset_pc();
 				send_nop();
 				send_cmd(0x803B02); // MOV NVMCON, W2
@@ -778,7 +971,7 @@ void pic24fjxxxga2_gb2::write(char *infile)
 				send_nop();
 				nvmcon = read_data(); // Clock out contents of the VISI register
 				send_nop();
-			} while ((nvmcon & 0x8000) == 0x8000);
+			} while (io::poll((nvmcon & 0x8000) == 0x8000));
 
 			if(flags.debug)
 				fprintf(stderr,"\n - %s set to 0x%01x",
@@ -795,7 +988,13 @@ void pic24fjxxxga2_gb2::write(char *infile)
 	delay_us(100000);
 
 	/* VERIFY CODE MEMORY */
-	if (!flags.noverify){
+	if (!flags.noverify && use_pe) {
+		pe_enter();
+		eicsp_verify<io>(pic_clk, pic_data, pe_timing(), &mem,
+						 filled_locations, counter);
+		pe_leave();
+	}
+	else if (!flags.noverify){
 		if (!flags.debug) cerr << "[ 0%]";
 		if (flags.client) fprintf(stdout, "@000");
 
@@ -814,63 +1013,7 @@ void pic24fjxxxga2_gb2::write(char *infile)
 
 			if (skip) continue;
 
-			send_cmd(0x200000 | ((addr & 0x00FF0000) >> 12) ); // MOV #<DestAddress23:16>, W0
-			send_cmd(0x8802A0); // MOV W0, TBLPAG
-			send_cmd(0x200006 | ((addr & 0x0000FFFF) << 4) ); // MOV #<DestAddress15:0>, W6
-
-			/* Fetch the next four memory locations and put them to W0:W5 */
-
-			/* Initialize the Write Pointer (w7) to point to the VISI register */
-			send_cmd(0x207847); // MOV #VISI, W7
-			send_nop();
-
-			send_cmd(0xEB0380); // CLR W7
-			send_nop();
-			send_cmd(0xBA1B96); // TBLRDL [W6], [W7++]
-			send_nop();
-			send_nop();
-			send_cmd(0xBADBB6); // TBLRDH.B [W6++], [W7++]
-			send_nop();
-			send_nop();
-			send_cmd(0xBADBD6); // TBLRDH.B [++W6], [W7++]
-			send_nop();
-			send_nop();
-			send_cmd(0xBA1BB6); // TBLRDL [W6++], [W7++]
-			send_nop();
-			send_nop();
-			send_cmd(0xBA1B96); // TBLRDL [W6], [W7++]
-			send_nop();
-			send_nop();
-			send_cmd(0xBADBB6); // TBLRDH.B [W6++], [W7++]
-			send_nop();
-			send_nop();
-			send_cmd(0xBADBD6); // TBLRDH.B [++W6], [W7++]
-			send_nop();
-			send_nop();
-			send_cmd(0xBA0BB6); // TBLRDL [W6++], [W7]
-			send_nop();
-			send_nop();
-
-			/* Read six data words (16 bits each) */
-			for (i = 0; i < 6; i++) {
-				send_cmd(0x883C20 + i); // MOV (W0 + i), VISI
-				send_nop();
-				raw_data[i] = read_data();
-				send_nop();
-			}
-
-			reset_pc();
-			send_nop();
-
-			/* store data correctly */
-			data[0] = raw_data[0];
-			data[1] = raw_data[1] & 0x00FF;
-			data[3] = (raw_data[1] & 0xFF00) >> 8;
-			data[2] = raw_data[2];
-			data[4] = raw_data[3];
-			data[5] = raw_data[4] & 0x00FF;
-			data[7] = (raw_data[4] & 0xFF00) >> 8;
-			data[6] = raw_data[5];
+			read_block(addr, data);
 
 			for (i = 0; i < 8; i++) {
 				if (flags.debug)
@@ -883,6 +1026,8 @@ void pic24fjxxxga2_gb2::write(char *infile)
 				}
 			}
 
+			io::mark(OP_ROW, addr);
+			rt_checkpoint();
 			if (counter != addr * 100 / filled_locations) {
 				if (flags.client)
 					fprintf(stdout,"@%03d", (addr*100/(filled_locations+0x100)));
@@ -900,7 +1045,8 @@ void pic24fjxxxga2_gb2::write(char *infile)
 }
 
 /* Write to screen the configuration registers, without saving them anywhere */
-void pic24fjxxxga2_gb2::dump_configuration_registers(void)
+template<class io>
+void pic24fjxxxga2_gb2<io>::dump_configuration_registers(void)
 {
 	uint32_t addr = mem.code_memory_size + 4*2;
 
@@ -935,3 +1081,5 @@ void pic24fjxxxga2_gb2::dump_configuration_registers(void)
 	reset_pc();
 	send_nop();
 }
+
+INSTANTIATE_DEVICE(pic24fjxxxga2_gb2)
@@ -21,16 +21,19 @@
 #include <iostream>
 
 #include "../common.h"
+#include "../eicsp.h"
 #include "device.h"
 
 using namespace std;
 
-class pic24fjxxxga2_gb2 : public Pic {
+template<class io>
+class pic24fjxxxga2_gb2 : public Pic, public eicsp_device {
 
 	public:
+		pic24fjxxxga2_gb2() : eicsp_device(0x400, 128) {};
 		void enter_program_mode(void);
 		void exit_program_mode(void);
-		bool setup_pe(void){return true;};
+		bool setup_pe(void){ return pe_setup<io>(pic_clk, pic_data); };
 		bool read_device_id(void);
 		void bulk_erase(void);
 		void dump_configuration_registers(void);
@@ -42,6 +45,15 @@ class pic24fjxxxga2_gb2 : public Pic {
 		void send_cmd(uint32_t cmd);
 		uint16_t read_data(void);
 
+		/* Enhanced ICSP, through the programming executive (eicsp.h) */
+		void enter_mode(uint32_t key);
+
+		/* parts of write(), also used by download_pe() */
+		void erase_page(uint32_t addr);
+		void write_row(memory *m, uint32_t addr);
+		void read_block(uint32_t addr, uint32_t *data);
+		uint32_t verify_block(uint32_t addr, memory *image, uint32_t want);
+
 		/*
 		 *                         ID       NAME             MEMSIZE
 		 */
@@ -26,20 +26,39 @@
 
 #include "pic32.h"
 
-/* delays (in microseconds) */
-#define DELAY_P1   	1
-#define DELAY_P1A  	1
-#define DELAY_P1B  	1
-#define DELAY_P6   	1
-#define DELAY_P7   	1
-#define DELAY_P9A  	40
-#define DELAY_P9B  	15
-#define DELAY_P14  	1
-#define DELAY_P16  	1
-#define DELAY_P17  	1
-#define DELAY_P18  	1
-#define DELAY_P19	1
-#define DELAY_P20	500
+/* ICSP timing profile (datasheet values, in nanoseconds) */
+enum { P1, P1A, P1B, P6, P7, P9A, P9B, P14, P16, P17, P18, P19, P20,
+	NUM_TIMINGS };
+
+static const unsigned int profile[NUM_TIMINGS] = {
+	100,			// P1: 100ns
+	40,				// P1A: 40ns
+	40,				// P1B: 40ns
+	100,			// P6: 100ns
+	1000,			// P7: 1us
+	40000,			// P9A: 40us
+	15000,			// P9B: 15us
+	10,				// P14: 10ns
+	1000,			// P16: 1us
+	100,			// P17: 100ns
+	40,				// P18: 40ns
+	40,				// P19: 40ns
+	500000			// P20: 500us
+};
+
+/* profile resolved for the selected --timing preset, by each head thread */
+static thread_local unsigned int delays[NUM_TIMINGS];
+
+/*
+ * 4-wire JTAG (--transport=jtag): TCK on PGC, TDI on PGD, TMS and TDO on
+ * their own pins. Every TDI/TMS pair is one TCK clock with no turnaround,
+ * instead of the four PGC clocks of a 2-wire phase, and TDO is read
+ * after the falling edge, where the 4-phase read returns it: SetMode,
+ * SendCommand, XferData and XferFastData work unchanged on both. No key
+ * is needed, the JTAG port must be enabled (JTAGEN, set when erased); the
+ * device is reset through the MTAP instead of MCLR.
+ */
+struct jtag_struct jtag;
 
 #define ENTER_PROGRAM_KEY	0x4D434850
 
@@ -89,136 +108,290 @@
 #define PROGRAM_AREA			0
 #define BOOT_AREA				1
 
-void pic32::enter_program_mode(void)
+#define PE_ROW_MAX				2048	// bytes (PIC32MZ, PIC32MK)
+
+/* A flash row packed for write(): its words, as sent to the PE */
+struct pe_row {
+	uint32_t addr;
+	uint32_t programmed;		// locations programmed, up to this row
+	uint32_t word[PE_ROW_MAX/4];
+};
+
+struct pe_rows {
+	memory *mem;
+	uint32_t rowsize, bootsize;
+	uint8_t area;
+	uint32_t addr, stopaddr;	// next row to pack, end of the area
+	uint32_t programmed;
+	uint32_t checksum;			// of the rows packed so far
+	uint32_t filled, counter;	// progress: locations to program, last %
+};
+
+/* Start packing the rows of area, if it is selected */
+static void pe_area(pe_rows *r, uint8_t area)
+{
+	r->area = area;
+	switch(area){
+		case PROGRAM_AREA:	// Write Program Flash
+			r->addr = 0;
+			r->stopaddr = (r->mem->code_memory_size*2)-1;
+			if(flags.boot_only)
+				r->stopaddr = 0;
+			break;
+		case BOOT_AREA:	// Write bootflash+configuration
+			r->addr = BOOTFLASH_OFFSET;
+			r->stopaddr = r->addr+r->bootsize-1;
+			if(flags.program_only)
+				r->stopaddr = r->addr;
+			break;
+	}
+}
+
+/* Pack the next row that is not empty, adding it to the checksum (row_pipe packer) */
+static bool pack_pe_row(void *ctx, pe_row *row)
+{
+	pe_rows *r = (pe_rows *) ctx;
+	memory *mem = r->mem;
+	uint32_t addr;
+	bool skip;
+
+	for (;;) {
+		if (r->addr >= r->stopaddr) {
+			if (r->area == BOOT_AREA)
+				return false;
+			pe_area(r, r->area+1);
+			continue;
+		}
+
+		skip = true;
+		for(uint32_t i=0; i<r->rowsize; i++){
+			if(mem->filled[(r->addr+i)/2]){
+				skip = false;
+				break;
+			}
+		}
+		if(!skip)
+			break;
+		r->checksum += 0x000000FF*r->rowsize;
+		r->addr += r->rowsize;
+	}
+
+	addr = row->addr = r->addr;
+	r->addr += r->rowsize;
+
+	for(uint32_t i=0; i<r->rowsize; i+=4){
+		if(mem->filled[(addr+i)/2]){
+			row->word[i/4] = (uint32_t)mem->location[(addr+i)/2] |
+							((uint32_t)mem->location[(addr+i)/2+1] << 16);
+			r->programmed += 2;
+			if((addr+i) < (BOOTFLASH_OFFSET+r->bootsize-16)){
+				r->checksum += (mem->location[(addr+i)/2] & 0x00FF) +
+								(mem->location[(addr+i)/2] >> 8) +
+								(mem->location[(addr+i)/2+1] & 0x00FF) +
+								(mem->location[(addr+i)/2+1] >> 8);
+			}
+		}
+		else{
+			row->word[i/4] = 0xFFFFFFFF;
+			if((addr+i) < (BOOTFLASH_OFFSET+r->bootsize-16))
+				r->checksum += 0x000000FF*4;
+		}
+	}
+	row->programmed = r->programmed;
+
+	return true;
+}
+
+/* Print the progress after a row is programmed (row_pipe reporter) */
+static void report_pe_row(void *ctx, const pe_row *row)
+{
+	pe_rows *r = (pe_rows *) ctx;
+
+	if(r->counter != row->programmed*100/r->filled){
+		r->counter = row->programmed*100/r->filled;
+		if(flags.client)
+			fprintf(stdout,"@%03d", r->counter);
+		if(!flags.debug)
+			fprintf(stderr,"\b\b\b\b\b[%2d%%]", r->counter);
+	}
+}
+
+template<class io>
+void pic32<io>::enter_program_mode(void)
 {
 	int i;
 
-	GPIO_IN(pic_mclr);
-	GPIO_OUT(pic_mclr);
+	io::mark(OP_ENTER);
+	timing_resolve(profile, delays, NUM_TIMINGS);
+
+	if(jtag.on){
+		io::out(pic_tms);
+		io::clr(pic_tms);
+		tmsl = 0;
+		io::in(pic_tdo);
+		io::out(pic_data);
+		io::clr2(pic_clk, pic_data);
+		pgd = 0;
+		return;
+	}
 
-	GPIO_CLR(pic_mclr);			/* remove VDD from MCLR pin */
-	delay_us(DELAY_P6);			/* wait P13 */
-	GPIO_SET(pic_mclr);			/* apply VDD to MCLR pin */
-	delay_us(DELAY_P20);		/* wait P20 */
-	GPIO_CLR(pic_mclr);			/* remove VDD from MCLR pin */
-	delay_us(DELAY_P18);	/* wait P19 */
+	io::in(pic_mclr);
+	io::out(pic_mclr);
 
-	GPIO_CLR(pic_clk);
+	io::clr(pic_mclr);			/* remove VDD from MCLR pin */
+	delay_ns(delays[P6]);			/* wait P13 */
+	io::set(pic_mclr);			/* apply VDD to MCLR pin */
+	delay_ns(delays[P20]);		/* wait P20 */
+	io::clr(pic_mclr);			/* remove VDD from MCLR pin */
+	delay_ns(delays[P18]);	/* wait P19 */
+
+	io::clr(pic_clk);
 	/* Shift in the "enter program mode" key sequence (MSB first) */
 	for (i = 31; i > -1; i--) {
 		if ( (ENTER_PROGRAM_KEY >> i) & 0x01 )
-			GPIO_SET(pic_data);
+			io::set(pic_data);
 		else
-			GPIO_CLR(pic_data);
-		delay_us(DELAY_P1A);	/* Setup time */
-		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);	/* Hold time */
-		GPIO_CLR(pic_clk);
+			io::clr(pic_data);
+		delay_ns(delays[P1A]);	/* Setup time */
+		io::set(pic_clk);
+		delay_ns(delays[P1B]);	/* Hold time */
+		io::clr(pic_clk);
 
 	}
-	GPIO_CLR(pic_data);
-	delay_us(DELAY_P19);		/* Wait P19 */
-	GPIO_SET(pic_mclr);			/* apply VDD to MCLR pin */
-	delay_us(DELAY_P7);			/* Wait (at least) P7 */
+	io::clr(pic_data);
+	delay_ns(delays[P19]);		/* Wait P19 */
+	io::set(pic_mclr);			/* apply VDD to MCLR pin */
+	delay_ns(delays[P7]);			/* Wait (at least) P7 */
 }
 
-void pic32::exit_program_mode(void)
+template<class io>
+void pic32<io>::exit_program_mode(void)
 {
+	/* leave EJTAG boot: TAP reset, then a device reset through the MTAP */
+	if(jtag.on){
+		SetMode(6, 0b011111);
+		SendCommand(MTAP_SW_MTAP);
+		SendCommand(MTAP_COMMAND);
+		XferData(8, MCHP_ASSERT_RST);
+		XferData(8, MCHP_DE_ASSERT_RST);
+		SetMode(5, 0b11111);
+		io::clr2(pic_clk, pic_data);
+		io::clr(pic_tms);
+		return;
+	}
 
 	SetMode(5, 0b11111);
-	GPIO_CLR(pic_clk);			/* stop clock on PGC */
-	GPIO_CLR(pic_data);			/* clear data pin PGD */
-	delay_us(DELAY_P16);		/* wait P16 */
-	GPIO_CLR(pic_mclr);			/* remove VDD from MCLR pin */
-	delay_us(DELAY_P17);		/* wait (at least) P17 */
-	GPIO_SET(pic_mclr);
-	GPIO_IN(pic_mclr);
+	io::clr2(pic_clk, pic_data);	/* stop clock on PGC, clear data pin PGD */
+	delay_ns(delays[P16]);		/* wait P16 */
+	io::clr(pic_mclr);			/* remove VDD from MCLR pin */
+	delay_ns(delays[P17]);		/* wait (at least) P17 */
+	io::set(pic_mclr);
+	io::in(pic_mclr);
 }
 
 /* PSEUDO OPERATIONS */
-uint8_t pic32::Data4Phase(uint8_t tdi, uint8_t tms){
+template<class io>
+uint8_t pic32<io>::Data4Phase(uint8_t tdi, uint8_t tms){
 	uint8_t tdo;
 	
+	if(jtag.on)
+		return JtagClock(tdi, tms);
+
 	// data pin to output
-	GPIO_OUT(pic_data);
+	io::out(pic_data);
 	
 	// write TDI - sampling is on the falling edge
-	if(tdi & 0x01)
-		GPIO_SET(pic_data);
-	else
-		GPIO_CLR(pic_data);	
-	
-	GPIO_SET(pic_clk);
-	delay_us(DELAY_P1B);
-	GPIO_CLR(pic_clk);
-	delay_us(DELAY_P1A);
+	pgc_rise<io>(pic_clk, pic_data, tdi & 0x01, pgd);
+	delay_ns(delays[P1B]);
+	io::clr(pic_clk);
+	delay_ns(delays[P1A]);
 	
 	// write TMS - sampling is on the falling edge
-	if(tms & 0x01)
-		GPIO_SET(pic_data);
-	else
-		GPIO_CLR(pic_data);	
-	
-	GPIO_SET(pic_clk);
-	delay_us(DELAY_P1B);
-	GPIO_CLR(pic_clk);
-	delay_us(DELAY_P1A);
+	pgc_rise<io>(pic_clk, pic_data, tms & 0x01, pgd);
+	delay_ns(delays[P1B]);
+	io::clr(pic_clk);
+	delay_ns(delays[P1A]);
 	
 	// data pin to input
-	GPIO_CLR(pic_data);
-	GPIO_IN(pic_data);
+	io::clr(pic_data);
+	io::in(pic_data);
+	pgd = 0;
 	
 	// "empty" clock pulse
-	GPIO_SET(pic_clk);
-	delay_us(DELAY_P1B);
-	GPIO_CLR(pic_clk);
-	delay_us(DELAY_P1A);
+	io::set(pic_clk);
+	delay_ns(delays[P1B]);
+	io::clr(pic_clk);
+	delay_ns(delays[P1A]);
 	
 	// read TDO, sampling on the rising edge
-	GPIO_SET(pic_clk);
-	tdo = GPIO_LEV(pic_data);
-	delay_us(DELAY_P1B);
-	GPIO_CLR(pic_clk);
-	delay_us(DELAY_P1A);
+	io::set(pic_clk);
+	tdo = io::lev(pic_data);
+	delay_ns(delays[P1B]);
+	io::clr(pic_clk);
+	delay_ns(delays[P1A]);
 	
 	return (tdo & 0x01);
 }
 
-void pic32::Data2Phase(uint8_t tdi, uint8_t tms){
+template<class io>
+void pic32<io>::Data2Phase(uint8_t tdi, uint8_t tms){
+	if(jtag.on){
+		JtagClock(tdi, tms);
+		return;
+	}
+
 	// data pin to output
-	GPIO_OUT(pic_data);
+	io::out(pic_data);
 	
 	// write TDI - sampling is on the falling edge
-	if(tdi & 0x01)
-		GPIO_SET(pic_data);
-	else
-		GPIO_CLR(pic_data);	
-	
-	GPIO_SET(pic_clk);
-	delay_us(DELAY_P1B);
-	GPIO_CLR(pic_clk);
-	delay_us(DELAY_P1A);
+	pgc_rise<io>(pic_clk, pic_data, tdi & 0x01, pgd);
+	delay_ns(delays[P1B]);
+	io::clr(pic_clk);
+	delay_ns(delays[P1A]);
 	
 	// write TMS - sampling is on the falling edge
-	if(tms & 0x01)
-		GPIO_SET(pic_data);
-	else
-		GPIO_CLR(pic_data);	
-	
-	GPIO_SET(pic_clk);
-	delay_us(DELAY_P1B);
-	GPIO_CLR(pic_clk);
-	delay_us(DELAY_P1A);
+	pgc_rise<io>(pic_clk, pic_data, tms & 0x01, pgd);
+	delay_ns(delays[P1B]);
+	io::clr(pic_clk);
+	delay_ns(delays[P1A]);
 }
 
-void pic32::SetMode(uint8_t length, uint8_t mode){
+template<class io>
+uint8_t pic32<io>::JtagClock(uint8_t tdi, uint8_t tms){
+	// TMS only changes at the edges of SetMode/SendCommand/XferData
+	if((tms & 0x01) != tmsl){
+		tmsl = tms & 0x01;
+		if(tmsl)
+			io::set(pic_tms);
+		else
+			io::clr(pic_tms);
+	}
+
+	// TDI and TMS sampled on the rising edge: set up TDI before it
+	pgd_write<io>(pic_data, tdi & 0x01, pgd);
+	delay_ns(delays[P1A]);
+	io::set(pic_clk);
+	delay_ns(delays[P1B]);
+	io::clr(pic_clk);
+	delay_ns(delays[P1A]);
+
+	// TDO changes on the falling edge
+	return (io::lev(pic_tdo) & 0x01);
+}
+
+template<class io>
+void pic32<io>::SetMode(uint8_t length, uint8_t mode){
+	io::mark(OP_SET_MODE, mode);
 	for(int i=0; i < length; i++)
 		Data4Phase(0, (mode >> i));
 }
 
-void pic32::SendCommand(uint8_t command){
+template<class io>
+void pic32<io>::SendCommand(uint8_t command){
 	int i;
 	
+	io::mark(OP_SEND_CMD, command);
+
 	// TMS header 1100 (TDI set to 0)
     Data4Phase(0, 1);
 	Data4Phase(0, 1);
@@ -236,10 +409,13 @@ void pic32::SendCommand(uint8_t command){
 	Data4Phase(0, 0);
 }
 
-uint32_t pic32::XferData(uint8_t length, uint32_t iData){
+template<class io>
+uint32_t pic32<io>::XferData(uint8_t length, uint32_t iData){
 	int i;
 	uint32_t oData;
 	
+	io::mark(OP_XFER_DATA, iData);
+
 	// TMS header 100 (TDI set to 0)
     Data4Phase(0, 1);
 	Data4Phase(0, 0);
@@ -259,9 +435,12 @@ uint32_t pic32::XferData(uint8_t length, uint32_t iData){
 	return oData;
 }
 
-void pic32::XferFastData2P(uint32_t iData){
+template<class io>
+void pic32<io>::XferFastData2P(uint32_t iData){
 	uint8_t i;
 
+	io::mark(OP_XFER_FAST_2P, iData);
+
 	// TMS header 100 (TDI set to 0)
     Data2Phase(0, 1);
 	Data2Phase(0, 0);
@@ -282,16 +461,20 @@ void pic32::XferFastData2P(uint32_t iData){
 	Data2Phase(0, 0);	
 }
 
-uint32_t pic32::XferFastData4P(uint32_t iData){
+template<class io>
+uint32_t pic32<io>::XferFastData4P(uint32_t iData){
 	uint8_t i = 0;
 	uint32_t oData = 0;
 
+	io::mark(OP_XFER_FAST_4P, iData);
+
 	do{
+		io::mark(OP_POLL);
 		// TMS header 100 (TDI set to 0)
 		Data4Phase(0, 1);
 		Data4Phase(0, 0);
 		i = Data4Phase(0, 0);
-	} while(!i);
+	} while(io::poll(!i));
 	
 	// prAcc
 	oData |= Data4Phase(0, 0);
@@ -310,15 +493,17 @@ uint32_t pic32::XferFastData4P(uint32_t iData){
 	return oData;
 }
 
-void pic32::XferInstruction(uint32_t instruction){
+template<class io>
+void pic32<io>::XferInstruction(uint32_t instruction){
 	uint32_t controlVal;
 	// Select Control Register
 	SendCommand(ETAP_CONTROL);
 	// Wait until CPU is ready
 	// Check if Processor Access bit (bit 18) is set
 	do {
+		io::mark(OP_POLL);
 		controlVal = XferData(32, 0x0004C000);
-	} while(!((controlVal >> 18) & 0x01));
+	} while(io::poll(!((controlVal >> 18) & 0x01)));
 	// Select Data Register
 	SendCommand(ETAP_DATA);
 	// Send the instruction
@@ -328,7 +513,8 @@ void pic32::XferInstruction(uint32_t instruction){
 	XferData(32, 0x0000C000);
 }
 
-uint32_t pic32::ReadFromAddress(uint32_t address){
+template<class io>
+uint32_t pic32<io>::ReadFromAddress(uint32_t address){
 	uint32_t instruction, oData;
 
 	// Load Fast Data register address to s3
@@ -353,7 +539,8 @@ uint32_t pic32::ReadFromAddress(uint32_t address){
 	return oData;
 }
 
-uint32_t pic32::GetPEResponse(void){
+template<class io>
+uint32_t pic32<io>::GetPEResponse(void){
 	uint32_t response;
 
 	// Wait until CPU is ready
@@ -361,8 +548,9 @@ uint32_t pic32::GetPEResponse(void){
 	
 	// Check if Processor Access bit (bit 18) is set
 	do {
+		io::mark(OP_POLL);
 		response = XferData(32, 0x0004c000);
-	} while(!( (response >> 18) & 0x01 ));
+	} while(io::poll(!( (response >> 18) & 0x01 )));
 	
 	// Select Data Register
 	SendCommand(ETAP_DATA);
@@ -375,7 +563,8 @@ uint32_t pic32::GetPEResponse(void){
 	return response;
 }
 
-bool pic32::check_device_status(void){
+template<class io>
+bool pic32<io>::check_device_status(void){
 	uint32_t statusVal = 0;
 	clock_t start;
 	bool timeout_avoided = true;
@@ -386,15 +575,17 @@ bool pic32::check_device_status(void){
 	
 	start = clock();
 	do{
+		io::mark(OP_POLL);
 		statusVal = XferData(8, MCHP_STATUS);
 		if( (clock() - start) / (double) CLOCKS_PER_SEC > 0.01)
 			timeout_avoided = false;
-	} while(timeout_avoided && ((statusVal & 0x0C) != 0x08));
+	} while(io::poll(timeout_avoided && ((statusVal & 0x0C) != 0x08)));
 
 	return timeout_avoided;
 }
 
-void pic32::code_protected_bulk_erase(void){
+template<class io>
+void pic32<io>::code_protected_bulk_erase(void){
 	uint32_t statusVal = 0;
 	
 	SendCommand(MTAP_SW_MTAP);
@@ -405,12 +596,14 @@ void pic32::code_protected_bulk_erase(void){
 		XferData(8, MCHP_DE_ASSERT_RST);
 	delay_us(10000);
 	do{
+		io::mark(OP_POLL);
 		statusVal = XferData(8, MCHP_STATUS);
-	} while((statusVal & 0x0C) != 0x08);
+	} while(io::poll((statusVal & 0x0C) != 0x08));
 	if(flags.client) fprintf(stdout, "@FIN");
 }
 
-bool pic32::enter_serial_exec_mode(void){
+template<class io>
+bool pic32<io>::enter_serial_exec_mode(void){
 	uint32_t statusVal = 0;
 	
 	SendCommand(MTAP_SW_MTAP);
@@ -433,7 +626,8 @@ bool pic32::enter_serial_exec_mode(void){
 	return true;
 }
 
-void pic32::download_pe(vector<uint32_t> pe_pointer){
+template<class io>
+void pic32<io>::download_pe(vector<uint32_t> pe_pointer){
 	
 	uint32_t i;
 	
@@ -490,7 +684,8 @@ void pic32::download_pe(vector<uint32_t> pe_pointer){
 	GetPEResponse();
 }
 
-bool pic32::setup_pe(void){
+template<class io>
+bool pic32<io>::setup_pe(void){
 	
 	if(!check_device_status()){
         cerr << "Timeout occurred checking device status!" << endl;
@@ -521,7 +716,8 @@ bool pic32::setup_pe(void){
 	return true;
 }
 
-bool pic32::read_device_id(void){
+template<class io>
+bool pic32<io>::read_device_id(void){
 	uint32_t rxp;
 	
 	bool found = false;
@@ -588,7 +784,8 @@ bool pic32::read_device_id(void){
 	return found;
 }
 
-void pic32::bulk_erase(void){
+template<class io>
+void pic32<io>::bulk_erase(void){
 	
 	uint32_t rxp;
 	
@@ -601,7 +798,8 @@ void pic32::bulk_erase(void){
 	if(flags.client) fprintf(stdout, "@FIN");
 }
 
-uint8_t pic32::blank_check(void){
+template<class io>
+uint8_t pic32<io>::blank_check(void){
 	uint32_t rxp = 0;
 	SendCommand(ETAP_FASTDATA);
 	XferFastData4P(PE_CMD_BLANK_CHECK);
@@ -614,7 +812,8 @@ uint8_t pic32::blank_check(void){
 		return 1;
 };
 
-void pic32::read(char *outfile, uint32_t start, uint32_t count){
+template<class io>
+void pic32<io>::read(char *outfile, uint32_t start, uint32_t count){
 	uint32_t rxp = 0;
 	uint32_t blocksize = 0;	// expressed in bytes
 	const uint32_t max_blocksize = 0x0000FFFF*4;
@@ -679,6 +878,8 @@ void pic32::read(char *outfile, uint32_t start, uint32_t count){
 					read_locations += 4;
 
 					uint32_t cur_counter = read_locations*100/total_to_read;
+					io::mark(OP_ROW, addr);
+					rt_checkpoint();
 					if(counter != cur_counter){
 						counter = cur_counter;
 						if(flags.client)
@@ -697,13 +898,11 @@ void pic32::read(char *outfile, uint32_t start, uint32_t count){
 	write_inhx(&mem, outfile, PROGRAM_FLASH_BASEADDR);
 };
 
-void pic32::write(char *infile){
+template<class io>
+void pic32<io>::write(char *infile){
 	uint32_t rxp = 0;
-	uint8_t area = PROGRAM_AREA;
-	uint32_t addr = 0, startaddr = 0, stopaddr = 0;
-	uint32_t filled_locations = 0, programmed_locations = 0;
-	bool skip = true;
-	uint32_t counter = 0;
+	uint32_t addr = 0;
+	uint32_t filled_locations = 0;
 	uint32_t device_checksum = 0, calculated_checksum = 0;
 	
 	filled_locations = read_inhx(infile, &mem, PROGRAM_FLASH_BASEADDR);
@@ -714,74 +913,30 @@ void pic32::write(char *infile){
 	if(!flags.debug) cerr << "[ 0%]";
 	if(flags.client) fprintf(stdout, "@000");
 	
-	do{
+	pe_rows rows = { &mem, rowsize, bootsize };
+	rows.filled = filled_locations;
+	pe_area(&rows, PROGRAM_AREA);
+	row_pipe<pe_row> pipe(pack_pe_row, &rows, report_pe_row);
+	pe_row *row;
 
-		switch(area){
-			case PROGRAM_AREA:	// Write Program Flash
-				startaddr = 0;
-				stopaddr = (mem.code_memory_size*2)-1;
-				break;
-			case BOOT_AREA:	// Write bootflash+configuration
-				startaddr = BOOTFLASH_OFFSET;
-				stopaddr = startaddr+bootsize-1;
-				break;
-			default:
-				break;
-		}
-		
-		if(((area == PROGRAM_AREA) & !flags.boot_only) || ((area == BOOT_AREA) & !flags.program_only)){
-	
-			for (addr = startaddr; addr < stopaddr; addr += rowsize){
-				
-				skip = true;
-				for(uint32_t i=0; i<rowsize; i++){
-					if(mem.filled[(addr+i)/2]){
-						skip = false;
-						break;
-					}
-				}
-				if(skip){
-					calculated_checksum += 0x000000FF*rowsize;
-					continue;
-				}
-				
-				SendCommand(ETAP_FASTDATA);
-				XferFastData4P(PE_CMD_ROW_PROGRAM);
-				XferFastData4P(PROGRAM_FLASH_BASEADDR+addr);
-				
-				for(uint32_t i=0; i<rowsize; i+=4){
-					if(mem.filled[(addr+i)/2]){
-						XferFastData4P((uint32_t)mem.location[(addr+i)/2] |
-									((uint32_t)mem.location[(addr+i)/2+1] << 16));
-						programmed_locations += 2;
-						if((addr+i) < (BOOTFLASH_OFFSET+bootsize-16)){
-							calculated_checksum += (mem.location[(addr+i)/2] & 0x00FF) +
-												(mem.location[(addr+i)/2] >> 8) +
-												(mem.location[(addr+i)/2+1] & 0x00FF) +
-												(mem.location[(addr+i)/2+1] >> 8);
-						}
-					}
-					else{
-						XferFastData4P(0xFFFFFFFF);
-						if((addr+i) < (BOOTFLASH_OFFSET+bootsize-16))
-							calculated_checksum += 0x000000FF*4;
-					}
-				}
-				rxp = GetPEResponse();
-				if(rxp != PE_CMD_ROW_PROGRAM)
-					fprintf(stderr, "___ERR___: %08x\n", rxp);
-					
-				if(counter != programmed_locations*100/filled_locations){
-					counter = programmed_locations*100/filled_locations;
-					if(flags.client)
-						fprintf(stdout,"@%03d", counter);
-					if(!flags.debug)
-						fprintf(stderr,"\b\b\b\b\b[%2d%%]", counter);
-				}
-			}
-		}
-		area++;
-	} while(area<=BOOT_AREA);
+	while ((row = pipe.next())) {
+		addr = row->addr;
+
+		SendCommand(ETAP_FASTDATA);
+		XferFastData4P(PE_CMD_ROW_PROGRAM);
+		XferFastData4P(PROGRAM_FLASH_BASEADDR+addr);
+		for(uint32_t i=0; i<rowsize/4; i++)
+			XferFastData4P(row->word[i]);
+		pipe.done();
+
+		rxp = GetPEResponse();
+		if(rxp != PE_CMD_ROW_PROGRAM)
+			fprintf(stderr, "___ERR___: %08x\n", rxp);
+
+		io::mark(OP_ROW, addr);
+		rt_checkpoint();
+	}
+	calculated_checksum = rows.checksum;
 	
 	if(!flags.debug) cerr << "\b\b\b\b\b\b";
 	if(flags.client) fprintf(stdout, "@FIN");
@@ -817,7 +972,8 @@ void pic32::write(char *infile){
 	
 	if(flags.client) fprintf(stdout, "@FIN");
 };
-void pic32::dump_configuration_registers(void){
+template<class io>
+void pic32<io>::dump_configuration_registers(void){
 	SendCommand(ETAP_FASTDATA);
 	XferFastData4P(PE_CMD_READ | 0x04);
 	XferFastData4P(PROGRAM_FLASH_BASEADDR+BOOTFLASH_OFFSET+bootsize-16);
@@ -826,3 +982,5 @@ void pic32::dump_configuration_registers(void){
 		fprintf(stderr, "DEVCFG%d = %08x\n", 3-r, (GetPEResponse()));
 	}
 };
+
+INSTANTIATE_DEVICE(pic32)
@@ -22,6 +22,7 @@
 #include <vector>
 
 #include "../common.h"
+#include "../pipe.h"
 #include "device.h"
 
 using namespace std;
@@ -37,11 +38,15 @@ extern vector<uint32_t> pic32_pemx1;
 extern vector<uint32_t> pic32_pemx3;
 extern vector<uint32_t> pic32_pemz;
 
+template<class io>
 class pic32: public Pic{
 
 	public:
 		pic32(uint8_t sf){
 			subfamily=sf;
+			pgd=1;
+			pic_tms=jtag.tms;
+			pic_tdo=jtag.tdo;
 		};
 		void enter_program_mode(void);
 		void exit_program_mode(void);
@@ -56,6 +61,7 @@ class pic32: public Pic{
 	protected:
 		uint8_t Data4Phase(uint8_t tdi, uint8_t tms);
 		void Data2Phase(uint8_t tdi, uint8_t tms);
+		uint8_t JtagClock(uint8_t tdi, uint8_t tms);
 		void SetMode(uint8_t length, uint8_t mode);
 		void SendCommand(uint8_t command);
 		uint32_t XferData(uint8_t length, uint32_t iData);
@@ -71,6 +77,9 @@ class pic32: public Pic{
 		
 		uint32_t bootsize;
 		uint32_t rowsize;
+		int pgd;		// PGD level left by the last TDI/TMS phase
+		int pic_tms, pic_tdo;	// 4-wire JTAG only
+		int tmsl;		// TMS level left by the last JTAG clock
 
 		/*
 		* DEVICES SECTION
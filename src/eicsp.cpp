@@ -0,0 +1,142 @@
+/*
+ * Raspberry Pi PIC Programmer using GPIO connector
+ * https://github.com/WallaceIT/picberry
+ * Copyright 2014 Francesco Valla
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+
+#include "common.h"
+#include "eicsp.h"
+
+struct pe_struct pe;
+
+/* Pack n instructions (n even) of mem at addr for the PE, blank if unset */
+void eicsp_pack(const memory *mem, uint32_t addr, int n, uint16_t *word)
+{
+	uint16_t lsw[2], msb[2];
+	int i, j;
+
+	for (i = 0; i < n; i += 2) {
+		for (j = 0; j < 2; j++) {
+			uint32_t a = addr + 2 * (i + j);
+
+			lsw[j] = mem->filled[a] ? mem->location[a] : 0xFFFF;
+			msb[j] = mem->filled[a+1] ? mem->location[a+1] & 0xFF : 0xFF;
+		}
+		*word++ = lsw[0];
+		*word++ = (msb[1] << 8) | msb[0];
+		*word++ = lsw[1];
+	}
+}
+
+/* Unpack n instructions read from the PE, as in memory::location */
+void eicsp_unpack(const uint16_t *word, int n, uint16_t *data)
+{
+	for (int i = 0; i < n; i += 2, word += 3) {
+		*data++ = word[0];
+		*data++ = word[1] & 0xFF;
+		*data++ = word[2];
+		*data++ = word[1] >> 8;
+	}
+}
+
+/*
+ * CRC-CCITT (polynomial 0x1021, seed 0xFFFF) of n instructions of mem at
+ * addr, low byte first, as CRCP computes it; unset locations are blank
+ */
+uint16_t eicsp_crc(const memory *mem, uint32_t addr, uint32_t n)
+{
+	uint16_t crc = 0xFFFF, lsw;
+	uint8_t byte[3];
+	int i, j;
+
+	for (; n > 0; n--, addr += 2) {
+		lsw = mem->filled[addr] ? mem->location[addr] : 0xFFFF;
+		byte[0] = lsw & 0xFF;
+		byte[1] = lsw >> 8;
+		byte[2] = mem->filled[addr+1] ? mem->location[addr+1] & 0xFF : 0xFF;
+
+		for (i = 0; i < 3; i++) {
+			crc ^= byte[i] << 8;
+			for (j = 0; j < 8; j++)
+				crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+		}
+	}
+	return crc;
+}
+
+/* Restart in Enhanced ICSP, talking to the PE */
+void eicsp_device::pe_enter(void)
+{
+	exit_program_mode();
+	enter_mode(ENTER_EICSP_KEY);
+}
+
+/* Restart in plain ICSP */
+void eicsp_device::pe_leave(void)
+{
+	exit_program_mode();
+	enter_mode(ENTER_ICSP_KEY);
+}
+
+static bool exec_used(const memory *m, uint32_t addr, uint32_t n)
+{
+	for (uint32_t k = 0; k < n; k++)
+		if (m->filled[addr + k])
+			return true;
+	return false;
+}
+
+/*
+ * Write the PE image in file (e.g. RIPE_xx.hex of MPLAB) to executive
+ * memory over ICSP, erasing only the pages it uses, and verify it
+ */
+bool eicsp_device::download_pe(const char *file)
+{
+	memory exec = {};
+	uint32_t addr;
+	bool ok = true;
+
+	/* as large as mem: read_inhx() takes whatever the file has */
+	exec.program_memory_size = 0x0F80018;
+	exec.code_memory_size = EXEC_END;
+	exec.location = (uint16_t *) calloc(exec.program_memory_size,
+										sizeof(uint16_t));
+	exec.filled = (bool *) calloc(exec.program_memory_size, sizeof(bool));
+	if (!exec.location || !exec.filled || !read_inhx((char *) file, &exec)) {
+		free(exec.location);
+		free(exec.filled);
+		return false;
+	}
+
+	for (addr = EXEC_BASE; addr < EXEC_END; addr += exec_page)
+		if (exec_used(&exec, addr, exec_page))
+			erase_page(addr);
+
+	for (addr = EXEC_BASE; addr < EXEC_END; addr += exec_row)
+		if (exec_used(&exec, addr, exec_row))
+			write_row(&exec, addr);
+
+	for (addr = EXEC_BASE; ok && addr < EXEC_END; addr += 8)
+		if (exec_used(&exec, addr, 8) && verify_block(addr, &exec, 1))
+			ok = false;
+
+	free(exec.location);
+	free(exec.filled);
+	return ok;
+}
@@ -0,0 +1,540 @@
+/*
+ * Raspberry Pi PIC Programmer using GPIO connector
+ * https://github.com/WallaceIT/picberry
+ * Copyright 2014 Francesco Valla
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EICSP_H_
+#define EICSP_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <iostream>
+
+#include "common.h"
+
+/*
+ * Enhanced ICSP of the 16-bit families (dsPIC33, PIC24). The programming
+ * executive (PE), a program in executive memory, takes commands over
+ * PGC/PGD: 16-bit words, MSB first, latched on the falling edge of PGC.
+ * The length of a command (in words) is in the low 12 bits of its first
+ * word. Then the programmer releases PGD: the PE drives it high while it
+ * works and low when its response is ready, and the programmer clocks in
+ * the response: the opcode word (PASS/FAIL/NACK, command, QE code), the
+ * length of the response and its data.
+ *
+ * Program memory goes through the PE packed: two instructions in three
+ * words, LSW1, MSB2:MSB1 and LSW2 (eicsp_pack()/eicsp_unpack()).
+ *
+ * The PE images are Microchip's and are not shipped with picberry: the
+ * PE already in executive memory is used, or --pe=FILE writes one first
+ * where the device class supports it. A device class only switches to
+ * Enhanced ICSP once the PE has answered its sanity check, else it stays
+ * on plain ICSP.
+ */
+#define ENTER_EICSP_KEY		0x4D434850
+#define ENTER_ICSP_KEY		0x4D434851	// back to plain ICSP
+
+#define EXEC_BASE			0x800000	// executive memory, holds the PE
+#define EXEC_END			0x801000
+
+#define PE_SCHECK			0x0
+#define PE_READC			0x1
+#define PE_READP			0x2
+#define PE_PROGP			0x5
+#define PE_ERASEB			0x7
+#define PE_QBLANK			0xA
+#define PE_QVER				0xB
+#define PE_CRCP				0xC
+
+#define PE_PASS				0x1
+#define PE_FAIL				0x2
+#define PE_NACK				0x3
+
+#define PE_QE_BLANK			0xF0
+
+/* response opcode word: PASS for command op */
+#define PE_OK(r, op)		(((r) >> 8) == ((PE_PASS << 4) | (op)))
+
+#define EICSP_ROW_MAX		128		// instructions in a PROGP row, at most
+#define EICSP_READ_MAX		128		// instructions read by one READP
+#define EICSP_CRC_PAGE		1024	// instructions checked by one CRCP
+
+/* Enhanced ICSP timings of a device class, in nanoseconds */
+struct eicsp_timing {
+	unsigned int	p1a, p1b;	// PGC low and high time
+	unsigned int	p9a;		// PE command processing time
+	unsigned int	p9b;		// PGD low by the PE to the first response clock
+	uint64_t		timeout;	// longest command (an erase)
+};
+
+#define EICSP_TIMEOUT		1000000000ULL	// ns, for eicsp_timing::timeout
+
+/*
+ * The Enhanced ICSP side of a 16-bit device class, which derives from it
+ * next to Pic. Its setup_pe() is pe_setup<io>() on the PGC and PGD pins of
+ * its own head (Pic::pic_clk, Pic::pic_data), its enter_program_mode()
+ * sets pe_time from the timing profile, and read, write and blank check
+ * go through the PE, between pe_enter() and pe_leave(), when use_pe is
+ * set. download_pe() writes the PE of --pe with the ICSP steps of the
+ * class, on the erase pages and rows (in addresses) of its constructor.
+ */
+class eicsp_device{
+	public:
+		eicsp_device(uint32_t page, uint32_t row)
+			: exec_page(page), exec_row(row) {};
+		virtual ~eicsp_device(){};
+		virtual void exit_program_mode(void) = 0;
+
+	protected:
+		bool use_pe = false;		// the PE answered: use it
+		uint8_t pe_version = 0;
+		eicsp_timing pe_time = {};
+		uint32_t exec_page, exec_row;
+
+		virtual void enter_mode(uint32_t key) = 0;
+		virtual void erase_page(uint32_t addr) = 0;
+		virtual void write_row(memory *m, uint32_t addr) = 0;
+		/* targets of want whose 8 locations at addr differ from image */
+		virtual uint32_t verify_block(uint32_t addr, memory *image,
+									  uint32_t want) = 0;
+
+		void pe_enter(void);
+		void pe_leave(void);
+		eicsp_timing pe_timing(void){ return pe_time; }
+		bool download_pe(const char *file);
+		template<class io> bool pe_setup(int clk, int data);
+};
+
+/* eicsp.cpp */
+void eicsp_pack(const memory *mem, uint32_t addr, int n, uint16_t *word);
+void eicsp_unpack(const uint16_t *word, int n, uint16_t *data);
+uint16_t eicsp_crc(const memory *mem, uint32_t addr, uint32_t n);
+
+/* Send a 16-bit word to the PE (MSB first) */
+template<class io>
+static inline void eicsp_send(int clk, int data, uint16_t w,
+							  const eicsp_timing &t)
+{
+	int pgd = 0;
+
+	io::clr(data);
+	for (int i = 15; i > -1; i--) {
+		pgc_rise<io>(clk, data, (w >> i) & 0x01, pgd);
+		delay_ns(t.p1b);
+		io::clr(clk);
+		delay_ns(t.p1a);
+	}
+}
+
+/* Read a 16-bit word from the PE (MSB first) */
+template<class io>
+static inline uint16_t eicsp_recv(int clk, int data, const eicsp_timing &t)
+{
+	uint16_t w = 0;
+
+	for (int i = 15; i > -1; i--) {
+		io::set(clk);
+		delay_ns(t.p1b);
+		w |= (io::lev(data) & 0x01) << i;
+		io::clr(clk);
+		delay_ns(t.p1a);
+	}
+	return w;
+}
+
+/*
+ * Send a command and read its response, up to n data words into resp.
+ * Returns the opcode word of the response, 0 if the PE did not answer
+ * (or the response does not fit resp).
+ */
+template<class io>
+static uint16_t eicsp_command(int clk, int data, const uint16_t *cmd,
+							  uint16_t *resp, int n, const eicsp_timing &t)
+{
+	uint16_t r, len;
+	uint64_t end;
+	bool busy;
+	int i;
+
+	io::mark(OP_SEND_CMD, cmd[0]);
+	io::clr(clk);
+	io::out(data);
+	for (i = 0; i < (cmd[0] & 0x0FFF); i++)
+		eicsp_send<io>(clk, data, cmd[i], t);
+
+	/* wait for the PE: PGD high while busy, low when done */
+	io::clr(data);
+	io::in(data);
+	delay_ns(t.p9a);
+	end = now_ns() + t.timeout;
+	do {
+		io::mark(OP_POLL);
+		busy = io::lev(data);
+	} while (io::poll(busy && now_ns() <= end));
+	if (busy) {
+		io::out(data);
+		return 0;
+	}
+	delay_ns(t.p9b);
+
+	io::mark(OP_READ_DATA);
+	r = eicsp_recv<io>(clk, data, t);
+	len = eicsp_recv<io>(clk, data, t);
+	if (len < 2 || len - 2 > n || ((r >> 8) & 0x0F) != (cmd[0] >> 12))
+		r = 0;
+	else
+		for (i = 0; i < len - 2; i++)
+			resp[i] = eicsp_recv<io>(clk, data, t);
+
+	io::out(data);
+	return r;
+}
+
+/* SCHECK then QVER: true if a PE answers, with its version */
+template<class io>
+static bool eicsp_sanity(int clk, int data, const eicsp_timing &t,
+						 uint8_t *version)
+{
+	const uint16_t scheck[] = { PE_SCHECK << 12 | 1 };
+	const uint16_t qver[] = { PE_QVER << 12 | 1 };
+	eicsp_timing q = t;
+	uint16_t r;
+
+	/* both answer at once: do not wait long for a missing PE */
+	q.timeout = 10000000;
+	if (!PE_OK(eicsp_command<io>(clk, data, scheck, 0, 0, q), PE_SCHECK))
+		return false;
+	r = eicsp_command<io>(clk, data, qver, 0, 0, q);
+	if (!PE_OK(r, PE_QVER))
+		return false;
+	*version = r & 0xFF;
+	return true;
+}
+
+/* PROGP: program the row of n instructions of mem at addr */
+template<class io>
+static bool eicsp_progp(int clk, int data, const eicsp_timing &t,
+						const memory *mem, uint32_t addr, int n)
+{
+	uint16_t cmd[3 + EICSP_ROW_MAX * 3 / 2];
+
+	cmd[0] = PE_PROGP << 12 | (3 + n * 3 / 2);
+	cmd[1] = addr >> 16;
+	cmd[2] = addr & 0xFFFF;
+	eicsp_pack(mem, addr, n, &cmd[3]);
+
+	return PE_OK(eicsp_command<io>(clk, data, cmd, 0, 0, t), PE_PROGP);
+}
+
+/*
+ * READP: read n instructions (n even, at most EICSP_READ_MAX) at addr
+ * into loc, in the layout of memory::location
+ */
+template<class io>
+static bool eicsp_readp(int clk, int data, const eicsp_timing &t,
+						uint32_t addr, int n, uint16_t *loc)
+{
+	uint16_t cmd[4], word[EICSP_READ_MAX * 3 / 2];
+
+	cmd[0] = PE_READP << 12 | 4;
+	cmd[1] = n;
+	cmd[2] = addr >> 16;
+	cmd[3] = addr & 0xFFFF;
+	if (!PE_OK(eicsp_command<io>(clk, data, cmd, word, n * 3 / 2, t),
+			   PE_READP))
+		return false;
+
+	eicsp_unpack(word, n, loc);
+	return true;
+}
+
+/* QBLANK: 1 if the n instructions at addr are blank, 0 if not, -1 error */
+template<class io>
+static int eicsp_qblank(int clk, int data, const eicsp_timing &t,
+						uint32_t addr, uint32_t n)
+{
+	uint16_t cmd[5], r;
+
+	cmd[0] = PE_QBLANK << 12 | 5;
+	cmd[1] = n >> 16;
+	cmd[2] = n & 0xFFFF;
+	cmd[3] = addr >> 16;
+	cmd[4] = addr & 0xFFFF;
+	r = eicsp_command<io>(clk, data, cmd, 0, 0, t);
+	if (!PE_OK(r, PE_QBLANK))
+		return -1;
+	return (r & 0xFF) == PE_QE_BLANK;
+}
+
+/* CRCP: CRC of the n instructions at addr, false if the PE cannot */
+template<class io>
+static bool eicsp_crcp(int clk, int data, const eicsp_timing &t,
+					   uint32_t addr, uint32_t n, uint16_t *crc)
+{
+	uint16_t cmd[5];
+
+	cmd[0] = PE_CRCP << 12 | 5;
+	cmd[1] = addr >> 16;
+	cmd[2] = addr & 0xFFFF;
+	cmd[3] = n >> 16;
+	cmd[4] = n & 0xFFFF;
+	return PE_OK(eicsp_command<io>(clk, data, cmd, crc, 1, t), PE_CRCP);
+}
+
+/* Instructions of a READP at addr, stopping at stop (even, at most 128) */
+static inline int eicsp_span(uint32_t addr, uint32_t stop)
+{
+	int n = ((stop - addr + 3) / 4) * 2;
+
+	return n > EICSP_READ_MAX ? EICSP_READ_MAX : n;
+}
+
+/* Read program memory from start to stop into mem (READP) */
+template<class io>
+static void eicsp_read(int clk, int data, const eicsp_timing &t,
+					   memory *mem, uint32_t start, uint32_t stop,
+					   unsigned int &counter)
+{
+	uint16_t word[2*EICSP_READ_MAX];
+	uint32_t addr;
+	int i, n;
+
+	for(addr=start & ~1; addr < stop; addr=addr+2*n) {
+		n = eicsp_span(addr, stop);
+		if(!eicsp_readp<io>(clk, data, t, addr, n, word)){
+			fprintf(stderr, "\n\n ERROR: the programming executive "
+					"did not read %06X\n\n", addr);
+			break;
+		}
+
+		for(i=0; i<2*n && addr+i < stop; i++){
+			if (flags.debug)
+				fprintf(stderr, "\n addr = 0x%06X data = 0x%04X",
+						(addr+i), word[i]);
+
+			if ((i%2 == 0 && word[i] != 0xFFFF) ||
+				(i%2 == 1 && word[i] != 0x00FF)) {
+				mem->location[addr+i]	= word[i];
+				mem->filled[addr+i]	= 1;
+			}
+		}
+
+		io::mark(OP_ROW, addr);
+		rt_checkpoint();
+		if(counter != addr*100/stop){
+			counter = addr*100/stop;
+			if(flags.client)
+				fprintf(stdout,"@%03d", counter);
+			if(!flags.debug)
+				fprintf(stderr,"\b\b\b\b\b[%2d%%]", counter);
+		}
+	}
+}
+
+/*
+ * Blank check of code memory (size addresses) with READP, for the PEs
+ * without a usable QBLANK: 1 if not blank, 0 if blank, -1 if the PE failed
+ */
+template<class io>
+static int eicsp_blank(int clk, int data, const eicsp_timing &t,
+					   uint32_t size)
+{
+	uint16_t word[2*EICSP_READ_MAX];
+	uint32_t addr;
+	int i, n;
+
+	for(addr=0; addr < size; addr=addr+2*n) {
+		n = eicsp_span(addr, size);
+		if(!eicsp_readp<io>(clk, data, t, addr, n, word))
+			return -1;
+
+		for(i=0; i<2*n; i++)
+			if ((i%2 == 0 && word[i] != 0xFFFF) ||
+				(i%2 == 1 && word[i] != 0x00FF))
+				return 1;
+
+		io::mark(OP_ROW, addr);
+		rt_checkpoint();
+	}
+
+	return 0;
+}
+
+/*
+ * Write the code memory of mem, in rows of row instructions (PROGP);
+ * false if the PE failed
+ */
+template<class io>
+static bool eicsp_write(int clk, int data, const eicsp_timing &t,
+						const memory *mem, int row,
+						unsigned int filled_locations, unsigned int &counter)
+{
+	uint32_t addr;
+	uint16_t k;
+	bool skip, ok = true;
+
+	for(addr=0; addr < mem->code_memory_size; addr=addr+2*row) {
+		skip = 1;
+		for(k=0; k<2*row; k+=2)
+			if(mem->filled[addr+k]) skip = 0;
+		if(skip) continue;
+
+		if(!eicsp_progp<io>(clk, data, t, mem, addr, row)){
+			fprintf(stderr, "\n\n ERROR: the programming executive "
+					"did not write the row at %06X\n\n", addr);
+			ok = false;
+			break;
+		}
+
+		io::mark(OP_ROW, addr+2*row);
+		rt_checkpoint();
+		if(counter != (addr+2*row)*100/filled_locations){
+			if(flags.client)
+				fprintf(stdout,"@%03d", ((addr+2*row)*100/(filled_locations+0x100)));
+			if(!flags.debug)
+				fprintf(stderr,"\b\b\b\b\b[%2d%%]", (addr+2*row)*100/(filled_locations+0x100));
+			counter = (addr+2*row)*100/filled_locations;
+		}
+	}
+
+	return ok;
+}
+
+/*
+ * Verify code memory against mem; false at the first mismatch. Each page
+ * with data is checked by the PE with CRCP against the CRC of the image,
+ * and read back (READP) only if the two differ. If the PE has no CRCP, or
+ * a page reads back right although its CRC differed, the CRCs are not
+ * comparable and the rest is read back.
+ */
+template<class io>
+static bool eicsp_verify(int clk, int data, const eicsp_timing &t,
+						 const memory *mem, unsigned int filled_locations,
+						 unsigned int &counter)
+{
+	uint16_t word[2*EICSP_READ_MAX], crc;
+	uint32_t addr, page, end;
+	uint16_t k;
+	bool skip, read, use_crc = true;
+	int i, n;
+
+	if(!flags.debug) cerr << "[ 0%]";
+	if(flags.client) fprintf(stdout, "@000");
+	counter = 0;
+
+	for(page=0; page < mem->code_memory_size; page=end) {
+		end = page + 2*EICSP_CRC_PAGE;
+		if(end > mem->code_memory_size)
+			end = mem->code_memory_size;
+
+		skip = 1;
+		for(addr=page; addr<end; addr+=2)
+			if(mem->filled[addr]) skip = 0;
+		if(skip) continue;
+
+		read = true;
+		if(use_crc && !eicsp_crcp<io>(clk, data, t, page, (end-page)/2, &crc))
+			use_crc = false;
+		else if(use_crc)
+			read = crc != eicsp_crc(mem, page, (end-page)/2);
+		if(read && use_crc && flags.debug)
+			fprintf(stderr, "\n CRC of %06X-%06X is %04X, %04X expected",
+					page, end-2, crc, eicsp_crc(mem, page, (end-page)/2));
+
+		for(addr=page; read && addr < end; addr=addr+2*n) {
+			n = eicsp_span(addr, end);
+
+			skip = 1;
+			for(k=0; k<2*n; k+=2)
+				if(mem->filled[addr+k]) skip = 0;
+			if(skip) continue;
+
+			if(!eicsp_readp<io>(clk, data, t, addr, n, word)){
+				fprintf(stderr, "\n\n ERROR: the programming executive "
+						"did not read %06X\n\n", addr);
+				return false;
+			}
+
+			for(i=0; i<2*n; i++){
+				if (flags.debug)
+					fprintf(stderr, "\n addr = 0x%06X data = 0x%04X", (addr+i), word[i]);
+
+				if(mem->filled[addr+i] && word[i] != mem->location[addr+i]){
+					fprintf(stderr,"\n\n ERROR at address %06X: written %04X but %04X read!\n\n",
+									addr+i, mem->location[addr+i], word[i]);
+					return false;
+				}
+			}
+
+			io::mark(OP_ROW, addr);
+			rt_checkpoint();
+		}
+
+		/* the page is right: its CRC cannot be compared with ours */
+		if(read && use_crc){
+			if(flags.debug)
+				cerr << endl << "CRC not comparable, reading back" << endl;
+			use_crc = false;
+		}
+
+		io::mark(OP_ROW, page);
+		rt_checkpoint();
+		if(counter != end*100/filled_locations){
+			if(flags.client)
+				fprintf(stdout,"@%03d", (end*100/(filled_locations+0x100)));
+			if(!flags.debug)
+				fprintf(stderr,"\b\b\b\b\b[%2d%%]", end*100/(filled_locations+0x100));
+			counter = end*100/filled_locations;
+		}
+	}
+
+	if(!flags.debug) cerr << "\b\b\b\b\b";
+	if(flags.client) fprintf(stdout, "@FIN");
+	return true;
+}
+
+
+/*
+ * Use Enhanced ICSP if a PE answers on clk/data, after writing the one of
+ * --pe to executive memory; stays in (or goes back to) ICSP either way
+ */
+template<class io>
+bool eicsp_device::pe_setup(int clk, int data)
+{
+	use_pe = false;
+	if (pe.off || gang.n)
+		return true;
+
+	if (pe.file && !download_pe(pe.file))
+		std::cerr << "Cannot write the programming executive " << pe.file
+				  << std::endl;
+
+	pe_enter();
+	use_pe = eicsp_sanity<io>(clk, data, pe_timing(), &pe_version);
+	pe_leave();
+
+	if (use_pe && flags.debug)
+		fprintf(stderr, "Programming executive v%d.%d: Enhanced ICSP\n",
+				pe_version >> 4, pe_version & 0x0F);
+	else if (!use_pe && (pe.file || flags.debug))
+		std::cerr << "No programming executive, using ICSP" << std::endl;
+
+	return true;
+}
+
+#endif /* EICSP_H_ */
@@ -0,0 +1,608 @@
+/*
+ * Raspberry Pi PIC Programmer using GPIO connector
+ * https://github.com/WallaceIT/picberry
+ * Copyright 2014 Francesco Valla
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+#include "common.h"
+
+#define GPIOCHIP_LINES		GPIO_V2_LINES_MAX
+
+int                 gpio_backend = GPIO_BACKEND_MEM;
+const char          *gpiochip_path = "/dev/gpiochip0";
+volatile uint32_t   *gpio;
+struct gang_struct  gang;
+bool                gpio_shared;
+std::atomic_flag    gpio_lock = ATOMIC_FLAG_INIT;
+
+static int          mem_fd = -1;
+static void         *gpio_map;
+
+/* gpiochip line request: requested pins, output lines and their levels */
+static int          line_fd = -1;
+static int          line_pin[GPIOCHIP_LINES];
+static int          line_count;
+static uint64_t     line_output;
+static uint64_t     line_level;
+
+#if defined(BOARD_AM335X) || defined(BOARD_ALL)
+uint32_t            am335x_oe[4];
+#endif
+#if defined(BOARD_A10) || defined(BOARD_ALL)
+struct a10_port_shadow a10_port[A10_PORTS];
+#endif
+#if defined(BOARD_RPI) || defined(BOARD_RPI2) || defined(BOARD_ALL)
+uint32_t            rpi_fsel[6];
+#endif
+
+#if defined(BOARD_ALL)
+#define DT_COMPATIBLE       "/proc/device-tree/compatible"
+
+/* supported hosts, by device tree compatible string; the last is a fallback */
+static const struct host_info hosts[] = {
+	{ "rpi",    "brcm,bcm2835",        HOST_BCM2835, 0x20200000, 256,
+	  0,    23, 24, 18, bcm2835_host::sync },
+	{ "rpi",    "brcm,bcm2708",        HOST_BCM2835, 0x20200000, 256,
+	  0,    23, 24, 18, bcm2835_host::sync },
+	{ "rpi2",   "brcm,bcm2836",        HOST_BCM2835, 0x3F200000, 256,
+	  0,    23, 24, 18, bcm2835_host::sync },
+	{ "rpi2",   "brcm,bcm2837",        HOST_BCM2835, 0x3F200000, 256,
+	  0,    23, 24, 18, bcm2835_host::sync },
+	{ "rpi2",   "brcm,bcm2709",        HOST_BCM2835, 0x3F200000, 256,
+	  0,    23, 24, 18, bcm2835_host::sync },
+	{ "rpi2",   "brcm,bcm2710",        HOST_BCM2835, 0x3F200000, 256,
+	  0,    23, 24, 18, bcm2835_host::sync },
+	{ "am335x", "ti,am33xx",           HOST_AM335X,  0x44E07000,
+	  0x481AE000 + 0x00000FFF - 0x44E07000,
+	  0,    60, 49, 48, am335x_host::sync },
+	{ "a10",    "allwinner,sun4i-a10", HOST_A10,     0x01c20000, 0x00002000,
+	  0x24, (PB<<8)|15, (PB<<8)|17, (PI<<8)|15, a10_host::sync },
+	{ "unknown", 0,                    HOST_BCM2835, 0,          256,
+	  0,    23, 24, 18, bcm2835_host::sync },
+};
+
+#define NUM_HOSTS           (int)(sizeof(hosts)/sizeof(hosts[0]))
+
+static const struct host_info *host;
+
+/* Match the device tree compatible strings against the known hosts */
+static const struct host_info *host_detect(void)
+{
+	char buf[512];
+	size_t len;
+	FILE *fp;
+
+	fp = fopen(DT_COMPATIBLE, "r");
+	if (fp == NULL)
+		return &hosts[NUM_HOSTS - 1];
+	len = fread(buf, 1, sizeof(buf) - 1, fp);
+	fclose(fp);
+	buf[len] = 0;
+
+	/* NUL separated list, most specific first */
+	for (size_t i = 0; i < len; i += strlen(&buf[i]) + 1)
+		for (int h = 0; h < NUM_HOSTS - 1; h++)
+			if (strcmp(&buf[i], hosts[h].compatible) == 0)
+				return &hosts[h];
+
+	return &hosts[NUM_HOSTS - 1];
+}
+
+/* The running host, detected on first use */
+const struct host_info *host_get(void)
+{
+	if (host == NULL)
+		host = host_detect();
+	return host;
+}
+
+/* Select the host by name, overriding detection */
+void host_select(const char *name)
+{
+	for (int h = 0; h < NUM_HOSTS - 1; h++)
+		if (strcmp(name, hosts[h].name) == 0) {
+			host = &hosts[h];
+			return;
+		}
+
+	fprintf(stderr, "Unknown host %s, available: rpi, rpi2, am335x, a10\n",
+			name);
+	exit(1);
+}
+#endif
+
+/* mock pins */
+int                 mock_gpio::pin[MOCK_PINS];
+uint8_t             mock_gpio::level[MOCK_PINS];
+int                 mock_gpio::used;
+unsigned long       mock_gpio::writes;
+
+/* instrumentation hooks */
+gpio_hook           gpio_hooks[GPIO_HOOKS];
+int                 gpio_nhooks;
+
+const char *gpio_op_name[NUM_OPS] = {
+	"other", "enter", "send_cmd", "send_nop", "read_data", "write_data",
+	"set_mode", "xfer_data", "xfer_fast_4p", "xfer_fast_2p", "row", "poll",
+	"poll_done"
+};
+
+/* Map a pin in [PORT:]NUM form to a gpiochip line offset */
+static unsigned int line_offset(int g)
+{
+#if defined(BOARD_ALL)
+	if (PORTOFFSET)
+		return ((g >> 8) / PORTOFFSET) * 32 + (g & 0xFF);
+	return g;
+#elif PORTOFFSET
+	/* lettered ports are 32 lines each */
+	return ((g >> 8) / PORTOFFSET) * 32 + (g & 0xFF);
+#else
+	return g;
+#endif
+}
+
+static uint64_t line_mask(int g)
+{
+	for (int i = 0; i < line_count; i++)
+		if (line_pin[i] == g)
+			return 1ULL << i;
+
+	fprintf(stderr, "GPIO %d was not requested from %s\n", g, gpiochip_path);
+	exit(1);
+}
+
+/* Apply direction and output levels of all lines in one ioctl */
+static void line_config(void)
+{
+	struct gpio_v2_line_config config;
+
+	memset(&config, 0, sizeof(config));
+	config.flags = GPIO_V2_LINE_FLAG_INPUT;
+	config.num_attrs = 2;
+	config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_FLAGS;
+	config.attrs[0].attr.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+	config.attrs[0].mask = line_output;
+	config.attrs[1].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+	config.attrs[1].attr.values = line_level;
+	config.attrs[1].mask = line_output;
+
+	if (ioctl(line_fd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &config) == -1) {
+		perror("gpiochip line configuration failed");
+		exit(1);
+	}
+}
+
+/* Update the levels of the lines in mask; only outputs reach the pins */
+static void line_values(uint64_t mask, uint64_t bits)
+{
+	struct gpio_v2_line_values values;
+	gpio_rmw l;
+
+	line_level = (line_level & ~mask) | (bits & mask);
+	values.mask = mask & line_output;
+	values.bits = line_level;
+	if (values.mask)
+		ioctl(line_fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values);
+}
+
+void gpiochip_gpio::in(int g)
+{
+	gpio_rmw l;
+
+	line_output &= ~line_mask(g);
+	line_config();
+}
+
+void gpiochip_gpio::out(int g)
+{
+	gpio_rmw l;
+
+	line_output |= line_mask(g);
+	line_config();
+}
+
+void gpiochip_gpio::set(int g)
+{
+	uint64_t mask = line_mask(g);
+
+	line_values(mask, mask);
+}
+
+void gpiochip_gpio::clr(int g)
+{
+	line_values(line_mask(g), 0);
+}
+
+void gpiochip_gpio::set2(int a, int b)
+{
+	uint64_t mask = line_mask(a) | line_mask(b);
+
+	line_values(mask, mask);
+}
+
+void gpiochip_gpio::clr2(int a, int b)
+{
+	line_values(line_mask(a) | line_mask(b), 0);
+}
+
+int gpiochip_gpio::lev(int g)
+{
+	struct gpio_v2_line_values values;
+
+	values.mask = line_mask(g);
+	values.bits = 0;
+	ioctl(line_fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values);
+	return (values.bits & values.mask) ? 1 : 0;
+}
+
+/* Whole-request access: the "bank" is the line request, a bit per line */
+uint32_t gpiochip_gpio::bit(int g)
+{
+	return line_mask(g);
+}
+
+void gpiochip_gpio::setm(int g, uint32_t m)
+{
+	line_values(m, m);
+}
+
+void gpiochip_gpio::clrm(int g, uint32_t m)
+{
+	line_values(m, 0);
+}
+
+uint32_t gpiochip_gpio::levm(int g)
+{
+	struct gpio_v2_line_values values;
+
+	values.mask = (1ULL << line_count) - 1;
+	values.bits = 0;
+	ioctl(line_fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values);
+	return values.bits;
+}
+
+static void mmap_open(const char *device, off_t base)
+{
+#if defined(BOARD_ALL)
+	if (host_get()->base == 0) {
+		fprintf(stderr, "Unknown host: select it with --host, "
+				"or use --backend=gpiochip\n");
+		exit(1);
+	}
+#endif
+
+	/* open /dev/mem or /dev/gpiomem */
+	mem_fd = open(device, O_RDWR|O_SYNC);
+	if (mem_fd == -1) {
+		fprintf(stderr, "Cannot open %s: %s\n", device, strerror(errno));
+		exit(1);
+	}
+
+	/* mmap GPIO */
+	gpio_map = mmap(0, BLOCK_SIZE, PROT_READ|PROT_WRITE,
+					MAP_SHARED, mem_fd, base);
+	if (gpio_map == MAP_FAILED) {
+		perror("mmap() failed");
+		exit(1);
+	}
+
+	/* Always use volatile pointer! */
+	gpio = (volatile uint32_t *) gpio_map;
+
+	/* load the host-side register shadows */
+	GPIO_SYNC();
+}
+
+static void gpiochip_open(const int *pins, int count)
+{
+	struct gpio_v2_line_request request;
+	int chip_fd;
+
+	chip_fd = open(gpiochip_path, O_RDWR);
+	if (chip_fd == -1) {
+		fprintf(stderr, "Cannot open %s: %s\n", gpiochip_path,
+				strerror(errno));
+		exit(1);
+	}
+
+	memset(&request, 0, sizeof(request));
+	for (int i = 0; i < count && line_count < GPIOCHIP_LINES; i++) {
+		bool dup = false;
+		for (int j = 0; j < line_count; j++)
+			dup |= (line_pin[j] == pins[i]);
+		if (dup)
+			continue;
+		line_pin[line_count] = pins[i];
+		request.offsets[line_count] = line_offset(pins[i]);
+		line_count++;
+	}
+	request.num_lines = line_count;
+	request.config.flags = GPIO_V2_LINE_FLAG_INPUT;
+	strncpy(request.consumer, "picberry", sizeof(request.consumer) - 1);
+
+	if (ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &request) == -1) {
+		perror("gpiochip line request failed");
+		exit(1);
+	}
+	line_fd = request.fd;
+	close(chip_fd);
+}
+
+/* Register an instrumentation hook, called on every pin access */
+void gpio_add_hook(gpio_hook hook)
+{
+	if (gpio_nhooks == GPIO_HOOKS) {
+		fprintf(stderr, "Too many GPIO hooks\n");
+		exit(1);
+	}
+	gpio_hooks[gpio_nhooks++] = hook;
+}
+
+/* Open the selected backend; pins lists the GPIOs that will be used */
+void gpio_open(const int *pins, int count)
+{
+	switch (gpio_backend) {
+		case GPIO_BACKEND_MEM:
+			mmap_open("/dev/mem", GPIO_BASE);
+			break;
+		case GPIO_BACKEND_GPIOMEM:
+			mmap_open("/dev/gpiomem", 0);
+			break;
+		case GPIO_BACKEND_GPIOCHIP:
+			gpiochip_open(pins, count);
+			break;
+		default:
+			break;
+	}
+}
+
+/* Release the selected backend */
+void gpio_close(void)
+{
+	int ret;
+
+	switch (gpio_backend) {
+		case GPIO_BACKEND_MEM:
+		case GPIO_BACKEND_GPIOMEM:
+			/* munmap GPIO */
+			ret = munmap(gpio_map, BLOCK_SIZE);
+			if (ret == -1) {
+				perror("munmap() failed");
+				exit(1);
+			}
+
+			/* close /dev/mem */
+			ret = close(mem_fd);
+			if (ret == -1) {
+				perror("Cannot close /dev/mem");
+				exit(1);
+			}
+			break;
+		case GPIO_BACKEND_GPIOCHIP:
+			close(line_fd);
+			line_count = 0;
+			break;
+		default:
+			break;
+	}
+}
+
+#define GPIO_DISPATCH(call) \
+	switch (gpio_backend) { \
+		case GPIO_BACKEND_GPIOCHIP:	return gpiochip_gpio::call; \
+		case GPIO_BACKEND_MOCK:		return mock_gpio::call; \
+		default: \
+			if (gpio_shared) \
+				MMAP_DISPATCH_SHARED(, ::call) \
+			MMAP_DISPATCH(, ::call) \
+	}
+
+void gpio_in(int g)  { GPIO_DISPATCH(in(g)) }
+void gpio_out(int g) { GPIO_DISPATCH(out(g)) }
+void gpio_set(int g) { GPIO_DISPATCH(set(g)) }
+void gpio_clr(int g) { GPIO_DISPATCH(clr(g)) }
+int gpio_lev(int g)  { GPIO_DISPATCH(lev(g)) }
+
+static int gpio_bank(int g) { GPIO_DISPATCH(bank(g)) }
+static uint32_t gpio_bit(int g) { GPIO_DISPATCH(bit(g)) }
+
+/*
+ * Bit-sliced gang. The 16-bit words of the targets form a 16x16 bit matrix
+ * (target, bit); transposing it gives, for each bit, the set of targets
+ * that get a 1. The transpose swaps blocks of 8, 4, 2 and 1 bits across
+ * whole words (Hacker's Delight 7-3), 32 word operations instead of 256
+ * bit moves, and is its own inverse. Target sets and PGD bits are then
+ * mapped into each other a byte at a time, through tables built by
+ * gang_setup().
+ */
+static uint32_t slice_out[2][256];	// targets 8i..8i+7 -> their PGD bits
+static uint16_t slice_in[4][256];	// byte i of the level register -> targets
+
+static void transpose16(uint16_t *a)
+{
+	uint16_t m = 0x00FF, t;
+	int j, k;
+
+	for (j = 8; j != 0; j >>= 1, m ^= m << j)
+		for (k = 0; k < 16; k = ((k | j) + 1) & ~j) {
+			t = ((a[k] >> j) ^ a[k | j]) & m;
+			a[k] ^= t << j;
+			a[k | j] ^= t;
+		}
+}
+
+/* One word per target to the PGD masks of its 16 bits, mask[bit] */
+void gang_pack(const uint16_t *word, uint32_t *mask)
+{
+	uint16_t a[16];
+	int i;
+
+	for (i = 0; i < 16; i++)
+		a[i] = i < gang.n ? word[i] : 0;
+	transpose16(a);
+	for (i = 0; i < 16; i++)
+		mask[i] = slice_out[0][a[i] & 0xFF] | slice_out[1][a[i] >> 8];
+}
+
+/* The level registers read for 16 bits, level[bit], to one word per target */
+void gang_unpack(const uint32_t *level, uint16_t *word)
+{
+	uint16_t a[16];
+	uint32_t l;
+	int i;
+
+	for (i = 0; i < 16; i++) {
+		l = level[i];
+		a[i] = slice_in[0][l & 0xFF] | slice_in[1][(l >> 8) & 0xFF] |
+			   slice_in[2][(l >> 16) & 0xFF] | slice_in[3][l >> 24];
+	}
+	transpose16(a);
+	for (i = 0; i < gang.n; i++)
+		word[i] = a[i];
+}
+
+/* Check the PGD lines of the gang and build their mask, after gpio_open() */
+void gang_setup(void)
+{
+	if (gang.n == 0)
+		return;
+
+	gang.mask = 0;
+	for (int i = 0; i < gang.n; i++) {
+		if (gpio_bank(gang.pin[i]) != gpio_bank(gang.pin[0])) {
+			fprintf(stderr, "Gang: GPIO %d is not on the port of PGD\n",
+					gang.pin[i] & 0xFF);
+			exit(1);
+		}
+		gang.bit[i] = gpio_bit(gang.pin[i]);
+		if (gang.mask & gang.bit[i]) {
+			fprintf(stderr, "Gang: GPIO %d given twice\n", gang.pin[i] & 0xFF);
+			exit(1);
+		}
+		gang.mask |= gang.bit[i];
+		gang.mismatch[i] = 0;
+		gang.verify[i] = 0;
+		gang.rows[i] = 0;
+		gang.fixed[i] = 0;
+		gang.dropped[i] = false;
+	}
+	gang.ref = 0;
+
+	memset(slice_out, 0, sizeof(slice_out));
+	memset(slice_in, 0, sizeof(slice_in));
+	for (int v = 0; v < 256; v++)
+		for (int i = 0; i < gang.n; i++) {
+			if (v & (1 << (i & 7)))
+				slice_out[i >> 3][v] |= gang.bit[i];
+			for (int b = 0; b < 4; b++)
+				if ((gang.bit[i] >> (8 * b)) & v)
+					slice_in[b][v] |= 1 << i;
+		}
+}
+
+/*
+ * Make the targets in the set (a bit per target index) the live ones, and
+ * the first of them the reference; returns their PGD mask
+ */
+uint32_t gang_live(uint32_t targets)
+{
+	gang.mask = 0;
+	gang.ref = -1;
+	for (int i = 0; i < gang.n; i++)
+		if (targets & (1 << i)) {
+			gang.mask |= gang.bit[i];
+			if (gang.ref < 0)
+				gang.ref = i;
+		}
+	if (gang.ref < 0)
+		gang.ref = 0;
+	return gang.mask;
+}
+
+/* Some targets read differently from the reference (gang_gpio::lev) */
+void gang_mismatch(uint32_t diff)
+{
+	for (int i = 0; i < gang.n; i++)
+		if (i != gang.ref && (diff & gang.bit[i]))
+			gang.mismatch[i]++;
+}
+
+/*
+ * End of a pass of a polling loop (gang_gpio::poll): go on while the
+ * reference is busy, then while some live target still reads differently,
+ * up to GANG_POLL_TIMEOUT.
+ */
+bool gang_poll(bool busy)
+{
+	uint32_t diff = gang.poll_diff;
+
+	gang.poll_diff = 0;
+	if (busy) {
+		gang.poll_end = 0;
+		return true;
+	}
+	if (diff) {
+		if (gang.poll_end == 0)
+			gang.poll_end = now_ns() + GANG_POLL_TIMEOUT;
+		if (now_ns() < gang.poll_end)
+			return true;
+		gang_mismatch(diff);
+	}
+	gang.polling = false;
+	gang.poll_end = 0;
+	return false;
+}
+
+/* Print the result table of the gang; false if any target failed */
+bool gang_report(void)
+{
+	bool ok = true, failed;
+
+	fprintf(stdout, "Gang:  target  GPIO  result  reads  words  rows  "
+			"fixed  first row\n");
+	for (int i = 0; i < gang.n; i++) {
+		failed = gang.dropped[i] || gang.mismatch[i] ||
+				 gang.rows[i] > gang.fixed[i];
+		if (failed)
+			ok = false;
+		fprintf(stdout, "Gang:  %6d  %4d  %-6s  %5lu  %5lu  %4lu  %5lu  ",
+				i, gang.pin[i] & 0xFF, failed ? "FAILED" : "OK",
+				gang.mismatch[i], gang.verify[i], gang.rows[i],
+				gang.fixed[i]);
+		if (gang.rows[i])
+			fprintf(stdout, "0x%06X", gang.first[i]);
+		else
+			fprintf(stdout, "-");
+		if (gang.image[i])
+			fprintf(stdout, "  %s", gang.image[i]);
+		fprintf(stdout, "\n");
+	}
+
+	return ok;
+}
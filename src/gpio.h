@@ -0,0 +1,534 @@
+/*
+ * Raspberry Pi PIC Programmer using GPIO connector
+ * https://github.com/WallaceIT/picberry
+ * Copyright 2014 Francesco Valla
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GPIO_H_
+#define GPIO_H_
+
+#include <stdint.h>
+#include <atomic>
+
+/*
+ * GPIO backends. Device classes are templates on the backend, so that
+ * every pin operation is resolved at compile time: with the register
+ * mapped backend they reduce to the raw stores of the host macros.
+ * The backend itself is chosen at runtime with --backend.
+ */
+#define GPIO_BACKEND_MEM		0	// /dev/mem mapping (default)
+#define GPIO_BACKEND_GPIOMEM	1	// /dev/gpiomem mapping (Raspberry Pi)
+#define GPIO_BACKEND_GPIOCHIP	2	// Linux gpiochip character device (v2)
+#define GPIO_BACKEND_MOCK		3	// in-memory pins, no hardware access
+
+#define MOCK_PINS			32
+
+extern int gpio_backend;
+extern const char *gpiochip_path;
+extern volatile uint32_t *gpio;
+
+/*
+ * Several programming heads (--head) drive pins of the same banks from
+ * their own threads. Pin direction changes, and on hosts with a shadowed
+ * data register (H::shadow) every data change, are read-modify-write
+ * updates of a shared word: while gpio_shared is set they take a spinlock,
+ * so that no head undoes the change of another one (on the mmap backend
+ * only mmap_gpio<H, true>, the heads' instance, asks for it). Plain stores
+ * to set and clear registers need no lock.
+ */
+extern bool gpio_shared;
+extern std::atomic_flag gpio_lock;
+
+struct gpio_rmw{
+	bool locked;
+	gpio_rmw(bool rmw = true) : locked(rmw && gpio_shared){
+		if (locked)
+			while (gpio_lock.test_and_set(std::memory_order_acquire))
+				;
+	}
+	~gpio_rmw(){
+		if (locked)
+			gpio_lock.clear(std::memory_order_release);
+	}
+};
+
+/*
+ * Register mapped access through the host macros (mem and gpiomem). The
+ * locking is chosen once per session: shared is set only for the device
+ * classes of --head runs, so the single-process path has no lock check
+ * on its edges.
+ */
+template<class H, bool shared = false>
+struct mmap_gpio{
+	static inline void in(int g){ gpio_rmw l(shared); H::in(g); }
+	static inline void out(int g){ gpio_rmw l(shared); H::out(g); }
+	static inline void set(int g){ gpio_rmw l(shared && H::shadow); H::set(g); }
+	static inline void clr(int g){ gpio_rmw l(shared && H::shadow); H::clr(g); }
+	static inline int lev(int g){ gpio_rmw l(shared && H::shadow); return H::lev(g); }
+	static inline void set2(int a, int b){ gpio_rmw l(shared && H::shadow); H::set2(a,b); }
+	static inline void clr2(int a, int b){ gpio_rmw l(shared && H::shadow); H::clr2(a,b); }
+	static inline int bank(int g){ return H::bank(g); }
+	static inline uint32_t bit(int g){ return H::bit(g); }
+	static inline void setm(int g, uint32_t m){ gpio_rmw l(shared && H::shadow); H::setm(g,m); }
+	static inline void clrm(int g, uint32_t m){ gpio_rmw l(shared && H::shadow); H::clrm(g,m); }
+	static inline uint32_t levm(int g){ gpio_rmw l(shared && H::shadow); return H::levm(g); }
+	static inline void mark(int op, uint32_t value = 0){
+		if (H::shadow) {	/* a burst starts: pick up foreign pin changes */
+			gpio_rmw l(shared);
+			H::resync();
+		}
+	}
+	static inline bool poll(bool busy){ return busy; }
+};
+
+/*
+ * Expand to "return prefix mmap_gpio<H> suffix;" for the host policy H of
+ * the running host: a switch in the all-hosts build, H = board_host
+ * otherwise. MMAP_DISPATCH_SHARED picks mmap_gpio<H, true> instead.
+ */
+#if defined(BOARD_ALL)
+#define MMAP_SWITCH(prefix, suffix, shared) \
+	switch (host_get()->type) { \
+		case HOST_AM335X:	return prefix mmap_gpio<am335x_host, shared> suffix; \
+		case HOST_A10:		return prefix mmap_gpio<a10_host, shared> suffix; \
+		default:			return prefix mmap_gpio<bcm2835_host, shared> suffix; \
+	}
+#else
+#define MMAP_SWITCH(prefix, suffix, shared) \
+	return prefix mmap_gpio<board_host, shared> suffix;
+#endif
+#define MMAP_DISPATCH(prefix, suffix)			MMAP_SWITCH(prefix, suffix, false)
+#define MMAP_DISPATCH_SHARED(prefix, suffix)	MMAP_SWITCH(prefix, suffix, true)
+
+/* Lines requested from a gpiochip, updated with one ioctl per call */
+struct gpiochip_gpio{
+	static void in(int g);
+	static void out(int g);
+	static void set(int g);
+	static void clr(int g);
+	static int lev(int g);
+	static void set2(int a, int b);
+	static void clr2(int a, int b);
+	static inline int bank(int g){ return 0; }
+	static uint32_t bit(int g);
+	static void setm(int g, uint32_t m);
+	static void clrm(int g, uint32_t m);
+	static uint32_t levm(int g);
+	static inline void mark(int op, uint32_t value = 0){}
+	static inline bool poll(bool busy){ return busy; }
+};
+
+/* Pins held in memory; reads return the last level written */
+struct mock_gpio{
+	static int		pin[MOCK_PINS];
+	static uint8_t	level[MOCK_PINS];
+	static int		used;
+	static unsigned long	writes;
+
+	static inline int slot(int g){
+		for (int i = 0; i < used; i++)
+			if (pin[i] == g)
+				return i;
+		if (used == MOCK_PINS)
+			return MOCK_PINS - 1;
+		pin[used] = g;
+		level[used] = 0;
+		return used++;
+	}
+	static inline void in(int g){ slot(g); }
+	static inline void out(int g){ slot(g); }
+	static inline void set(int g){ level[slot(g)] = 1; writes++; }
+	static inline void clr(int g){ level[slot(g)] = 0; writes++; }
+	static inline int lev(int g){ return level[slot(g)]; }
+	static inline void set2(int a, int b){
+		level[slot(a)] = 1; level[slot(b)] = 1; writes++;
+	}
+	static inline void clr2(int a, int b){
+		level[slot(a)] = 0; level[slot(b)] = 0; writes++;
+	}
+	static inline int bank(int g){ return 0; }
+	static inline uint32_t bit(int g){ return 1u << slot(g); }
+	static inline void setm(int g, uint32_t m){
+		for (int i = 0; i < used; i++)
+			if (m & (1u << i))
+				level[i] = 1;
+		writes++;
+	}
+	static inline void clrm(int g, uint32_t m){
+		for (int i = 0; i < used; i++)
+			if (m & (1u << i))
+				level[i] = 0;
+		writes++;
+	}
+	static inline uint32_t levm(int g){
+		uint32_t m = 0;
+		for (int i = 0; i < used; i++)
+			m |= (uint32_t)level[i] << i;
+		return m;
+	}
+	static inline void mark(int op, uint32_t value = 0){}
+	static inline bool poll(bool busy){ return busy; }
+};
+
+/*
+ * Instrumentation. Device classes annotate their ICSP operations with
+ * io::mark(), with the command, data word or address as value; the plain
+ * backends ignore it, while hook_gpio<B> forwards every pin access and mark
+ * to the registered hooks (statistics, trace, ...).
+ * Devices are instantiated on hook_gpio only when a hook is registered.
+ *
+ * Status polling loops (NVMCON WR, PE busy, PIC32 PrAcc and MCHP status)
+ * are written as
+ *
+ *	do {
+ *		io::mark(OP_POLL);
+ *		...
+ *	} while (io::poll(busy));
+ *
+ * so that their reads are known to be handshakes, not data: io::poll()
+ * returns busy on the plain backends, gang_gpio<B> also waits there for
+ * the targets that are still busy, and hook_gpio<B> marks the end of the
+ * loop with OP_POLL_DONE.
+ */
+enum gpio_op {
+	OP_OTHER,
+	OP_ENTER,			// program mode entry key sequence
+	OP_SEND_CMD,		// SIX / 4-bit command / TAP command
+	OP_SEND_NOP,
+	OP_READ_DATA,		// REGOUT / data read
+	OP_WRITE_DATA,
+	OP_SET_MODE,		// PIC32 TMS sequence
+	OP_XFER_DATA,		// PIC32 XferData
+	OP_XFER_FAST_4P,	// PIC32 XferFastData, 4-phase
+	OP_XFER_FAST_2P,	// PIC32 XferFastData, 2-phase
+	OP_ROW,				// a row/block at the given address is done
+	OP_POLL,			// a pass of a status polling loop starts
+	OP_POLL_DONE,		// the polling loop is over
+	NUM_OPS
+};
+
+extern const char *gpio_op_name[NUM_OPS];
+
+enum gpio_event { EV_IN, EV_OUT, EV_SET, EV_CLR, EV_LEV, EV_MARK };
+
+#define GPIO_HOOKS			4
+
+typedef void (*gpio_hook)(int event, int g, int value);
+extern gpio_hook gpio_hooks[GPIO_HOOKS];
+extern int gpio_nhooks;
+
+void gpio_add_hook(gpio_hook hook);
+
+static inline void gpio_notify(int event, int g, int value)
+{
+	for (int i = 0; i < gpio_nhooks; i++)
+		gpio_hooks[i](event, g, value);
+}
+
+template<class B>
+struct hook_gpio{
+	static inline void in(int g){ B::in(g); gpio_notify(EV_IN, g, 0); }
+	static inline void out(int g){ B::out(g); gpio_notify(EV_OUT, g, 0); }
+	static inline void set(int g){ B::set(g); gpio_notify(EV_SET, g, 1); }
+	static inline void clr(int g){ B::clr(g); gpio_notify(EV_CLR, g, 0); }
+	static inline int lev(int g){
+		int v = B::lev(g);
+		gpio_notify(EV_LEV, g, v);
+		return v;
+	}
+	static inline void set2(int a, int b){
+		B::set2(a, b);
+		gpio_notify(EV_SET, a, 1);
+		gpio_notify(EV_SET, b, 1);
+	}
+	static inline void clr2(int a, int b){
+		B::clr2(a, b);
+		gpio_notify(EV_CLR, a, 0);
+		gpio_notify(EV_CLR, b, 0);
+	}
+	static inline void mark(int op, uint32_t value = 0){
+		B::mark(op, value);
+		gpio_notify(EV_MARK, op, value);
+	}
+	static inline bool poll(bool busy){
+		if (B::poll(busy))
+			return true;
+		gpio_notify(EV_MARK, OP_POLL_DONE, 0);
+		return false;
+	}
+};
+
+/*
+ * Gang programming (--gang). N targets share PGC and MCLR and have a PGD
+ * line each, all on the bank (port) of pic_data. gang_gpio<B> turns every
+ * access to PGD into an access to all of them: a data bit goes out with
+ * one mask store, and is read back with one read of the level register.
+ * The device class sees the reference target (the first live one); the
+ * level read from every other target is compared with it, and a target
+ * that ever reads differently has failed (its readback did not match the
+ * image, or it did not answer).
+ *
+ * Device classes that support it write and verify bit-sliced, through
+ * gang_slice<io>: every PGD edge carries a mask with the bit of each
+ * target, still in one store, so every target can have its own image
+ * (-w a.hex,b.hex,...) and is verified on its own. They can then take a
+ * target out of the gang (gang_slice<io>::select()): its PGD is held low,
+ * so it only sees NOPs (SIX 0x000000) while the others go on, and its
+ * failed rows can be retried later on that target alone.
+ *
+ * Reads in a status polling loop are not compared: the targets need not
+ * finish a row write or an erase on the same pass. Once the reference is
+ * no longer busy, the loop goes on until every live target reads like it,
+ * for up to GANG_POLL_TIMEOUT; the ones that still differ then have failed.
+ */
+#define GANG_MAX			16
+#define GANG_POLL_TIMEOUT	1000000000ULL	// ns
+
+struct gang_struct {
+	int				n;				// targets, 0 when not ganging
+	int				pin[GANG_MAX];	// PGD of each target, pin[0] = pic_data
+	uint32_t		bit[GANG_MAX];	// their bits in the bank of pic_data
+	uint32_t		mask;			// the live ones (all of them by default)
+	int				ref;			// reference target, the first live one
+	unsigned long	mismatch[GANG_MAX];	// reads differing from the reference
+	char			*image[GANG_MAX];	// HEX file of each target, 0 if shared
+	unsigned long	verify[GANG_MAX];	// words differing from its image
+	unsigned long	rows[GANG_MAX];		// rows that failed verify
+	unsigned long	fixed[GANG_MAX];	// of them, fixed by a retry
+	uint32_t		first[GANG_MAX];	// address of the first failed row
+	bool			dropped[GANG_MAX];	// taken out of the gang for good
+	bool			polling;		// in a status polling loop
+	uint32_t		poll_diff;		// PGD bits read differently on this pass
+	uint64_t		poll_end;		// give up waiting for them, 0 if not yet
+};
+
+extern struct gang_struct gang;
+
+void gang_mismatch(uint32_t diff);
+bool gang_poll(bool busy);
+uint32_t gang_live(uint32_t targets);
+void gang_pack(const uint16_t *word, uint32_t *mask);
+void gang_unpack(const uint32_t *level, uint16_t *word);
+
+template<class B>
+struct gang_gpio{
+	static inline void in(int g){
+		if (g != gang.pin[0])
+			B::in(g);
+		else
+			for (int i = 0; i < gang.n; i++)
+				if (gang.mask & gang.bit[i])
+					B::in(gang.pin[i]);
+	}
+	static inline void out(int g){
+		if (g != gang.pin[0])
+			B::out(g);
+		else
+			for (int i = 0; i < gang.n; i++)
+				if (gang.mask & gang.bit[i])
+					B::out(gang.pin[i]);
+	}
+	static inline void set(int g){
+		if (g == gang.pin[0])
+			B::setm(g, gang.mask);
+		else
+			B::set(g);
+	}
+	static inline void clr(int g){
+		if (g == gang.pin[0])
+			B::clrm(g, gang.mask);
+		else
+			B::clr(g);
+	}
+	static inline int lev(int g){
+		if (g != gang.pin[0])
+			return B::lev(g);
+
+		uint32_t w = B::levm(g) & gang.mask;
+		int v = (w & gang.bit[gang.ref]) ? 1 : 0;
+		if (w == (v ? gang.mask : 0))
+			return v;
+		if (gang.polling)
+			gang.poll_diff |= v ? w ^ gang.mask : w;
+		else
+			gang_mismatch(v ? w ^ gang.mask : w);
+		return v;
+	}
+	/*
+	 * PGD and another pin: one store if on the same bank. The bit of PGD
+	 * itself is not in it: gang.mask has the live targets, and the first
+	 * one may have been taken out of the gang.
+	 */
+	static inline void set2(int a, int b){
+		if (a != gang.pin[0] && b != gang.pin[0])
+			B::set2(a, b);
+		else if (B::bank(a) == B::bank(b))
+			B::setm(gang.pin[0], gang.mask | B::bit(a == gang.pin[0] ? b : a));
+		else {
+			set(a);
+			set(b);
+		}
+	}
+	static inline void clr2(int a, int b){
+		if (a != gang.pin[0] && b != gang.pin[0])
+			B::clr2(a, b);
+		else if (B::bank(a) == B::bank(b))
+			B::clrm(gang.pin[0], gang.mask | B::bit(a == gang.pin[0] ? b : a));
+		else {
+			clr(a);
+			clr(b);
+		}
+	}
+	static inline void mark(int op, uint32_t value = 0){
+		if (op == OP_POLL)
+			gang.polling = true;
+		B::mark(op, value);
+	}
+	static inline bool poll(bool busy){ return gang_poll(busy); }
+};
+
+/*
+ * Bit-sliced access to a gang: rise() drives low the PGD of the targets
+ * not in m, then raises PGC together with the PGD of those in m (see
+ * pgc_rise()); levm() reads the level register with every PGD bit.
+ * Masks come from gang_pack(), levels go through gang_unpack(). Only the
+ * gang backends have it (sliced is true).
+ */
+template<class io>
+struct gang_slice{
+	static const bool sliced = false;
+	static inline void rise(int pgc, uint32_t m){}
+	static inline uint32_t levm(int g){ return 0; }
+	static inline void select(uint32_t targets){}
+};
+
+template<class B>
+struct gang_slice<gang_gpio<B> >{
+	static const bool sliced = true;
+	static inline void rise(int pgc, uint32_t m){
+		m &= gang.mask;
+		if (gang.mask & ~m)
+			B::clrm(gang.pin[0], gang.mask & ~m);
+		if (B::bank(pgc) == B::bank(gang.pin[0]))
+			B::setm(pgc, B::bit(pgc) | m);
+		else {
+			if (m)
+				B::setm(gang.pin[0], m);
+			B::set(pgc);
+		}
+	}
+	static inline uint32_t levm(int g){ return B::levm(g); }
+	/* Only the targets in the set (a bit per target) get the next clocks */
+	static inline void select(uint32_t targets){
+		uint32_t live = gang.mask;
+		uint32_t off = live & ~gang_live(targets);
+		if (off)
+			B::clrm(gang.pin[0], off);
+	}
+};
+
+template<class B>
+struct gang_slice<hook_gpio<gang_gpio<B> > >{
+	static const bool sliced = true;
+	static inline void rise(int pgc, uint32_t m){
+		int v = (m & gang.mask & gang.bit[0]) ? 1 : 0;
+		gang_slice<gang_gpio<B> >::rise(pgc, m);
+		gpio_notify(v ? EV_SET : EV_CLR, gang.pin[0], v);
+		gpio_notify(EV_SET, pgc, 1);
+	}
+	static inline uint32_t levm(int g){
+		uint32_t w = B::levm(g);
+		gpio_notify(EV_LEV, g, (w & gang.bit[0]) ? 1 : 0);
+		return w;
+	}
+	static inline void select(uint32_t targets){
+		gang_slice<gang_gpio<B> >::select(targets);
+	}
+};
+
+/*
+ * Combined PGC/PGD edges. pgd tracks the level of the PGD line, so that it
+ * is only written when it changes. The targets latch PGD on the falling
+ * edge of PGC, so the data bit goes out with the rising edge (the clock
+ * high time is its setup time) and never with the falling one, which
+ * would leave it no hold time.
+ */
+
+/* Drive PGD to bit */
+template<class io>
+static inline void pgd_write(int pgd_pin, int bit, int &pgd)
+{
+	if (bit && !pgd)
+		io::set(pgd_pin);
+	else if (!bit && pgd)
+		io::clr(pgd_pin);
+	pgd = bit ? 1 : 0;
+}
+
+/* Raise PGC with PGD at bit */
+template<class io>
+static inline void pgc_rise(int pgc, int pgd_pin, int bit, int &pgd)
+{
+	if (bit && !pgd) {
+		io::set2(pgd_pin, pgc);
+		pgd = 1;
+	}
+	else {
+		pgd_write<io>(pgd_pin, bit, pgd);
+		io::set(pgc);
+	}
+}
+
+/* Instantiate a device class template for every backend (and host) */
+#define INSTANTIATE_BACKEND(cls, io) \
+	template class cls<io>; \
+	template class cls<hook_gpio<io> >; \
+	template class cls<gang_gpio<io> >; \
+	template class cls<hook_gpio<gang_gpio<io> > >;
+
+/* heads (--head) run plain devices only, with locked pin updates */
+#define INSTANTIATE_HOST(cls, H) \
+	INSTANTIATE_BACKEND(cls, mmap_gpio<H>) \
+	template class cls<mmap_gpio<H, true> >;
+
+#if defined(BOARD_ALL)
+#define INSTANTIATE_MMAP(cls) \
+	INSTANTIATE_HOST(cls, bcm2835_host) \
+	INSTANTIATE_HOST(cls, am335x_host) \
+	INSTANTIATE_HOST(cls, a10_host)
+#else
+#define INSTANTIATE_MMAP(cls) \
+	INSTANTIATE_HOST(cls, board_host)
+#endif
+
+#define INSTANTIATE_DEVICE(cls) \
+	INSTANTIATE_MMAP(cls) \
+	INSTANTIATE_BACKEND(cls, gpiochip_gpio) \
+	INSTANTIATE_BACKEND(cls, mock_gpio)
+
+/* Backend setup and runtime-dispatched pin access, for non-critical paths */
+void gpio_open(const int *pins, int count);
+void gpio_close(void);
+void gpio_in(int g);
+void gpio_out(int g);
+void gpio_set(int g);
+void gpio_clr(int g);
+int gpio_lev(int g);
+void gang_setup(void);
+bool gang_report(void);
+
+#endif /* GPIO_H_ */
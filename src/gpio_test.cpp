@@ -38,31 +38,149 @@
 
 #include "common.h"
 
-int                 mem_fd;
-void                *gpio_map;
-volatile uint32_t   *gpio;
-
 void setup_io(void);
 void close_io(void);
 
 struct flags_struct flags;
 
-int tested_gpio = DEFAULT_PIC_CLK;
+int tested_gpio;
 char tested_gpio_port = 0;
+int pair_gpio;
+char pair_gpio_port = 0;
+
+/*
+ * Benchmark: every sample times BENCH_BATCH operations between two clock
+ * reads (BENCH_BATCH = 1 for latencies), minus the cost of the clock read
+ * itself. Results are in ns per operation, over BENCH_SAMPLES samples.
+ */
+#define BENCH_SAMPLES       20000
+#define BENCH_BATCH         64
+
+static uint64_t samples[BENCH_SAMPLES];
+static uint64_t clock_cost;
+
+static int cmp_sample(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* Sort the samples, print the percentiles and return the median */
+static uint64_t bench_report(const char *name, int batch)
+{
+    uint64_t p50, p90, p99, p999, max;
+
+    qsort(samples, BENCH_SAMPLES, sizeof(samples[0]), cmp_sample);
+    p50 = samples[BENCH_SAMPLES / 2] / batch;
+    p90 = samples[BENCH_SAMPLES * 90 / 100] / batch;
+    p99 = samples[BENCH_SAMPLES * 99 / 100] / batch;
+    p999 = samples[BENCH_SAMPLES * 999 / 1000] / batch;
+    max = samples[BENCH_SAMPLES - 1] / batch;
+
+    printf("%-22s %8llu %8llu %8llu %8llu %10llu %8llu\n", name,
+           (unsigned long long)p50, (unsigned long long)p90,
+           (unsigned long long)p99, (unsigned long long)p999,
+           (unsigned long long)max, (unsigned long long)(p99 - p50));
+
+    return p50;
+}
+
+/* Time BENCH_SAMPLES runs of batch iterations of op */
+#define BENCH(op, batch) \
+    for (int s = 0; s < BENCH_SAMPLES; s++) { \
+        uint64_t t = now_ns(), e; \
+        for (int k = 0; k < (batch); k++) { op; } \
+        e = now_ns() - t; \
+        samples[s] = e > clock_cost ? e - clock_cost : 0; \
+    }
+
+template<class io>
+static void bench(int a, int b)
+{
+    volatile int level;
+    uint64_t edge;
+
+    /* cost of a clock read, subtracted from every sample */
+    clock_cost = 0;
+    BENCH(, 0)
+    qsort(samples, BENCH_SAMPLES, sizeof(samples[0]), cmp_sample);
+    clock_cost = samples[BENCH_SAMPLES / 2];
+
+    io::in(a); io::out(a);
+    io::in(b); io::out(b);
+
+    printf("clock read: %llu ns, %d samples\n\n",
+           (unsigned long long)clock_cost, BENCH_SAMPLES);
+    printf("%-22s %8s %8s %8s %8s %10s %8s\n", "ns/op", "p50", "p90",
+           "p99", "p99.9", "max", "jitter");
+
+    BENCH(io::set(a); io::clr(a), BENCH_BATCH)
+    edge = bench_report("toggle (set+clr)", BENCH_BATCH);
+    BENCH(io::set(a); io::clr(a), 1)
+    bench_report("set+clr latency", 1);
+    BENCH(level = io::lev(a), BENCH_BATCH)
+    bench_report("GPIO_LEV read", BENCH_BATCH);
+    BENCH(level = io::lev(a), 1)
+    bench_report("GPIO_LEV latency", 1);
+    BENCH(io::in(a); io::out(a), BENCH_BATCH)
+    bench_report("direction in+out", BENCH_BATCH);
+    BENCH(io::set2(a, b); io::clr2(a, b), BENCH_BATCH)
+    bench_report("two-pin set2+clr2", BENCH_BATCH);
+    BENCH(io::set(a); io::set(b); io::clr(a); io::clr(b), BENCH_BATCH)
+    bench_report("two-pin separate", BENCH_BATCH);
+    (void)level;
+
+    if (edge)
+        printf("\nmaximum toggle rate: %llu kHz\n",
+               (unsigned long long)(1000000 / edge));
+
+    io::in(a);
+    io::in(b);
+}
+
+/* Benchmark the register mapped backend of the running host */
+static void bench_mmap(int a, int b)
+{
+    MMAP_DISPATCH(bench<, >(a, b))
+}
+
+/* Parse a pin in [PORT:]NUM form */
+static void parse_pin(char *str, int *g, char *port)
+{
+    if(!strchr(&str[0],':'))   // port not specified
+        sscanf(&str[0], "%d", g);
+    else{                       // port specified
+        if(!sscanf(&str[0], "%[A-Z]:%d", port, g)){
+                    cout << "GPIO selection string not correctly formatted!" << endl;
+                    exit(0);
+                }
+        *g |= ((*port-'A')*PORTOFFSET)<<8;
+    }
+}
 
 int main(int argc, char *argv[])
 {
     char *pins = 0;
+    char *pair = 0;
+    bool benchmark = false;
     int opt = 0, option_index = 0;
 
     static struct option long_options[] = {
             {"debug", 0, 0, 'D'},
-            {"gpio", 1, 0, 'g'}
+            {"gpio", 1, 0, 'g'},
+            {"pair", 1, 0, 'p'},
+            {"bench", 0, 0, 'b'},
+            {"backend", 1, 0, 'B'},
+#if defined(BOARD_ALL)
+            {"host", 1, 0, 'H'},
+#endif
+            {0, 0, 0, 0}
     };
     
     setvbuf(stdout, NULL, _IONBF, 1024);
 
-    while ((opt = getopt_long(argc, argv, "Dg:",long_options, &option_index)) != -1) {
+    while ((opt = getopt_long(argc, argv, "Dg:p:bB:H:",long_options, &option_index)) != -1) {
         switch (opt) {
         case 'D':
             flags.debug = 1;
@@ -70,6 +188,34 @@ int main(int argc, char *argv[])
         case 'g':
             pins = optarg;
             break;
+        case 'p':
+            pair = optarg;
+            break;
+        case 'b':
+            benchmark = true;
+            break;
+        case 'B':
+            if(strcmp(optarg, "mem") == 0)
+                gpio_backend = GPIO_BACKEND_MEM;
+            else if(strcmp(optarg, "gpiomem") == 0)
+                gpio_backend = GPIO_BACKEND_GPIOMEM;
+            else if(strncmp(optarg, "gpiochip", 8) == 0){
+                gpio_backend = GPIO_BACKEND_GPIOCHIP;
+                if(optarg[8] == ':')
+                    gpiochip_path = &optarg[9];
+            }
+            else if(strcmp(optarg, "mock") == 0)
+                gpio_backend = GPIO_BACKEND_MOCK;
+            else{
+                cout << "Unknown GPIO backend " << optarg << endl;
+                exit(1);
+            }
+            break;
+#if defined(BOARD_ALL)
+        case 'H':
+            host_select(optarg);
+            break;
+#endif
         default:
             cout << endl;
             exit(1);
@@ -77,47 +223,62 @@ int main(int argc, char *argv[])
     }
     
     /* Configure GPIOs */
-    if(pins != 0){       // if GPIO connections are specified in the options...
-        if(!strchr(&pins[0],':'))   // port not specified
-            sscanf(&pins[0], "%d", &tested_gpio);
-        else{                       // port specified
-            if(!sscanf(&pins[0], "%[A-Z]:%d", &tested_gpio_port, &tested_gpio)){
-                        cout << "GPIO selection string not correctly formatted!" << endl;
-                        exit(0);
-                    }
-            tested_gpio |= ((tested_gpio_port-'A')*PORTOFFSET)<<8;
-        }
-    }
+    tested_gpio = DEFAULT_PIC_CLK;
+    pair_gpio = DEFAULT_PIC_DATA;
+    if(pins != 0)       // if GPIO connections are specified in the options...
+        parse_pin(pins, &tested_gpio, &tested_gpio_port);
+    if(pair != 0)
+        parse_pin(pair, &pair_gpio, &pair_gpio_port);
     
     cout << "Testing GPIO " << tested_gpio_port << (tested_gpio&0xFF) << endl;
-    cout << "BASE ADDRESS " << hex << GPIO_BASE << " + OFFSET " << hex << OFFSET(tested_gpio) << " = FINAL ADDRESS " << hex << GPIO_BASE + OFFSET(tested_gpio) << endl;
+#if defined(BOARD_AM335X)
+    cout << "BASE ADDRESS " << hex << GPIO_BASE << " + OFFSET " << hex << OFFSET(tested_gpio) << " = FINAL ADDRESS " << hex << GPIO_BASE + OFFSET(tested_gpio) << dec << endl;
+#endif
 
     setup_io();
+
+    if(benchmark){
+        cout << "Benchmarking GPIO " << tested_gpio_port << (tested_gpio&0xFF)
+             << " and " << pair_gpio_port << (pair_gpio&0xFF)
+             << ": both pins are driven, disconnect the target!" << endl;
+        switch(gpio_backend){
+            case GPIO_BACKEND_GPIOCHIP:
+                bench<gpiochip_gpio>(tested_gpio, pair_gpio);
+                break;
+            case GPIO_BACKEND_MOCK:
+                bench<mock_gpio>(tested_gpio, pair_gpio);
+                break;
+            default:
+                bench_mmap(tested_gpio, pair_gpio);
+                break;
+        }
+        close_io();
+        return 0;
+    }
     
+    gpio_in(tested_gpio);   // NOTE: MUST use gpio_in before gpio_out
+    cout << "Read Test: level = " << gpio_lev(tested_gpio) << endl;
     
-    GPIO_IN(tested_gpio);   // NOTE: MUST use GPIO_IN before GPIO_OUT
-    cout << "Read Test: level = " << (int)(GPIO_LEV(tested_gpio)) << endl;
-    
-    GPIO_OUT(tested_gpio);
+    gpio_out(tested_gpio);
     cout << "Blink Test";
     
     for(int k=0;k<10;k++){
         cout << ".";
-        GPIO_SET(tested_gpio);
+        gpio_set(tested_gpio);
         usleep(500000L);
-        GPIO_CLR(tested_gpio);
+        gpio_clr(tested_gpio);
         usleep(500000L);
     }
     
     cout << "OK" << endl;
     
-    GPIO_IN(tested_gpio);
+    gpio_in(tested_gpio);
     cout << "Read Test: ";
     for(int k=0;k<10;k++){
-        cout << (int)(GPIO_LEV(tested_gpio)) << " ";
-        GPIO_SET(tested_gpio);
+        cout << gpio_lev(tested_gpio) << " ";
+        gpio_set(tested_gpio);
         usleep(500000L);
-        GPIO_CLR(tested_gpio);
+        gpio_clr(tested_gpio);
         usleep(500000L);
     }
     
@@ -129,41 +290,13 @@ int main(int argc, char *argv[])
 /* Set up a memory regions to access GPIO */
 void setup_io(void)
 {
-        /* open /dev/mem */
-        mem_fd = open("/dev/mem", O_RDWR|O_SYNC);
-        if (mem_fd == -1) {
-                perror("Cannot open /dev/mem");
-                exit(1);
-        }
-
-        /* mmap GPIO */
-        gpio_map = mmap(0, BLOCK_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, mem_fd, GPIO_BASE);
-        if (gpio_map == MAP_FAILED) {
-                perror("mmap() failed");
-                exit(1);
-        }
-
-        /* Always use volatile pointer! */
-        gpio = (volatile uint32_t *) gpio_map;
+        int pins[2] = { tested_gpio, pair_gpio };
 
+        gpio_open(pins, 2);
 }
 
 /* Release GPIO memory region */
 void close_io(void)
 {
-        int ret;
-
-        /* munmap GPIO */
-        ret = munmap(gpio_map, BLOCK_SIZE);
-        if (ret == -1) {
-            perror("munmap() failed");
-            exit(1);
-        }
-
-        /* close /dev/mem */
-        ret = close(mem_fd);
-        if (ret == -1) {
-            perror("Cannot close /dev/mem");
-            exit(1);
-        }
+        gpio_close();
 }
@@ -39,13 +39,142 @@
 #define SET         0x10
 #define PULL        0x1C
 
+#define A10_PORTS   9       /* PA..PI */
+
+/*
+ * Shadowed ports: the configuration and data words of every port are kept
+ * on the host, and pin changes write the whole word without reading the
+ * register back. The other pins of a port may belong to other processes,
+ * so the data word of the ports we drive is merged back from the register
+ * at the start of every burst (a10_resync(), from io::mark()), and a pin
+ * direction change reads its configuration word before rewriting it.
+ * GPIO_LEV reads the data register anyway, so it also checks the output
+ * pins against the shadow and reloads it on a mismatch.
+ */
+struct a10_port_shadow {
+	uint32_t cfg[4];        /* CFG0..CFG3, 3-bit function per pin */
+	uint32_t dat;           /* DAT */
+	uint32_t out;           /* pins configured as outputs */
+	uint32_t own;           /* pins set up by GPIO_IN/GPIO_OUT */
+};
+
+extern volatile uint32_t *gpio;
+extern struct a10_port_shadow a10_port[A10_PORTS];
+
+#define A10_REG(p,r)  (*(volatile uint32_t*)((char*)gpio+OFFSET+(p)*PORTOFFSET+(r)))
+#define A10_PORT(g)   ((int)(g>>8)/PORTOFFSET)
+#define A10_PIN(g)    ((int)(g&0xFF))
+
+/* reload the shadow of port p from the registers */
+static inline void a10_sync(int p)
+{
+	a10_port_shadow *s = &a10_port[p];
+
+	s->out = 0;
+	for (int i = 0; i < 4; i++) {
+		s->cfg[i] = A10_REG(p, i*4);
+		for (int n = 0; n < 8; n++)
+			if (((s->cfg[i] >> (n*4)) & 0x07) == 0x01)
+				s->out |= 1 << (i*8+n);
+	}
+	s->dat = A10_REG(p, SET);
+}
+
+/* set the function of pin g: 0 input, 1 output */
+static inline void a10_cfg(int g, uint32_t fn)
+{
+	int p = A10_PORT(g), n = A10_PIN(g);
+	a10_port_shadow *s = &a10_port[p];
+	uint32_t cfg = A10_REG(p, (n/8)*4);	/* keep the other pins' functions */
+
+	s->cfg[n/8] = (cfg & ~(0x07<<((n%8)*4))) | (fn<<((n%8)*4));
+	A10_REG(p, (n/8)*4) = s->cfg[n/8];
+	if (fn == 0x01)
+		s->out |= 1 << n;
+	else
+		s->out &= ~(1 << n);
+	s->own |= 1 << n;
+}
+
+/* take the pins we do not own from the data registers of our ports */
+static inline void a10_resync(void)
+{
+	for (int p = 0; p < A10_PORTS; p++) {
+		a10_port_shadow *s = &a10_port[p];
+
+		if (s->own)
+			s->dat = (A10_REG(p, SET) & ~s->own) | (s->dat & s->own);
+	}
+}
+
+/* update the pins in mask of the port of g */
+static inline void a10_dat(int g, uint32_t mask, uint32_t bits)
+{
+	int p = A10_PORT(g);
+
+	a10_port[p].dat = (a10_port[p].dat & ~mask) | bits;
+	A10_REG(p, SET) = a10_port[p].dat;
+}
+
+/* read the data register of the port of g */
+static inline uint32_t a10_levm(int g)
+{
+	int p = A10_PORT(g);
+	uint32_t dat = A10_REG(p, SET);
+
+	if ((dat ^ a10_port[p].dat) & a10_port[p].out)
+		a10_sync(p);
+	return dat;
+}
+
+static inline int a10_lev(int g)
+{
+	return (a10_levm(g) >> A10_PIN(g)) & 0x1;
+}
+
+#define GPIO_SYNC()   for (int p = 0; p < A10_PORTS; p++) a10_sync(p)
+
 /* GPIO setup macros. Always use GPIO_IN(x) before using GPIO_OUT(x) */
-#define GPIO_IN(g)    *(int*)((char*)gpio+OFFSET+(g>>8)+(((int)(g&0xFF)/8)*4)) &= ~(0x07<<(((int)(g&0xFF)%8)*4))
-#define GPIO_OUT(g)   *(int*)((char*)gpio+OFFSET+(g>>8)+(((int)(g&0xFF)/8)*4)) |= (0x01<<(((int)(g&0xFF)%8)*4))
+#define GPIO_IN(g)    a10_cfg(g, 0x00)
+#define GPIO_OUT(g)   a10_cfg(g, 0x01)
+
+#define GPIO_SET(g)   a10_dat(g, 1<<A10_PIN(g), 1<<A10_PIN(g))
+#define GPIO_CLR(g)   a10_dat(g, 1<<A10_PIN(g), 0)
+#define GPIO_LEV(g)   a10_lev(g)
+
+/* set/clear two pins, with a single store when on the same port */
+#define GPIO_SET2(a,b)  do { if (A10_PORT(a) == A10_PORT(b)) \
+                            a10_dat(a, (1<<A10_PIN(a)) | (1<<A10_PIN(b)), (1<<A10_PIN(a)) | (1<<A10_PIN(b))); \
+                        else { GPIO_SET(a); GPIO_SET(b); } } while (0)
+#define GPIO_CLR2(a,b)  do { if (A10_PORT(a) == A10_PORT(b)) \
+                            a10_dat(a, (1<<A10_PIN(a)) | (1<<A10_PIN(b)), 0); \
+                        else { GPIO_CLR(a); GPIO_CLR(b); } } while (0)
+
+/* whole-port access: any pins of the port of g with one store or read */
+#define GPIO_BANK(g)    A10_PORT(g)
+#define GPIO_BIT(g)     (1<<A10_PIN(g))
+#define GPIO_SETM(g,m)  a10_dat(g, m, m)
+#define GPIO_CLRM(g,m)  a10_dat(g, m, 0)
+#define GPIO_LEVM(g)    a10_levm(g)
 
-#define GPIO_SET(g)   *(int*)((char*)gpio+OFFSET+(g>>8)+SET) |= 1<<(int)(g&0xFF)
-#define GPIO_CLR(g)   *(int*)((char*)gpio+OFFSET+(g>>8)+SET) &= ~(1<<(int)(g&0xFF))
-#define GPIO_LEV(g)   (*(int*)((char*)gpio+OFFSET+(g>>8)+SET) >> (int)(g&0xFF)) & 0x1
+/* host policy: the macros above, for the device class templates */
+struct a10_host{
+	static const bool shadow = true;	// data register updated from a shadow
+	static inline void sync(void){ GPIO_SYNC(); }
+	static inline void resync(void){ a10_resync(); }
+	static inline void in(int g){ GPIO_IN(g); }
+	static inline void out(int g){ GPIO_OUT(g); }
+	static inline void set(int g){ GPIO_SET(g); }
+	static inline void clr(int g){ GPIO_CLR(g); }
+	static inline int lev(int g){ return GPIO_LEV(g); }
+	static inline void set2(int a, int b){ GPIO_SET2(a,b); }
+	static inline void clr2(int a, int b){ GPIO_CLR2(a,b); }
+	static inline int bank(int g){ return GPIO_BANK(g); }
+	static inline uint32_t bit(int g){ return GPIO_BIT(g); }
+	static inline void setm(int g, uint32_t m){ GPIO_SETM(g,m); }
+	static inline void clrm(int g, uint32_t m){ GPIO_CLRM(g,m); }
+	static inline uint32_t levm(int g){ return GPIO_LEVM(g); }
+};
 
 /* default GPIO <-> PIC connections */
 #define DEFAULT_PIC_CLK    (int)((PB<<8)|15)   /* PGC - Output - PB15 */
@@ -0,0 +1,139 @@
+/*
+ * Raspberry Pi PIC Programmer using GPIO connector
+ * https://github.com/WallaceIT/picberry
+ * Copyright 2014 Francesco Valla
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * All hosts in one binary (make universal). The host headers are included
+ * one after the other and only their policy structs are kept: the device
+ * classes are instantiated on each of them, and the one of the running
+ * host is selected once, when the device class is created. Addresses and
+ * default pins come from the host_info of the running host, detected from
+ * /proc/device-tree/compatible or selected with --host.
+ */
+
+#include <sys/types.h>
+
+#include "rpi.h"
+#undef BCM2708_PERI_BASE
+#undef GPIO_BASE
+#undef BLOCK_SIZE
+#undef PORTOFFSET
+#undef FSEL_REG
+#undef FSEL_IN
+#undef FSEL_OUT
+#undef GPIO_SYNC
+#undef GPIO_IN
+#undef GPIO_OUT
+#undef GPIO_SET
+#undef GPIO_CLR
+#undef GPIO_LEV
+#undef GPIO_SET2
+#undef GPIO_CLR2
+#undef GPIO_BANK
+#undef GPIO_BIT
+#undef GPIO_SETM
+#undef GPIO_CLRM
+#undef GPIO_LEVM
+#undef DEFAULT_PIC_CLK
+#undef DEFAULT_PIC_DATA
+#undef DEFAULT_PIC_MCLR
+
+#include "am335x.h"
+#undef GPIO0_BASE
+#undef GPIO1_BASE
+#undef GPIO2_BASE
+#undef GPIO3_BASE
+#undef GPIO_BASE
+#undef PORTOFFSET
+#undef BANK_SIZE
+#undef BLOCK_SIZE
+#undef GPIO_OE_REG
+#undef GPIO_IN_REG
+#undef GPIO_OUT_REG
+#undef GPIO_CLEARDATAOUT_REG
+#undef GPIO_SETDATAOUT_REG
+#undef OFFSET
+#undef GPIO_SYNC
+#undef GPIO_IN
+#undef GPIO_OUT
+#undef GPIO_SET
+#undef GPIO_CLR
+#undef GPIO_LEV
+#undef GPIO_SET2
+#undef GPIO_CLR2
+#undef GPIO_BANK
+#undef GPIO_BIT
+#undef GPIO_SETM
+#undef GPIO_CLRM
+#undef GPIO_LEVM
+#undef DEFAULT_PIC_CLK
+#undef DEFAULT_PIC_DATA
+#undef DEFAULT_PIC_MCLR
+
+#include "a10.h"
+#undef SW_PORTC_IO_BASE
+#undef GPIO_BASE
+#undef OFFSET
+#undef BLOCK_SIZE
+#undef PORTOFFSET
+#undef SET
+#undef PULL
+#undef GPIO_SYNC
+#undef GPIO_IN
+#undef GPIO_OUT
+#undef GPIO_SET
+#undef GPIO_CLR
+#undef GPIO_LEV
+#undef GPIO_SET2
+#undef GPIO_CLR2
+#undef GPIO_BANK
+#undef GPIO_BIT
+#undef GPIO_SETM
+#undef GPIO_CLRM
+#undef GPIO_LEVM
+#undef DEFAULT_PIC_CLK
+#undef DEFAULT_PIC_DATA
+#undef DEFAULT_PIC_MCLR
+
+#define HOST_BCM2835	0	// Raspberry Pi, any model up to 3
+#define HOST_AM335X		1
+#define HOST_A10		2
+
+struct host_info {
+	const char	*name;			// --host name
+	const char	*compatible;	// device tree compatible string
+	int			type;			// HOST_x: policy of the device classes
+	off_t		base;			// GPIO registers physical address
+	size_t		block_size;		// GPIO registers mapping size
+	int			portoffset;
+	int			pic_clk, pic_data, pic_mclr;	// default connections
+	void		(*sync)(void);	// load the register shadows
+};
+
+const struct host_info *host_get(void);
+void host_select(const char *name);
+
+#define GPIO_BASE			(host_get()->base)
+#define BLOCK_SIZE			(host_get()->block_size)
+#define PORTOFFSET			(host_get()->portoffset)
+#define GPIO_SYNC()			host_get()->sync()
+
+#define DEFAULT_PIC_CLK		(host_get()->pic_clk)
+#define DEFAULT_PIC_DATA	(host_get()->pic_data)
+#define DEFAULT_PIC_MCLR	(host_get()->pic_mclr)
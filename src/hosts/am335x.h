@@ -18,6 +18,8 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
  
+extern volatile uint32_t *gpio;
+
  /* PORT OFFSETs */
 #define GPIO0_BASE 0x44E07000
 #define GPIO1_BASE 0x4804C000
@@ -33,17 +35,58 @@
 #define GPIO_OE_REG 0x4d
 #define GPIO_IN_REG 0x4e
 #define GPIO_OUT_REG 0x4f
+#define GPIO_CLEARDATAOUT_REG 0x64
+#define GPIO_SETDATAOUT_REG 0x65
 
 #define OFFSET(g) ((int)((bool)(g/32))*(GPIO1_BASE-GPIO0_BASE)+(int)((bool)(g/64))*(GPIO2_BASE-GPIO1_BASE)+(int)((bool)(g/96))*(GPIO3_BASE-GPIO2_BASE))/4
 
+/* OE shadow of the four banks, loaded by GPIO_SYNC() after mapping */
+extern uint32_t am335x_oe[4];
+#define GPIO_SYNC()   for (int b = 0; b < 4; b++) am335x_oe[b] = *(gpio+OFFSET(b*32)+GPIO_OE_REG)
+
 /* GPIO setup macros. Always use GPIO_IN(x) before using GPIO_OUT(x) */
-#define GPIO_OUT(g)   *(gpio+OFFSET(g)+GPIO_OE_REG) &= ~(0x01<<(g%32))
-#define GPIO_IN(g)    *(gpio+OFFSET(g)+GPIO_OE_REG) |= (0x01<<(g%32))
+#define GPIO_OUT(g)   *(gpio+OFFSET(g)+GPIO_OE_REG) = (am335x_oe[g/32] &= ~(0x01<<(g%32)))
+#define GPIO_IN(g)    *(gpio+OFFSET(g)+GPIO_OE_REG) = (am335x_oe[g/32] |= (0x01<<(g%32)))
 
-#define GPIO_SET(g)   *(gpio+OFFSET(g)+GPIO_OUT_REG) |= (0x01<<(g%32))
-#define GPIO_CLR(g)   *(gpio+OFFSET(g)+GPIO_OUT_REG) &= ~(0x01<<(g%32))
+/* SETDATAOUT/CLEARDATAOUT are write-only: no read-modify-write on edges */
+#define GPIO_SET(g)   *(gpio+OFFSET(g)+GPIO_SETDATAOUT_REG) = (0x01<<(g%32))
+#define GPIO_CLR(g)   *(gpio+OFFSET(g)+GPIO_CLEARDATAOUT_REG) = (0x01<<(g%32))
 #define GPIO_LEV(g)   (*(gpio+OFFSET(g)+GPIO_IN_REG) >> (g%32)) & 0x01
 
+/* set/clear two pins, with a single store when on the same bank */
+#define GPIO_SET2(a,b)  do { if (a/32 == b/32) \
+                            *(gpio+OFFSET(a)+GPIO_SETDATAOUT_REG) = (0x01<<(a%32)) | (0x01<<(b%32)); \
+                        else { GPIO_SET(a); GPIO_SET(b); } } while (0)
+#define GPIO_CLR2(a,b)  do { if (a/32 == b/32) \
+                            *(gpio+OFFSET(a)+GPIO_CLEARDATAOUT_REG) = (0x01<<(a%32)) | (0x01<<(b%32)); \
+                        else { GPIO_CLR(a); GPIO_CLR(b); } } while (0)
+
+/* whole-bank access: any pins of the bank of g with one store or read */
+#define GPIO_BANK(g)    (g/32)
+#define GPIO_BIT(g)     (0x01<<(g%32))
+#define GPIO_SETM(g,m)  *(gpio+OFFSET(g)+GPIO_SETDATAOUT_REG) = (m)
+#define GPIO_CLRM(g,m)  *(gpio+OFFSET(g)+GPIO_CLEARDATAOUT_REG) = (m)
+#define GPIO_LEVM(g)    *(gpio+OFFSET(g)+GPIO_IN_REG)
+
+/* host policy: the macros above, for the device class templates */
+struct am335x_host{
+	static const bool shadow = false;	// set and clear registers, no shadow
+	static inline void sync(void){ GPIO_SYNC(); }
+	static inline void resync(void){}
+	static inline void in(int g){ GPIO_IN(g); }
+	static inline void out(int g){ GPIO_OUT(g); }
+	static inline void set(int g){ GPIO_SET(g); }
+	static inline void clr(int g){ GPIO_CLR(g); }
+	static inline int lev(int g){ return GPIO_LEV(g); }
+	static inline void set2(int a, int b){ GPIO_SET2(a,b); }
+	static inline void clr2(int a, int b){ GPIO_CLR2(a,b); }
+	static inline int bank(int g){ return GPIO_BANK(g); }
+	static inline uint32_t bit(int g){ return GPIO_BIT(g); }
+	static inline void setm(int g, uint32_t m){ GPIO_SETM(g,m); }
+	static inline void clrm(int g, uint32_t m){ GPIO_CLRM(g,m); }
+	static inline uint32_t levm(int g){ return GPIO_LEVM(g); }
+};
+
 /* default GPIO <-> PIC connections */
 #define DEFAULT_PIC_CLK    60   /* PGC  - Output - gpio1_28 */
 #define DEFAULT_PIC_DATA   49   /* PGD  - I/O    - gpio1_17 */
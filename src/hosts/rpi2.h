@@ -19,20 +19,64 @@
  */
 
 
+extern volatile uint32_t *gpio;
+
 /* GPIO registers address */
 #define BCM2708_PERI_BASE  0x3F000000
 #define GPIO_BASE          (BCM2708_PERI_BASE + 0x200000) /* GPIO controller */
 #define BLOCK_SIZE         (256)
 #define PORTOFFSET         0
 
+/*
+ * GPFSEL0..5 are cached on the host (loaded by GPIO_SYNC() after mapping):
+ * a direction change is a single store of the updated word, with no read
+ * of the register, so PGD turnarounds cost one bus write.
+ */
+extern uint32_t rpi_fsel[6];
+#define GPIO_SYNC()   for (int r = 0; r < 6; r++) rpi_fsel[r] = *(gpio+r)
+
+#define FSEL_REG(g)   ((g&0xFF)/10)
+#define FSEL_IN(g)    (rpi_fsel[FSEL_REG(g)] & ~(7<<(((g&0xFF)%10)*3)))
+#define FSEL_OUT(g)   (FSEL_IN(g) | (1<<(((g&0xFF)%10)*3)))
+
 /* GPIO setup macros. Always use GPIO_IN(x) before using GPIO_OUT(x) */
-#define GPIO_IN(g)    *(gpio+((g&0xFF)/10))   &= ~(7<<(((g&0xFF)%10)*3))
-#define GPIO_OUT(g)   *(gpio+((g&0xFF)/10))   |=  (1<<(((g&0xFF)%10)*3))
+#define GPIO_IN(g)    *(gpio+FSEL_REG(g)) = (rpi_fsel[FSEL_REG(g)] = FSEL_IN(g))
+#define GPIO_OUT(g)   *(gpio+FSEL_REG(g)) = (rpi_fsel[FSEL_REG(g)] = FSEL_OUT(g))
 
 #define GPIO_SET(g)   *(gpio+7)  = 1<<(g&0xFF)
 #define GPIO_CLR(g)   *(gpio+10) = 1<<(g&0xFF)
 #define GPIO_LEV(g)   (*(gpio+13) >> (g&0xFF)) & 0x1 /* reads pin level */
 
+/* GPSET0/GPCLR0 take a mask: set/clear two pins with a single store */
+#define GPIO_SET2(a,b)  *(gpio+7)  = (1<<(a&0xFF)) | (1<<(b&0xFF))
+#define GPIO_CLR2(a,b)  *(gpio+10) = (1<<(a&0xFF)) | (1<<(b&0xFF))
+
+/* whole-bank access: any pins of the bank of g with one store or read */
+#define GPIO_BANK(g)    ((g&0xFF)/32)
+#define GPIO_BIT(g)     (1<<((g&0xFF)%32))
+#define GPIO_SETM(g,m)  *(gpio+7+GPIO_BANK(g))  = (m)
+#define GPIO_CLRM(g,m)  *(gpio+10+GPIO_BANK(g)) = (m)
+#define GPIO_LEVM(g)    *(gpio+13+GPIO_BANK(g))
+
+/* host policy: the macros above, for the device class templates */
+struct bcm2835_host{
+	static const bool shadow = false;	// set and clear registers, no shadow
+	static inline void sync(void){ GPIO_SYNC(); }
+	static inline void resync(void){}
+	static inline void in(int g){ GPIO_IN(g); }
+	static inline void out(int g){ GPIO_OUT(g); }
+	static inline void set(int g){ GPIO_SET(g); }
+	static inline void clr(int g){ GPIO_CLR(g); }
+	static inline int lev(int g){ return GPIO_LEV(g); }
+	static inline void set2(int a, int b){ GPIO_SET2(a,b); }
+	static inline void clr2(int a, int b){ GPIO_CLR2(a,b); }
+	static inline int bank(int g){ return GPIO_BANK(g); }
+	static inline uint32_t bit(int g){ return GPIO_BIT(g); }
+	static inline void setm(int g, uint32_t m){ GPIO_SETM(g,m); }
+	static inline void clrm(int g, uint32_t m){ GPIO_CLRM(g,m); }
+	static inline uint32_t levm(int g){ return GPIO_LEVM(g); }
+};
+
 /* default GPIO <-> PIC connections */
 #define DEFAULT_PIC_CLK    23   /* PGC - Output */
 #define DEFAULT_PIC_DATA   24   /* PGD - I/O */
@@ -53,15 +53,9 @@
 #include "devices/pic24fjxxxga2_gb2.h"
 #include "devices/pic24fxxka1xx.h"
 
-int                 mem_fd;
-void                *gpio_map;
-volatile uint32_t   *gpio;
-
 struct flags_struct flags;
 
-int pic_clk  = DEFAULT_PIC_CLK;
-int pic_data = DEFAULT_PIC_DATA;
-int pic_mclr = DEFAULT_PIC_MCLR;
+int pic_clk, pic_data, pic_mclr;
 char pic_clk_port=0, pic_data_port=0, pic_mclr_port=0;
 
 #define FXN_NULL        0b00000000
@@ -73,18 +67,193 @@ char pic_clk_port=0, pic_data_port=0, pic_mclr_port=0;
 #define FXN_BLANKCHEK   0b00100000
 #define FXN_REGDUMP     0b01000000
 
-/* Hardware delay function by Gordon's Projects - WiringPi */
-void delay_us (unsigned int howLong)
+/*
+ * Programming heads (--head): each one has its own PGC/PGD/MCLR and runs
+ * its own Pic on its own thread. Head 0 is the one given with --gpio.
+ */
+#define HEAD_MAX        8
+
+struct head_struct {
+    int         pic_clk, pic_data, pic_mclr;
+    Pic         *pic;
+    bool        found;
+    uint8_t     blank;
+    pthread_t   thread;
+};
+
+static head_struct  heads[HEAD_MAX];
+static int          nheads = 1;
+static int          head_function;
+static char         *head_infile;
+
+/* Create the device class of a PIC family on the given GPIO backend */
+template<class io>
+static Pic *new_family(const char *family)
+{
+    if(family == 0 || strcmp(family, "dspic33f") == 0)
+        return new dspic33f<io>();
+    else if(strcmp(family,"dspic33e") == 0)
+        return new dspic33e<io>(SF_DSPIC33E);
+    else if(strcmp(family,"pic24fj") == 0)
+        return new dspic33e<io>(SF_PIC24FJ);
+    else if(strcmp(family,"pic10f322") == 0)
+        return new pic10f322<io>();
+    else if(strcmp(family,"pic18fj") == 0)
+        return new pic18fj<io>();
+    else if(strcmp(family,"pic24fjxxxga0xx") == 0)
+        return new pic24fjxxxga0xx<io>();
+    else if(strcmp(family,"pic24fjxxxga3xx") == 0)
+        return new pic24fjxxxga3xx<io>();
+    else if(strcmp(family,"pic24fjxxxgl3xx") == 0)
+        return new pic24fjxxxgl3xx<io>();
+    else if(strcmp(family,"pic24fjxxga1xx") == 0)
+        return new pic24fjxxga1xx_gb0xx<io>();
+    else if(strcmp(family,"pic24fjxxgb0xx") == 0)
+        return new pic24fjxxga1xx_gb0xx<io>();
+    else if(strcmp(family,"pic24fjxxxga1xx") == 0)
+        return new pic24fjxxxga1_gb1<io>();
+    else if(strcmp(family,"pic24fjxxxga2xx") == 0)
+        return new pic24fjxxxga2_gb2<io>();
+    else if(strcmp(family,"pic24fjxxxgb1xx") == 0)
+        return new pic24fjxxxga1_gb1<io>();
+    else if(strcmp(family,"pic24fjxxxgb2xx") == 0)
+        return new pic24fjxxxga2_gb2<io>();
+    else if(strcmp(family,"pic24fxxka1xx") == 0)
+        return new pic24fxxka1xx<io>();
+    else if(strcmp(family,"pic32mx1") == 0)
+        return new pic32<io>(SF_PIC32MX1);
+    else if(strcmp(family,"pic32mx2") == 0)
+        return new pic32<io>(SF_PIC32MX2);
+    else if(strcmp(family,"pic32mx3") == 0)
+        return new pic32<io>(SF_PIC32MX3);
+    else if(strcmp(family,"pic32mz") == 0)
+        return new pic32<io>(SF_PIC32MZ);
+    else if(strcmp(family,"pic32mk") == 0)
+        return new pic32<io>(SF_PIC32MK);
+
+    return 0;
+}
+
+template<class io>
+static Pic *new_backend(const char *family)
 {
-	struct timeval tNow, tLong, tEnd;
+    /* instrumented devices only when a hook is registered */
+    if(gang.n && gpio_nhooks)
+        return new_family<hook_gpio<gang_gpio<io> > >(family);
+    if(gang.n)
+        return new_family<gang_gpio<io> >(family);
+    if(gpio_nhooks)
+        return new_family<hook_gpio<io> >(family);
+    return new_family<io>(family);
+}
 
-	gettimeofday (&tNow, 0);
-	tLong.tv_sec  = howLong / 1000000;
-	tLong.tv_usec = howLong % 1000000;
-	timeradd (&tNow, &tLong, &tEnd);
+/* Create the device class of a PIC family on the selected GPIO backend */
+Pic *new_pic(const char *family)
+{
+    switch(gpio_backend){
+        case GPIO_BACKEND_GPIOCHIP:
+            return new_backend<gpiochip_gpio>(family);
+        case GPIO_BACKEND_MOCK:
+            return new_backend<mock_gpio>(family);
+        default:
+            if(gpio_shared)     /* a head: plain device, locked updates */
+                MMAP_DISPATCH_SHARED(new_family<, >(family))
+            MMAP_DISPATCH(new_backend<, >(family))
+    }
+}
+
+/* Parse a pin in [PORT:]NUM form; -1 if not well formed */
+static int parse_pin(const char *tok)
+{
+    char port = 0;
+    int pin;
 
-	while (timercmp (&tNow, &tEnd, <))
-		gettimeofday (&tNow, 0);
+    if(sscanf(tok, "%c:%d", &port, &pin) == 2)
+        return pin | ((port-'A')*PORTOFFSET)<<8;
+    if(sscanf(tok, "%d", &pin) == 1)
+        return pin;
+    return -1;
+}
+
+/* Program mode session of one head, on its own thread */
+static void *head_main(void *arg)
+{
+    head_struct *h = (head_struct *) arg;
+    Pic *pic = h->pic;
+
+    pic->enter_program_mode();
+    pic->setup_pe();
+
+    h->found = pic->read_device_id();
+    if(h->found){
+        switch(head_function){
+            case FXN_WRITE:
+                pic->write(head_infile);
+                break;
+            case FXN_ERASE:
+                pic->bulk_erase();
+                break;
+            case FXN_BLANKCHEK:
+                h->blank = pic->blank_check();
+                break;
+        }
+    }
+
+    pic->exit_program_mode();
+    return NULL;
+}
+
+/* Run the selected function on all the heads at once; false if any failed */
+static bool run_heads(const char *family)
+{
+    bool ok = true;
+    int i;
+
+    gpio_shared = true;
+    for(i = 0; i < nheads; i++){
+        heads[i].pic = new_pic(family);
+        if(heads[i].pic == 0){
+            cerr << "ERROR: PIC family not correctly chosen." << endl;
+            return false;
+        }
+        heads[i].pic->pic_clk = heads[i].pic_clk;
+        heads[i].pic->pic_data = heads[i].pic_data;
+        heads[i].pic->pic_mclr = heads[i].pic_mclr;
+    }
+
+    cout << "Running " << nheads << " heads...";
+    for(i = 0; i < nheads; i++)
+        if(pthread_create(&heads[i].thread, NULL, head_main, &heads[i])){
+            cerr << "ERROR: cannot start head " << i << endl;
+            exit(1);
+        }
+    for(i = 0; i < nheads; i++)
+        pthread_join(heads[i].thread, NULL);
+    gpio_shared = false;
+    cout << "DONE!" << endl;
+
+    for(i = 0; i < nheads; i++){
+        Pic *pic = heads[i].pic;
+
+        if(!heads[i].found){
+            fprintf(stdout, "Head %d: ERROR, unknown/unsupported device "
+                    "or programmer not connected (ID 0x%x)\n", i,
+                    pic->device_id);
+            ok = false;
+        }
+        else if(head_function == FXN_BLANKCHEK)
+            fprintf(stdout, "Head %d: %s, chip is %sblank\n", i, pic->name,
+                    heads[i].blank ? "not " : "");
+        else
+            fprintf(stdout, "Head %d: %s, ID 0x%08x, revision 0x%08x\n", i,
+                    pic->name, pic->device_id, pic->device_rev);
+
+        free(pic->mem.location);
+        free(pic->mem.filled);
+        delete pic;
+    }
+
+    return ok;
 }
 
 int main(int argc, char *argv[])
@@ -95,11 +264,14 @@ int main(int argc, char *argv[])
     bool log = false;
     char *logfile = 0;
     char *pins = 0;
+    char *gang_pins = 0;
+    char *head_pins[HEAD_MAX];
     char *family = 0;
     uint32_t count = 0, start = 0;
     int option_index = 0;
     int server_port = 15000;
     uint8_t retval = 0;
+    bool found = false;
 
     static struct option long_options[] = {
             {"help",        no_argument,       0,           'h'},
@@ -113,8 +285,24 @@ int main(int argc, char *argv[])
             {"regdump",     no_argument,       0,           'd'},
             {"reset",       no_argument,       0,           'R'},
             {"log",         required_argument, 0,           'l'},
+            {"timing",      required_argument, 0,           'T'},
+            {"backend",     required_argument, 0,           'B'},
+            {"realtime",    optional_argument, 0,           'P'},
+            {"stats",       optional_argument, 0,           'Q'},
+            {"speed",       required_argument, 0,           'A'},
+            {"record",      required_argument, 0,           'W'},
+            {"replay",      required_argument, 0,           'Y'},
+            {"trace",       required_argument, 0,           'V'},
+            {"gang",        required_argument, 0,           'G'},
+            {"head",        required_argument, 0,           'D'},
+            {"pe",          required_argument, 0,           'E'},
+            {"transport",   required_argument, 0,           'J'},
+#if defined(BOARD_ALL)
+            {"host",        required_argument, 0,           'H'},
+#endif
             {"debug",       no_argument,       &flags.debug,        1},
             {"noverify",    no_argument,       &flags.noverify,     1},
+            {"nothread",    no_argument,       &flags.nothread,     1},
             {"boot-only",   no_argument,       &flags.boot_only,    1},
             {"program-only",no_argument,       &flags.program_only, 1},
 	    {"fulldump",    no_argument,       &flags.fulldump,     1},
@@ -171,6 +359,116 @@ int main(int argc, char *argv[])
             case 'R':
                 function = FXN_RESET;
                 break;
+            case 'T':
+                if(strcmp(optarg, "datasheet") == 0)
+                    timing.preset = TIMING_DATASHEET;
+                else if(strcmp(optarg, "safe") == 0)
+                    timing.preset = TIMING_SAFE;
+                else if(strncmp(optarg, "custom", 6) == 0 &&
+                        (optarg[6] == 0 || optarg[6] == ':')){
+                    char *end;
+                    long scale;
+
+                    timing.preset = TIMING_CUSTOM;
+                    if(optarg[6] == ':'){
+                        scale = strtol(&optarg[7], &end, 10);
+                        if(end == &optarg[7] || *end || scale < 0 ||
+                           scale > 100000){
+                            cout << "Bad timing percentage " << &optarg[7]
+                                 << endl;
+                            exit(1);
+                        }
+                        timing.scale = scale;
+                    }
+                }
+                else{
+                    cout << "Unknown timing preset " << optarg << endl;
+                    exit(1);
+                }
+                break;
+            case 'B':
+                if(strcmp(optarg, "mem") == 0)
+                    gpio_backend = GPIO_BACKEND_MEM;
+                else if(strcmp(optarg, "gpiomem") == 0)
+                    gpio_backend = GPIO_BACKEND_GPIOMEM;
+                else if(strncmp(optarg, "gpiochip", 8) == 0){
+                    gpio_backend = GPIO_BACKEND_GPIOCHIP;
+                    if(optarg[8] == ':')
+                        gpiochip_path = &optarg[9];
+                }
+                else if(strcmp(optarg, "mock") == 0)
+                    gpio_backend = GPIO_BACKEND_MOCK;
+                else{
+                    cout << "Unknown GPIO backend " << optarg << endl;
+                    exit(1);
+                }
+                break;
+            case 'P':
+                realtime.enabled = 1;
+                if(optarg)
+                    realtime.cpu = atoi(optarg);
+                break;
+            case 'Q':
+                stats.enabled = 1;
+                stats.file = optarg;
+                stats_init();
+                break;
+            case 'A':
+                if(strncmp(optarg, "auto", 4) == 0)
+                    speed.autotune = 1;
+                else if(strncmp(optarg, "retune", 6) == 0)
+                    speed.autotune = speed.retune = 1;
+                else{
+                    cout << "Unknown speed mode " << optarg << endl;
+                    exit(1);
+                }
+                if(strchr(optarg, ':'))
+                    speed.margin = atoi(strchr(optarg, ':') + 1);
+                break;
+            case 'W':
+                replay.record = optarg;
+                record_init();
+                break;
+            case 'Y':
+                replay.file = optarg;
+                break;
+            case 'G':
+                gang_pins = optarg;
+                break;
+            case 'D':
+                if(nheads == HEAD_MAX){
+                    cout << "At most " << HEAD_MAX << " heads!" << endl;
+                    exit(1);
+                }
+                head_pins[nheads++] = optarg;
+                break;
+            case 'E':
+                if(strcmp(optarg, "off") == 0)
+                    pe.off = 1;
+                else
+                    pe.file = optarg;
+                break;
+            case 'J':
+                if(strcmp(optarg, "jtag") == 0)
+                    jtag.on = 1;
+                else if(strcmp(optarg, "icsp") != 0){
+                    cout << "Unknown transport " << optarg << endl;
+                    exit(1);
+                }
+                break;
+            case 'V':
+                trace.file = optarg;
+                if(strchr(optarg, ':')){
+                    *strchr(optarg, ':') = 0;
+                    trace.records = atoi(optarg + strlen(optarg) + 1);
+                }
+                trace_init();
+                break;
+#if defined(BOARD_ALL)
+            case 'H':
+                host_select(optarg);
+                break;
+#endif
             default:
                 cout << endl;
                 usage();
@@ -178,6 +476,11 @@ int main(int argc, char *argv[])
         }
     }
 
+    if (replay.record && function != FXN_WRITE) {
+        cout << "--record needs --write!" << endl;
+        exit(1);
+    }
+
     if (function & FXN_WRITE && !infile) {
         cout << "Please specify an input file!" << endl;
         exit(1);
@@ -197,7 +500,38 @@ int main(int argc, char *argv[])
     cout << "picberry PIC Programmer v" << VERSION << endl;
 
     /* Configure GPIOs */
-    if(pins != 0){       // if GPIO connections are specified in the options...
+    pic_clk  = DEFAULT_PIC_CLK;
+    pic_data = DEFAULT_PIC_DATA;
+    pic_mclr = DEFAULT_PIC_MCLR;
+    if(jtag.on){         // PIC32 4-wire JTAG: TCK,TMS,TDI,TDO
+        int pin[4], n = 0;
+
+        for(char *tok = pins ? strtok(pins, ",") : 0; tok; tok = strtok(0, ",")){
+            if(n == 4 || (pin[n] = parse_pin(tok)) < 0){
+                n = 0;
+                break;
+            }
+            n++;
+        }
+        if(n != 4){
+            cout << "--transport=jtag needs --gpio=TCK,TMS,TDI,TDO!" << endl;
+            exit(1);
+        }
+        if(!family || strncmp(family, "pic32", 5)){
+            cout << "--transport=jtag is supported on PIC32 only!" << endl;
+            exit(1);
+        }
+        if(gang_pins || nheads > 1 || replay.record || replay.file){
+            cout << "--transport=jtag cannot be used with --gang, --head, "
+                    "--record or --replay!" << endl;
+            exit(1);
+        }
+        pic_clk = pin[0];
+        jtag.tms = pin[1];
+        pic_data = pin[2];
+        jtag.tdo = pin[3];
+    }
+    else if(pins != 0){  // if GPIO connections are specified in the options...
         if(!strchr(&pins[0],':'))   // port not specified
             sscanf(&pins[0], "%d,%d,%d", &pic_clk, &pic_data, &pic_mclr);
         else{                       // port specified
@@ -216,7 +550,109 @@ int main(int argc, char *argv[])
         }
     }
     
-    if(flags.debug){
+    /* other targets of the gang: PGD pins, in the same form */
+    if(gang_pins != 0){
+        gang.pin[0] = pic_data;
+        gang.n = 1;
+        for(char *tok = strtok(gang_pins, ","); tok; tok = strtok(0, ",")){
+            int pin = parse_pin(tok);
+
+            if(gang.n == GANG_MAX){
+                cout << "At most " << GANG_MAX << " gang targets!" << endl;
+                exit(1);
+            }
+            if(pin < 0){
+                cout << "Gang selection string not correctly formatted!"
+                     << endl;
+                exit(1);
+            }
+            if(pin == pic_clk || pin == pic_mclr){
+                cout << "Gang PGD pins cannot be PGC or MCLR!" << endl;
+                exit(1);
+            }
+            gang.pin[gang.n++] = pin;
+        }
+    }
+
+    /* other programming heads: PGC,PGD,MCLR, in the same form */
+    heads[0].pic_clk = pic_clk;
+    heads[0].pic_data = pic_data;
+    heads[0].pic_mclr = pic_mclr;
+    for(int i = 1; i < nheads; i++){
+        int pin[3], n = 0;
+
+        for(char *tok = strtok(head_pins[i], ","); tok; tok = strtok(0, ",")){
+            if(n == 3 || (pin[n] = parse_pin(tok)) < 0){
+                n = 0;
+                break;
+            }
+            n++;
+        }
+        if(n != 3){
+            cout << "Head selection string not correctly formatted!" << endl;
+            exit(1);
+        }
+        heads[i].pic_clk = pin[0];
+        heads[i].pic_data = pin[1];
+        heads[i].pic_mclr = pin[2];
+        for(int j = 0; j < i; j++)
+            for(n = 0; n < 3; n++)
+                if(pin[n] == heads[j].pic_clk || pin[n] == heads[j].pic_data ||
+                   pin[n] == heads[j].pic_mclr){
+                    cout << "Heads cannot share pins!" << endl;
+                    exit(1);
+                }
+    }
+    if(nheads > 1){
+        if(gang_pins || trace.file || replay.record || replay.file ||
+           stats.enabled || speed.autotune || realtime.enabled){
+            cout << "--head cannot be used with --gang, --trace, --record, "
+                    "--replay, --stats, --speed or --realtime!" << endl;
+            exit(1);
+        }
+        if(function != FXN_WRITE && function != FXN_ERASE &&
+           function != FXN_BLANKCHEK && function != FXN_NULL){
+            cout << "--head supports --write, --erase and --blankcheck only!"
+                 << endl;
+            exit(1);
+        }
+    }
+
+    /* with --gang, -w can take a HEX file per target: write them bit-sliced */
+    if(infile && strchr(infile, ',')){
+        int n = 0;
+
+        if(!gang.n){
+            cout << "A HEX file per target needs --gang!" << endl;
+            exit(1);
+        }
+        if(!family || (strcmp(family, "dspic33e") && strcmp(family, "pic24fj"))){
+            cout << "A HEX file per target is supported on dspic33e and "
+                    "pic24fj only!" << endl;
+            exit(1);
+        }
+        if(replay.record || replay.file){
+            cout << "--record and --replay need one HEX file!" << endl;
+            exit(1);
+        }
+        for(char *tok = strtok(infile, ","); tok; tok = strtok(0, ",")){
+            if(n == gang.n)
+                break;
+            gang.image[n++] = tok;
+        }
+        if(n != gang.n || strtok(0, ",")){
+            cout << "Please specify one HEX file per gang target!" << endl;
+            exit(1);
+        }
+    }
+
+    if(flags.debug && jtag.on){
+        cout << "TCK <=> pin " << (pic_clk&0xFF) << endl;
+        cout << "TMS <=> pin " << (jtag.tms&0xFF) << endl;
+        cout << "TDI <=> pin " << (pic_data&0xFF) << endl;
+        cout << "TDO <=> pin " << (jtag.tdo&0xFF) << endl;
+    }
+    else if(flags.debug){
         cout << "PGC <=> pin " << pic_clk_port << (pic_clk&0xFF)
              << endl;
         cout << "PGD <=> pin " << pic_data_port << (pic_data&0xFF)
@@ -225,6 +661,9 @@ int main(int argc, char *argv[])
              << endl;
     }
 
+    /* Calibrate the delay loop before any bit-banging */
+    delay_init();
+
     /* Setup gpio pointer for direct register access */
     if(flags.debug) cout << "Setting up I/O..." << endl;
     setup_io();
@@ -233,51 +672,19 @@ int main(int argc, char *argv[])
         pic_reset();
     else if(function == FXN_SERVER)
         server_mode(server_port);
+    else if(replay.file && (replay_session() || function != FXN_WRITE)){
+        /* replayed, or failed with no HEX file to fall back to */
+    }
+    else if(nheads > 1){
+        head_function = function;
+        head_infile = infile;
+        found = run_heads(family);
+    }
     else{
 
-        Pic *pic = new dspic33f();
-
-        if(family == 0 || strcmp(family, "dspic33f") == 0);
-            //pic = new dspic33f(); default case, nothing to do
-        else if(strcmp(family,"dspic33e") == 0)
-            pic = new dspic33e(SF_DSPIC33E);
-        else if(strcmp(family,"pic24fj") == 0)
-            pic = new dspic33e(SF_PIC24FJ);
-        else if(strcmp(family,"pic10f322") == 0)
-            pic = new pic10f322();
-        else if(strcmp(family,"pic18fj") == 0)
-            pic = new pic18fj();
-        else if(strcmp(family,"pic24fjxxxga0xx") == 0)
-            pic = new pic24fjxxxga0xx();
-        else if(strcmp(family,"pic24fjxxxga3xx") == 0)
-            pic = new pic24fjxxxga3xx();
-        else if(strcmp(family,"pic24fjxxxgl3xx") == 0)
-            pic = new pic24fjxxxgl3xx();
-        else if(strcmp(family,"pic24fjxxga1xx") == 0)
-            pic = new pic24fjxxga1xx_gb0xx();
-        else if(strcmp(family,"pic24fjxxgb0xx") == 0)
-            pic = new pic24fjxxga1xx_gb0xx();
-        else if(strcmp(family,"pic24fjxxxga1xx") == 0)
-            pic = new pic24fjxxxga1_gb1();
-        else if(strcmp(family,"pic24fjxxxga2xx") == 0)
-            pic = new pic24fjxxxga2_gb2();
-        else if(strcmp(family,"pic24fjxxxgb1xx") == 0)
-            pic = new pic24fjxxxga1_gb1();
-        else if(strcmp(family,"pic24fjxxxgb2xx") == 0)
-            pic = new pic24fjxxxga2_gb2();
-        else if(strcmp(family,"pic24fxxka1xx") == 0)
-				pic = new pic24fxxka1xx();
-        else if(strcmp(family,"pic32mx1") == 0)
-            pic = new pic32(SF_PIC32MX1);
-        else if(strcmp(family,"pic32mx2") == 0)
-            pic = new pic32(SF_PIC32MX2);
-        else if(strcmp(family,"pic32mx3") == 0)
-            pic = new pic32(SF_PIC32MX3);
-        else if(strcmp(family,"pic32mz") == 0)
-            pic = new pic32(SF_PIC32MZ);
-        else if(strcmp(family,"pic32mk") == 0)
-            pic = new pic32(SF_PIC32MK);   
-        else{
+        Pic *pic = new_pic(family);
+
+        if(pic == 0){
             cerr << "ERROR: PIC family not correctly chosen." << endl;
             cerr << "Available families:" << endl
                  << "- dspic33e" << endl
@@ -302,11 +709,19 @@ int main(int argc, char *argv[])
             goto clean;
         }
 
+        /* Find the fastest reliable timings for this fixture */
+        if(speed.autotune && !speed_auto(pic, family))
+            cerr << "Speed: no answer from the target, using safe timings"
+                 << endl;
+
         /* ENTER PROGRAM MODE */
+        record_start(family);
+        rt_enter();
         pic -> enter_program_mode();
         pic -> setup_pe();
 
-        if(pic -> read_device_id()){  // Read devide ID and setup memory
+        found = pic -> read_device_id();
+        if(found){  // Read devide ID and setup memory
         
             fprintf(stdout,"Device Name: %s\n", pic->name);
 		    fprintf(stdout,"Device ID: 0x%08x\n", pic->device_id);
@@ -355,6 +770,11 @@ int main(int argc, char *argv[])
             
 
         pic->exit_program_mode();
+        rt_exit();
+        stats_report();
+        if(found && gang.n && !gang_report())
+            found = false;
+        record_stop(found);
         
         if(!log){
             cout << "Press ENTER to exit program mode...";
@@ -375,77 +795,88 @@ clean:
     return 0;
 }
 
-/* Set up a memory regions to access GPIO */
+/* Set up the GPIO backend */
 void setup_io(void)
 {
-    /* open /dev/mem */
-    mem_fd = open("/dev/mem", O_RDWR|O_SYNC);
-    if (mem_fd == -1) {
-        perror("Cannot open /dev/mem");
-        exit(1);
+    int pins[3 * HEAD_MAX + GANG_MAX] = {pic_clk, pic_data, pic_mclr};
+    int n = 3;
+
+    if(jtag.on){
+        pins[n++] = jtag.tms;
+        pins[n++] = jtag.tdo;
     }
 
-    /* mmap GPIO */
-    gpio_map = mmap(0, BLOCK_SIZE, PROT_READ|PROT_WRITE,
-                    MAP_SHARED, mem_fd, GPIO_BASE);
-    if (gpio_map == MAP_FAILED) {
-        perror("mmap() failed");
-        exit(1);
+    for(int i = 1; i < gang.n; i++)
+        pins[n++] = gang.pin[i];
+    for(int i = 1; i < nheads; i++){
+        pins[n++] = heads[i].pic_clk;
+        pins[n++] = heads[i].pic_data;
+        pins[n++] = heads[i].pic_mclr;
     }
+    gpio_open(pins, n);
+    gang_setup();
 
-    /* Always use volatile pointer! */
-    gpio = (volatile uint32_t *) gpio_map;
-        
-    GPIO_IN(pic_clk);   // NOTE: MUST use GPIO_IN before GPIO_OUT
-    GPIO_OUT(pic_clk);
+    gpio_in(pic_clk);   // NOTE: MUST use gpio_in before gpio_out
+    gpio_out(pic_clk);
     
-    GPIO_IN(pic_data);
-    GPIO_OUT(pic_data);
+    gpio_in(pic_data);
+    gpio_out(pic_data);
+    for(int i = 1; i < gang.n; i++){
+        gpio_in(gang.pin[i]);
+        gpio_out(gang.pin[i]);
+        gpio_clr(gang.pin[i]);
+    }
     
-    GPIO_IN(pic_mclr);      // MCLR as input, puts the output driver in Hi-Z
+    gpio_in(pic_mclr);      // MCLR as input, puts the output driver in Hi-Z
 
-    GPIO_CLR(pic_clk);
-    GPIO_CLR(pic_data);
+    gpio_clr(pic_clk);
+    gpio_clr(pic_data);
+
+    if(jtag.on){
+        gpio_in(jtag.tms);
+        gpio_out(jtag.tms);
+        gpio_clr(jtag.tms);
+        gpio_in(jtag.tdo);
+    }
+
+    /* the other heads, the same way */
+    for(int i = 1; i < nheads; i++){
+        gpio_in(heads[i].pic_clk);
+        gpio_out(heads[i].pic_clk);
+        gpio_in(heads[i].pic_data);
+        gpio_out(heads[i].pic_data);
+        gpio_in(heads[i].pic_mclr);
+        gpio_clr(heads[i].pic_clk);
+        gpio_clr(heads[i].pic_data);
+    }
 
     delay_us(1);        // sleep for 1us after GPIO configuration
 }
 
-/* Release GPIO memory region */
+/* Release the GPIO backend */
 void close_io(void)
 {
-        int ret;
-        
         /* MCLR as input, puts the output driver in Hi-Z */
-        GPIO_IN(pic_mclr);
-
-        /* munmap GPIO */
-        ret = munmap(gpio_map, BLOCK_SIZE);
-        if (ret == -1) {
-            perror("munmap() failed");
-            exit(1);
-        }
+        gpio_in(pic_mclr);
+        for(int i = 1; i < nheads; i++)
+            gpio_in(heads[i].pic_mclr);
 
-        /* close /dev/mem */
-        ret = close(mem_fd);
-        if (ret == -1) {
-            perror("Cannot close /dev/mem");
-            exit(1);
-        }
+        gpio_close();
 }
 
 /* reset the device */
 void pic_reset(bool silent)
 {
-    GPIO_OUT(pic_mclr);
+    gpio_out(pic_mclr);
 
-    GPIO_CLR(pic_mclr);     // remove VDD from MCLR pin
+    gpio_clr(pic_mclr);     // remove VDD from MCLR pin
     delay_us(1500);
     if(!flags.client && !silent){
         cout << "Press any key to release the reset...";
         fgetc(stdin);
         cout << endl;
     }
-    GPIO_IN(pic_mclr);      // MCLR as input, puts the output driver in Hi-Z
+    gpio_in(pic_mclr);      // MCLR as input, puts the output driver in Hi-Z
 }
 
 /* print the help */
@@ -467,6 +898,24 @@ void usage(void)
             "       --blankcheck,       -b                blank check of the chip\n"
             "       --regdump,          -d                read configuration registers\n"
             "       --noverify                            skip memory verification after writing\n"
+            "       --nothread                            pack the rows of a write in the program mode thread\n"
+            "       --timing=preset                       ICSP timings: datasheet, safe or custom[:percent] [default: safe]\n"
+            "       --backend=name                        GPIO access: mem, gpiomem, gpiochip[:path] or mock [default: mem]\n"
+            "       --realtime[=cpu]                      run program mode as SCHED_FIFO, pinned to cpu [default: last]\n"
+            "       --stats[=file.json]                   report PGC edge timings per ICSP operation [default: stderr]\n"
+            "       --speed=auto[:margin]                 tune the timings to this fixture, cached [default margin: 25%]\n"
+            "       --speed=retune[:margin]               as auto, ignoring the cached result\n"
+            "       --record=file                         record the GPIO operations of a write session to file\n"
+            "       --replay=file                         replay a recorded session, checking all reads [with -w: fall back to it]\n"
+            "       --trace=file.vcd[:records]            trace the GPIO operations to a VCD file [default: 1048576 records]\n"
+            "       --head=PGC,PGD,MCLR                   one more programming head, run on its own thread (repeatable)\n"
+            "       --gang=PGD,PGD,...                    program more targets at once, sharing PGC and MCLR, PGD in [PORT:]NUM form\n"
+            "                                             with -w a.hex,b.hex,... a HEX file per target (dspic33e, pic24fj)\n"
+            "       --transport=jtag                      PIC32 over 4-wire JTAG, with --gpio=TCK,TMS,TDI,TDO [default: icsp]\n"
+            "       --pe=file.hex|off                     write this programming executive first (16-bit families), or use plain ICSP\n"
+#if defined(BOARD_ALL)
+            "       --host=name                           host board: rpi, rpi2, am335x or a10 [default: detected]\n"
+#endif
             "       --debug                               turn ON debug\n"
             "       --fulldump                            don't detect empty sections, make complete dump (PIC32)\n"
             "       --program-only                        read/write only program section (PIC32)\n"
@@ -563,7 +1012,7 @@ void server_mode(int port){
     }
     
     /* Setup picberry operation */
-    Pic *pic = new dspic33f();
+    Pic *pic = new_pic("dspic33f");
     current_family = SRV_FAM_DSPIC33F;
     
     /* Run until cancelled */
@@ -601,17 +1050,23 @@ void server_mode(int port){
                 case SRV_ENTER:
                     if(!program_mode){
                         cerr << "[CMD] Enter Program Mode" << endl;
+                        rt_enter();
                         pic -> enter_program_mode();
                         if(pic -> setup_pe())
                             program_mode = true;
-                        else
+                        else{
                             pic -> exit_program_mode();
+                            rt_exit();
+                            stats_report();
+                        }
                     }
                     break;
                 case SRV_EXIT:
                     if(program_mode){
                         cerr << "[CMD] Exit Program Mode" << endl;
                         pic -> exit_program_mode();
+                        rt_exit();
+                        stats_report();
                         program_mode = false;   
                     }
                     break;
@@ -624,39 +1079,39 @@ void server_mode(int port){
                         switch(buffer[1]){
                             case SRV_FAM_DSPIC33E:
                                 cerr << "DSPIC33E" << endl;
-                                pic = new dspic33e(SF_DSPIC33E);
+                                pic = new_pic("dspic33e");
                                 break;
                             case SRV_FAM_DSPIC33F:
                                 cerr << "DSPIC33F" << endl;
-                                pic = new dspic33f();
+                                pic = new_pic("dspic33f");
                                 break;
                             case SRV_FAM_PIC18FJ:
                                 cerr << "PIC18FJ" << endl;
-                                pic = new pic18fj();
+                                pic = new_pic("pic18fj");
                                 break;
                             case SRV_FAM_PIC24FJ:
                                 cerr << "PIC24FJ" << endl;
-                                pic = new dspic33e(SF_PIC24FJ);
+                                pic = new_pic("pic24fj");
                                 break;
                             case SRV_FAM_PIC32MX1:
                                 cerr << "PIC32MX1" << endl;
-                                pic = new pic32(SF_PIC32MX1);
+                                pic = new_pic("pic32mx1");
                                 break;
                             case SRV_FAM_PIC32MX2:
                                 cerr << "PIC32MX2" << endl;
-                                pic = new pic32(SF_PIC32MX2);
+                                pic = new_pic("pic32mx2");
                                 break;
                             case SRV_FAM_PIC32MX3:
                                 cerr << "PIC32MX3" << endl;
-                                pic = new pic32(SF_PIC32MX3);
+                                pic = new_pic("pic32mx3");
                                 break;
                             case SRV_FAM_PIC32MZ:
                                 cerr << "PIC32MZ" << endl;
-                                pic = new pic32(SF_PIC32MZ);
+                                pic = new_pic("pic32mz");
                                 break;
                             case SRV_FAM_PIC32MK:
                                 cerr << "PIC32MK" << endl;
-                                pic = new pic32(SF_PIC32MK);
+                                pic = new_pic("pic32mk");
                                 break;
                         }
                     }
@@ -677,6 +1132,8 @@ void server_mode(int port){
                         else{
                             fprintf(stdout, "NC");
                             pic -> exit_program_mode();
+                            rt_exit();
+                            stats_report();
                             program_mode = false;
                         }
                     }
@@ -722,6 +1179,8 @@ void server_mode(int port){
         cerr << "Client disconnected." << endl;
         if(program_mode){
             pic -> exit_program_mode();
+            rt_exit();
+            stats_report();
             program_mode = false;   
         }
         close(clientsock);
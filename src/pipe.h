@@ -0,0 +1,146 @@
+/*
+ * Raspberry Pi PIC Programmer using GPIO connector
+ * https://github.com/WallaceIT/picberry
+ * Copyright 2014 Francesco Valla
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PIPE_H_
+#define PIPE_H_
+
+#include <atomic>
+#include <pthread.h>
+#include <sched.h>
+
+/*
+ * Row pipeline. During a write, the host-side work on the next rows (HEX
+ * lookup, opcode packing, checksums, progress output) is done by a packer
+ * thread, which fills a single-producer/single-consumer ring of packed
+ * rows; the thread in program mode only takes them out and clocks them on
+ * the wire. The packer runs at normal priority, off the real-time CPU
+ * (rt_spawn()). On single-CPU hosts, or with --nothread, there is no
+ * packer thread and next() packs each row inline.
+ *
+ * pack(ctx, row) fills row and returns true, or returns false after the
+ * last row. report(ctx, row), if given, prints the progress of a row that
+ * is off the wire: the packer calls it before reusing the slot, and waits
+ * for the last rows before it exits.
+ */
+#define PIPE_ROWS		4
+#define PIPE_SPIN		64		// polls of an empty ring before yielding
+
+template<class T>
+struct row_pipe {
+	typedef bool (*packer)(void *ctx, T *row);
+	typedef void (*reporter)(void *ctx, const T *row);
+
+	T						slot[PIPE_ROWS];
+	std::atomic<unsigned int> head;		// packer: next slot to fill
+	std::atomic<unsigned int> tail;		// wire: next slot to clock out
+	std::atomic<bool>		cancel;
+	int						last;		// slot after the last row, -1 if none
+	packer					pack;
+	reporter				report;
+	void					*ctx;
+	bool					threaded;
+	pthread_t				thread;
+
+	row_pipe(packer p, void *c, reporter r = 0) : head(0), tail(0),
+		cancel(false), last(-1), pack(p), report(r), ctx(c)
+	{
+		threaded = rt_spawn(&thread, run, this);
+	}
+
+	~row_pipe()
+	{
+		if (threaded) {
+			cancel = true;
+			pthread_join(thread, NULL);
+		}
+	}
+
+	/* Report the rows clocked out since row *r; returns the tail */
+	unsigned int drain(unsigned int *r)
+	{
+		unsigned int t = tail.load(std::memory_order_acquire);
+
+		for (; *r != t; (*r)++)
+			if (report)
+				report(ctx, &slot[*r % PIPE_ROWS]);
+		return t;
+	}
+
+	static void *run(void *arg)
+	{
+		row_pipe *p = (row_pipe *) arg;
+		unsigned int h = 0, r = 0;
+		bool more;
+
+		do {
+			while (h - p->drain(&r) == PIPE_ROWS)
+				if (p->cancel)
+					return NULL;
+				else
+					sched_yield();
+			more = p->pack(p->ctx, &p->slot[h % PIPE_ROWS]);
+			if (!more)
+				p->last = h;
+			p->head.store(++h, std::memory_order_release);
+		} while (more);
+
+		/* the progress of the rows still on the wire */
+		while (p->drain(&r) != (unsigned int) p->last)
+			if (p->cancel)
+				return NULL;
+			else
+				sched_yield();
+
+		return NULL;
+	}
+
+	/* Next packed row, 0 after the last one */
+	T *next(void)
+	{
+		unsigned int t = tail.load(std::memory_order_relaxed);
+
+		if (!threaded)
+			return pack(ctx, &slot[0]) ? &slot[0] : 0;
+
+		/* the packer is usually a row ahead: spin briefly, then yield */
+		for (int spin = 0; head.load(std::memory_order_acquire) == t; spin++)
+			if (spin >= PIPE_SPIN)
+				sched_yield();
+		if ((int) t == last) {
+			/* let the packer print the last progress before returning */
+			pthread_join(thread, NULL);
+			threaded = false;
+			return 0;
+		}
+		return &slot[t % PIPE_ROWS];
+	}
+
+	/* The row returned by next() is on the wire: its slot can be reused */
+	void done(void)
+	{
+		if (threaded)
+			tail.store(tail.load(std::memory_order_relaxed) + 1,
+					   std::memory_order_release);
+		else if (report)
+			report(ctx, &slot[0]);
+	}
+};
+
+#endif /* PIPE_H_ */
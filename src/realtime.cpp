@@ -0,0 +1,176 @@
+/*
+ * Raspberry Pi PIC Programmer using GPIO connector
+ * https://github.com/WallaceIT/picberry
+ * Copyright 2014 Francesco Valla
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "common.h"
+
+/*
+ * While in program mode (--realtime) the process runs SCHED_FIFO with its
+ * memory locked. The bit loops call rt_checkpoint() between rows, where
+ * the ICSP link is idle: there the process sleeps for RT_YIELD every
+ * RT_SLICE, so that the rest of the system is not starved.
+ */
+#define RT_SLICE			20000000	// ns
+#define RT_YIELD			200000		// ns
+#define RT_STACK_PREFAULT	(64*1024)
+#define RT_HELPER_STACK		(256*1024)
+
+struct realtime_struct realtime;
+
+static bool			rt_active;
+static int			rt_cpu;
+static cpu_set_t	rt_saved_cpus;
+static bool			rt_saved;
+static long			rt_nivcsw;
+static uint64_t		rt_last_yield;
+
+static long involuntary_switches(void)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_THREAD, &usage);
+	return usage.ru_nivcsw;
+}
+
+/* Touch the stack and the GPIO pages, so that no page fault hits the loops */
+static void prefault(void)
+{
+	volatile char stack[RT_STACK_PREFAULT];
+
+	memset((char *)stack, 0, sizeof(stack));
+	gpio_lev(pic_clk);
+	gpio_lev(pic_data);
+	gpio_lev(pic_mclr);
+}
+
+/* Switch to real-time execution, before entering program mode */
+void rt_enter(void)
+{
+	struct sched_param param;
+	cpu_set_t cpus;
+	int cpu = realtime.cpu;
+
+	if (!realtime.enabled || rt_active)
+		return;
+
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1)
+		perror("mlockall() failed");
+	prefault();
+
+	/* isolated cores are usually the last ones (e.g. isolcpus=3) */
+	if (cpu < 0)
+		cpu = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+	rt_saved = sched_getaffinity(0, sizeof(rt_saved_cpus),
+								 &rt_saved_cpus) == 0;
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu, &cpus);
+	rt_cpu = cpu;
+	if (sched_setaffinity(0, sizeof(cpus), &cpus) == -1)
+		perror("sched_setaffinity() failed");
+
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = realtime.priority;
+	if (sched_setscheduler(0, SCHED_FIFO, &param) == -1)
+		perror("sched_setscheduler() failed");
+
+	rt_active = true;
+	rt_nivcsw = involuntary_switches();
+	rt_last_yield = now_ns();
+	delay_max_gap = 0;
+	delay_track(true);
+}
+
+/* Safe point between rows: give the CPU away for a moment once per slice */
+void rt_checkpoint(void)
+{
+	if (!rt_active || now_ns() - rt_last_yield < RT_SLICE)
+		return;
+
+	struct timespec ts = {0, RT_YIELD};
+	nanosleep(&ts, NULL);
+	rt_last_yield = now_ns();
+	delay_track(true);		// the sleep is not a stall
+}
+
+/* Back to normal scheduling after exiting program mode, and report */
+void rt_exit(void)
+{
+	struct sched_param param;
+
+	if (!rt_active)
+		return;
+
+	delay_track(false);
+	memset(&param, 0, sizeof(param));
+	sched_setscheduler(0, SCHED_OTHER, &param);
+	if (rt_saved)
+		sched_setaffinity(0, sizeof(rt_saved_cpus), &rt_saved_cpus);
+	munlockall();
+	rt_active = false;
+
+	fprintf(stderr, "Realtime: preempted %ld times, longest stall %llu us\n",
+			involuntary_switches() - rt_nivcsw,
+			(unsigned long long)(delay_max_gap / 1000));
+}
+
+/*
+ * Start a helper thread for the host-side work of program mode (e.g. the
+ * row packer of a write), at normal priority and off the real-time CPU.
+ * Returns false on single-CPU hosts or with --nothread: the caller then
+ * does the work inline.
+ */
+bool rt_spawn(pthread_t *thread, void *(*fn)(void *), void *arg)
+{
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	struct sched_param param;
+	pthread_attr_t attr;
+	cpu_set_t cpus;
+	int ret;
+
+	if (flags.nothread || ncpu < 2)
+		return false;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, RT_HELPER_STACK);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+	memset(&param, 0, sizeof(param));
+	pthread_attr_setschedparam(&attr, &param);
+	if (rt_active) {
+		CPU_ZERO(&cpus);
+		for (int i = 0; i < ncpu; i++)
+			if (i != rt_cpu)
+				CPU_SET(i, &cpus);
+		pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+	}
+
+	ret = pthread_create(thread, &attr, fn, arg);
+	pthread_attr_destroy(&attr);
+	return ret == 0;
+}
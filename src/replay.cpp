@@ -0,0 +1,393 @@
+/*
+ * Raspberry Pi PIC Programmer using GPIO connector
+ * https://github.com/WallaceIT/picberry
+ * Copyright 2014 Francesco Valla
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+
+/*
+ * Session record and replay (--record, --replay). While recording, every
+ * pin operation on PGC/PGD/MCLR and every wait, from program mode entry to
+ * exit, is appended to a byte stream; pin reads are stored with the level
+ * that was read. Replaying drives the same stream on the pins, and checks
+ * each read against the recorded level: the device ID read and the verify
+ * pass of the recorded write are the checkpoints.
+ *
+ * Status polling loops (io::mark(OP_POLL) ... io::poll()) are handshakes,
+ * whose length depends on the target: only their last pass is recorded,
+ * between REC_POLL and REC_POLL_END, and the replay runs it again until
+ * all of its reads match, for up to REC_POLL_TIMEOUT.
+ *
+ * One byte per operation:
+ *	bit 7		a wait follows, in ns, as a base-128 varint (LSB group first)
+ *	bits 4..2	REC_SET, REC_CLR, REC_IN, REC_OUT, REC_LEV0, REC_LEV1,
+ *				REC_POLL, REC_POLL_END
+ *	bits 1..0	pin: 0 PGC, 1 PGD, 2 MCLR (0 for REC_POLL, REC_POLL_END)
+ */
+#define REC_MAGIC		"PBRP"
+#define REC_VERSION		2
+#define REC_CHUNK		(1 << 20)	// bytes
+#define REC_CHECKPOINT	4096		// ops between rt_checkpoint() calls
+
+#define REC_SET			0
+#define REC_CLR			1
+#define REC_IN			2
+#define REC_OUT			3
+#define REC_LEV0		4
+#define REC_LEV1		5
+#define REC_POLL		6
+#define REC_POLL_END	7
+
+#define REC_POLL_TIMEOUT	1000000000ULL	// ns
+
+#define REC_DELAY		0x80
+
+struct rec_header {
+	char		magic[4];
+	uint32_t	version;
+	char		family[24];
+	uint32_t	ops;
+	uint32_t	size;		// bytes of the op stream
+};
+
+struct replay_struct replay;
+
+static uint8_t	*stream;
+static uint32_t	stream_size, stream_len;
+static uint32_t	ops;
+static int64_t	last_op = -1;		// offset of the last op byte
+static uint64_t	pending;			// wait after the last op, in ns
+static bool		recording;
+static int64_t	poll_op = -1;		// offset of the REC_POLL of the loop
+static uint32_t	poll_ops;			// ops up to it
+static char		rec_family[24];
+
+static void rec_byte(uint8_t b)
+{
+	if (stream_len == stream_size) {
+		stream_size += REC_CHUNK;
+		stream = (uint8_t *) realloc(stream, stream_size);
+		if (stream == NULL) {
+			fprintf(stderr, "Error: out of memory recording session.\n");
+			exit(1);
+		}
+	}
+	stream[stream_len++] = b;
+}
+
+/* Append the wait to the last op */
+static void rec_flush(void)
+{
+	if (last_op < 0 || pending == 0)
+		return;
+
+	stream[last_op] |= REC_DELAY;
+	while (pending >= 0x80) {
+		rec_byte(0x80 | (pending & 0x7F));
+		pending >>= 7;
+	}
+	rec_byte(pending);
+	pending = 0;
+}
+
+/* Append an op byte */
+static void rec_op(uint8_t op)
+{
+	rec_flush();
+	last_op = stream_len;
+	rec_byte(op);
+	ops++;
+}
+
+/* Keep only the last pass of a polling loop */
+static void rec_poll(int op)
+{
+	if (op == OP_POLL && poll_op < 0) {
+		rec_op(REC_POLL << 2);
+		poll_op = last_op;
+		poll_ops = ops;
+	}
+	else if (op == OP_POLL) {
+		stream[poll_op] &= ~REC_DELAY;
+		stream_len = poll_op + 1;
+		last_op = poll_op;
+		ops = poll_ops;
+		pending = 0;
+	}
+	else if (op == OP_POLL_DONE && poll_op >= 0) {
+		rec_op(REC_POLL_END << 2);
+		poll_op = -1;
+	}
+}
+
+static void rec_event(int event, int g, int value)
+{
+	int pin, code;
+
+	if (!recording)
+		return;
+
+	if (event == EV_MARK) {
+		rec_poll(g);
+		return;
+	}
+
+	if (g == pic_clk)
+		pin = 0;
+	else if (g == pic_data)
+		pin = 1;
+	else if (g == pic_mclr)
+		pin = 2;
+	else
+		return;
+
+	switch (event) {
+		case EV_SET:	code = REC_SET; break;
+		case EV_CLR:	code = REC_CLR; break;
+		case EV_IN:		code = REC_IN; break;
+		case EV_OUT:	code = REC_OUT; break;
+		case EV_LEV:	code = value ? REC_LEV1 : REC_LEV0; break;
+		default:		return;
+	}
+
+	rec_op((code << 2) | pin);
+}
+
+static void rec_delay(unsigned int ns)
+{
+	if (recording)
+		pending += ns;
+}
+
+/* Register the recording hooks, before the device class is created */
+void record_init(void)
+{
+	if (replay.record) {
+		gpio_add_hook(rec_event);
+		delay_hook = rec_delay;
+	}
+}
+
+void record_start(const char *family)
+{
+	if (!replay.record)
+		return;
+
+	strncpy(rec_family, family, sizeof(rec_family) - 1);
+	stream_len = 0;
+	ops = 0;
+	last_op = -1;
+	pending = 0;
+	poll_op = -1;
+	recording = true;
+}
+
+/* Stop recording; the session is saved only if it completed */
+void record_stop(bool save)
+{
+	struct rec_header h;
+	FILE *fp;
+
+	if (!recording)
+		return;
+	recording = false;
+	rec_flush();
+	if (!save) {
+		fprintf(stderr, "Record: session failed, %s not written.\n",
+				replay.record);
+		return;
+	}
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, REC_MAGIC, 4);
+	h.version = REC_VERSION;
+	memcpy(h.family, rec_family, sizeof(h.family));
+	h.ops = ops;
+	h.size = stream_len;
+
+	fp = fopen(replay.record, "wb");
+	if (fp == NULL) {
+		fprintf(stderr, "Error: cannot open record file %s.\n",
+				replay.record);
+		return;
+	}
+	if (fwrite(&h, sizeof(h), 1, fp) != 1 ||
+		fwrite(stream, 1, stream_len, fp) != stream_len)
+		fprintf(stderr, "Error: cannot write record file %s.\n",
+				replay.record);
+	else
+		fprintf(stderr, "Record: %u operations, %u bytes in %s\n",
+				ops, stream_len, replay.record);
+	fclose(fp);
+}
+
+/*
+ * Drive the recorded stream on the pins. Returns the index of the first
+ * read that does not match the recording (of the REC_POLL of a polling
+ * loop that timed out), or -1 if all of them did.
+ */
+template<class io>
+static int64_t replay_play(const uint8_t *p, const uint8_t *end)
+{
+	const int pin[4] = { pic_clk, pic_data, pic_mclr, pic_mclr };
+	const uint8_t *poll = NULL;
+	uint64_t ns, poll_end = 0;
+	int64_t n = 0, poll_n = 0;
+	bool match = true;
+	int shift;
+	uint8_t b;
+
+	for (; p < end; n++) {
+		b = *p++;
+		switch ((b >> 2) & 0x07) {
+			case REC_SET:	io::set(pin[b & 0x03]); break;
+			case REC_CLR:	io::clr(pin[b & 0x03]); break;
+			case REC_IN:	io::in(pin[b & 0x03]); break;
+			case REC_OUT:	io::out(pin[b & 0x03]); break;
+			case REC_LEV0:
+				if (io::lev(pin[b & 0x03]))
+					match = false;
+				break;
+			case REC_LEV1:
+				if (!io::lev(pin[b & 0x03]))
+					match = false;
+				break;
+			case REC_POLL:
+				if (poll != p - 1) {
+					poll = p - 1;
+					poll_n = n;
+					poll_end = now_ns() + REC_POLL_TIMEOUT;
+				}
+				io::mark(OP_POLL);
+				break;
+			case REC_POLL_END:
+				if (io::poll(!match && now_ns() < poll_end)) {
+					/* the target is still busy: next pass */
+					p = poll;
+					n = poll_n - 1;
+					match = true;
+					rt_checkpoint();
+					continue;
+				}
+				if (!match)
+					return poll_n;
+				poll = NULL;
+				break;
+		}
+		if (!match && poll == NULL)
+			return n;
+		if (b & REC_DELAY) {
+			ns = 0;
+			shift = 0;
+			do {
+				ns |= (uint64_t)(*p & 0x7F) << shift;
+				shift += 7;
+			} while (*p++ & 0x80);
+			for (; ns > 0xFFFFFFFFULL; ns -= 0xFFFFFFFFULL)
+				delay_ns(0xFFFFFFFF);
+			delay_ns(ns);
+		}
+		if ((n % REC_CHECKPOINT) == 0)
+			rt_checkpoint();
+	}
+
+	return -1;
+}
+
+/* Replay on all the targets of the gang, if any */
+template<class io>
+static int64_t replay_backend(const uint8_t *p, const uint8_t *end)
+{
+	if (gang.n)
+		return replay_play<gang_gpio<io> >(p, end);
+	return replay_play<io>(p, end);
+}
+
+static int64_t replay_mmap(const uint8_t *p, const uint8_t *end)
+{
+	MMAP_DISPATCH(replay_backend<, >(p, end))
+}
+
+/* Replay the session in replay.file; true if all the reads matched */
+bool replay_session(void)
+{
+	struct rec_header h;
+	uint8_t *buf;
+	int64_t failed;
+	FILE *fp;
+
+	fp = fopen(replay.file, "rb");
+	if (fp == NULL) {
+		fprintf(stderr, "Error: cannot open replay file %s.\n", replay.file);
+		return false;
+	}
+	if (fread(&h, sizeof(h), 1, fp) != 1 || memcmp(h.magic, REC_MAGIC, 4) ||
+		h.version != REC_VERSION) {
+		fprintf(stderr, "Error: %s is not a picberry session.\n",
+				replay.file);
+		fclose(fp);
+		return false;
+	}
+	buf = (uint8_t *) malloc(h.size);
+	if (buf == NULL || fread(buf, 1, h.size, fp) != h.size) {
+		fprintf(stderr, "Error: cannot read replay file %s.\n", replay.file);
+		free(buf);
+		fclose(fp);
+		return false;
+	}
+	fclose(fp);
+
+	h.family[sizeof(h.family) - 1] = 0;
+	fprintf(stdout, "Replaying %s session (%u operations)...", h.family,
+			h.ops);
+
+	rt_enter();
+	switch (gpio_backend) {
+		case GPIO_BACKEND_GPIOCHIP:
+			failed = replay_backend<gpiochip_gpio>(buf, buf + h.size);
+			break;
+		case GPIO_BACKEND_MOCK:
+			failed = replay_backend<mock_gpio>(buf, buf + h.size);
+			break;
+		default:
+			failed = replay_mmap(buf, buf + h.size);
+			break;
+	}
+	rt_exit();
+	free(buf);
+
+	if (failed >= 0) {
+		/* hold the target in reset */
+		gpio_clr(pic_clk);
+		gpio_clr(pic_data);
+		gpio_clr(pic_mclr);
+		fprintf(stdout, "FAILED\n");
+		fprintf(stderr, "Replay: read back mismatch at operation %lld of %u\n",
+				(long long)failed, h.ops);
+		return false;
+	}
+
+	fprintf(stdout, "DONE!\n");
+	if (gang.n)
+		gang_report();
+	return true;
+}
@@ -0,0 +1,212 @@
+/*
+ * Raspberry Pi PIC Programmer using GPIO connector
+ * https://github.com/WallaceIT/picberry
+ * Copyright 2014 Francesco Valla
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+
+/*
+ * Automatic clock speed discovery (--speed=auto). The custom timing scale
+ * is binary searched between SPEED_SCALE_MAX and 0: a scale passes when
+ * SPEED_READS consecutive device ID reads, each in its own program mode
+ * session, return the ID and revision read with the safe preset. The
+ * fastest passing scale plus the safety margin is cached in the state
+ * file, one line per family and pin set:
+ *
+ *	<family> <pgc> <pgd> <mclr> <backend> <scale>
+ *
+ * Later runs start from the cached scale, and retune only if it fails.
+ */
+#define SPEED_SCALE_MAX		1000	// percent of the datasheet edge timings
+#define SPEED_STEP			5		// search resolution, in percent
+#define SPEED_READS			16
+#define SPEED_LINE			128
+
+struct speed_struct speed;
+
+static uint32_t	ref_id;
+static uint16_t	ref_rev;
+
+/* Read the device ID once; drop the memory buffer that comes with it */
+static bool speed_read_id(Pic *pic)
+{
+	if (!pic->read_device_id())
+		return false;
+
+	free(pic->mem.location);
+	free(pic->mem.filled);
+	pic->mem.location = 0;
+	pic->mem.filled = 0;
+	return true;
+}
+
+/* Check the target at the current timings */
+static bool speed_check(Pic *pic)
+{
+	bool ok = true;
+
+	pic->enter_program_mode();
+	if (!pic->setup_pe())
+		ok = false;
+	for (int i = 0; ok && i < SPEED_READS; i++)
+		ok = speed_read_id(pic) && pic->device_id == ref_id &&
+			 pic->device_rev == ref_rev;
+	pic->exit_program_mode();
+
+	return ok;
+}
+
+static bool speed_try(Pic *pic, unsigned int scale)
+{
+	bool ok;
+
+	timing.preset = TIMING_CUSTOM;
+	timing.scale = scale;
+	ok = speed_check(pic);
+	if (flags.debug)
+		fprintf(stderr, "Speed: %u%% %s\n", scale, ok ? "passed" : "failed");
+
+	return ok;
+}
+
+static bool speed_key(const char *line, const char *family, unsigned int *scale)
+{
+	char name[32];
+	int clk, data, mclr, backend;
+
+	if (sscanf(line, "%31s %d %d %d %d %u", name, &clk, &data, &mclr,
+			   &backend, scale) != 6)
+		return false;
+
+	return strcmp(name, family) == 0 && clk == pic_clk &&
+		   data == pic_data && mclr == pic_mclr && backend == gpio_backend;
+}
+
+static bool speed_load(const char *family, unsigned int *scale)
+{
+	char line[SPEED_LINE];
+	bool found = false;
+	FILE *fp;
+
+	fp = fopen(speed.file, "r");
+	if (fp == NULL)
+		return false;
+	while (!found && fgets(line, sizeof(line), fp))
+		found = speed_key(line, family, scale);
+	fclose(fp);
+
+	return found;
+}
+
+/* Replace (or add) the entry of this family and pin set */
+static void speed_store(const char *family, unsigned int scale)
+{
+	char line[SPEED_LINE], *lines = 0;
+	size_t len = 0;
+	unsigned int old;
+	FILE *fp;
+
+	fp = fopen(speed.file, "r");
+	if (fp != NULL) {
+		while (fgets(line, sizeof(line), fp)) {
+			if (speed_key(line, family, &old))
+				continue;
+			lines = (char *) realloc(lines, len + strlen(line) + 1);
+			strcpy(lines + len, line);
+			len += strlen(line);
+		}
+		fclose(fp);
+	}
+
+	fp = fopen(speed.file, "w");
+	if (fp == NULL) {
+		fprintf(stderr, "Error: cannot write speed file %s.\n", speed.file);
+		free(lines);
+		return;
+	}
+	if (lines)
+		fputs(lines, fp);
+	fprintf(fp, "%s %d %d %d %d %u\n", family, pic_clk, pic_data, pic_mclr,
+			gpio_backend, scale);
+	fclose(fp);
+	free(lines);
+}
+
+/*
+ * Select the timings for this fixture. Returns false if the target does
+ * not answer even with the safe preset; timings are left to safe then.
+ */
+bool speed_auto(Pic *pic, const char *family)
+{
+	unsigned int lo, hi, scale;
+
+	/* reference ID, with the slowest timings */
+	timing.preset = TIMING_SAFE;
+	pic->enter_program_mode();
+	pic->setup_pe();
+	if (!speed_read_id(pic)) {
+		pic->exit_program_mode();
+		return false;
+	}
+	pic->exit_program_mode();
+	ref_id = pic->device_id;
+	ref_rev = pic->device_rev;
+
+	if (!speed.retune && speed_load(family, &scale)) {
+		if (speed_try(pic, scale)) {
+			fprintf(stderr, "Speed: using cached %u%% of datasheet timings\n",
+					scale);
+			return true;
+		}
+		fprintf(stderr, "Speed: cached %u%% failed, retuning\n", scale);
+	}
+
+	fprintf(stderr, "Speed: tuning...\n");
+	if (!speed_try(pic, SPEED_SCALE_MAX)) {
+		fprintf(stderr, "Speed: unstable at %u%%, using safe timings\n",
+				SPEED_SCALE_MAX);
+		timing.preset = TIMING_SAFE;
+		return true;
+	}
+
+	/* hi always passes, lo fails (or is the fastest possible) */
+	lo = 0;
+	hi = SPEED_SCALE_MAX;
+	if (speed_try(pic, 0))
+		hi = 0;
+	while (hi - lo > SPEED_STEP) {
+		scale = (lo + hi) / 2;
+		if (speed_try(pic, scale))
+			hi = scale;
+		else
+			lo = scale;
+	}
+
+	scale = hi + speed.margin;
+	fprintf(stderr, "Speed: fastest passing %u%%, using %u%% of datasheet "
+			"timings\n", hi, scale);
+	timing.preset = TIMING_CUSTOM;
+	timing.scale = scale;
+	speed_store(family, scale);
+
+	return true;
+}
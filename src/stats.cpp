@@ -0,0 +1,204 @@
+/*
+ * Raspberry Pi PIC Programmer using GPIO connector
+ * https://github.com/WallaceIT/picberry
+ * Copyright 2014 Francesco Valla
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "common.h"
+
+/*
+ * PGC edge timing statistics (--stats). Every PGC edge is timestamped and
+ * accounted to the ICSP operation marked by the device class: high time
+ * (rising to falling edge), low time (falling to rising edge, inside an
+ * operation) and gap (last edge of the previous operation to the first
+ * rising edge of the next one). Histograms have power-of-two buckets, in
+ * nanoseconds. Timestamping costs a clock read per edge, so the achieved
+ * rates are slightly lower than without --stats.
+ */
+#define HIST_BUCKETS		32
+
+struct histogram {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint64_t bucket[HIST_BUCKETS];	// bucket i: [2^i, 2^(i+1)) ns
+};
+
+struct op_stats {
+	histogram high;
+	histogram low;
+	histogram gap;
+};
+
+struct stats_struct stats;
+
+static op_stats		ops[NUM_OPS];
+static int			cur_op = OP_OTHER;
+static bool			op_start;
+static int			clk_level = -1;
+static uint64_t		last_edge;
+
+static void hist_add(histogram *h, uint64_t ns)
+{
+	int b = 0;
+
+	while (b < HIST_BUCKETS - 1 && (ns >> (b + 1)))
+		b++;
+	h->bucket[b]++;
+	if (h->count == 0 || ns < h->min)
+		h->min = ns;
+	if (ns > h->max)
+		h->max = ns;
+	h->sum += ns;
+	h->count++;
+}
+
+static void stats_event(int event, int g, int value)
+{
+	uint64_t now;
+
+	if (event == EV_MARK) {
+		if (g == OP_ROW || g == OP_POLL || g == OP_POLL_DONE)
+			return;				// not ICSP operations
+		cur_op = g;
+		op_start = true;
+		return;
+	}
+
+	if (g != pic_clk || (event != EV_SET && event != EV_CLR))
+		return;
+	if (value == clk_level)		// no edge
+		return;
+
+	now = now_ns();
+	if (last_edge) {
+		if (value == 0)
+			hist_add(&ops[cur_op].high, now - last_edge);
+		else if (op_start)
+			hist_add(&ops[cur_op].gap, now - last_edge);
+		else
+			hist_add(&ops[cur_op].low, now - last_edge);
+	}
+	if (value)
+		op_start = false;
+	clk_level = value;
+	last_edge = now;
+}
+
+/* Enable the statistics, before the device class is created */
+void stats_init(void)
+{
+	if (stats.enabled)
+		gpio_add_hook(stats_event);
+}
+
+static void hist_print(const char *name, histogram *h)
+{
+	if (h->count == 0)
+		return;
+	fprintf(stderr, "    %-5s %10llu  min %8llu  avg %8llu  max %10llu ns\n",
+			name,
+			(unsigned long long)h->count,
+			(unsigned long long)h->min,
+			(unsigned long long)(h->sum / h->count),
+			(unsigned long long)h->max);
+}
+
+static void hist_json(FILE *fp, const char *name, histogram *h, bool last)
+{
+	bool first = true;
+
+	fprintf(fp, "      \"%s\": {\"count\": %llu, \"min\": %llu, \"mean\": %llu, "
+			"\"max\": %llu, \"buckets\": {",
+			name,
+			(unsigned long long)h->count,
+			(unsigned long long)h->min,
+			(unsigned long long)(h->count ? h->sum / h->count : 0),
+			(unsigned long long)h->max);
+	for (int b = 0; b < HIST_BUCKETS; b++) {
+		if (h->bucket[b] == 0)
+			continue;
+		fprintf(fp, "%s\"%llu\": %llu", first ? "" : ", ",
+				1ULL << b, (unsigned long long)h->bucket[b]);
+		first = false;
+	}
+	fprintf(fp, "}}%s\n", last ? "" : ",");
+}
+
+/* Print (or export) the statistics collected so far, and reset them */
+void stats_report(void)
+{
+	FILE *fp;
+	int n = 0;
+
+	if (!stats.enabled)
+		return;
+
+	if (stats.file) {
+		fp = fopen(stats.file, "w");
+		if (fp == NULL) {
+			fprintf(stderr, "Error: cannot open stats file %s.\n", stats.file);
+			return;
+		}
+		fprintf(fp, "{\n  \"unit\": \"ns\",\n  \"operations\": {\n");
+		for (int i = 0; i < NUM_OPS; i++)
+			if (ops[i].high.count)
+				n++;
+		for (int i = 0; i < NUM_OPS; i++) {
+			if (ops[i].high.count == 0)
+				continue;
+			fprintf(fp, "    \"%s\": {\n", gpio_op_name[i]);
+			hist_json(fp, "high", &ops[i].high, false);
+			hist_json(fp, "low", &ops[i].low, false);
+			hist_json(fp, "gap", &ops[i].gap, true);
+			fprintf(fp, "    }%s\n", --n ? "," : "");
+		}
+		fprintf(fp, "  }\n}\n");
+		fclose(fp);
+	}
+	else {
+		fprintf(stderr, "PGC edge statistics:\n");
+		for (int i = 0; i < NUM_OPS; i++) {
+			op_stats *op = &ops[i];
+			uint64_t period;
+
+			if (op->high.count == 0)
+				continue;
+			fprintf(stderr, "  %s", gpio_op_name[i]);
+			if (op->low.count) {
+				period = op->high.sum / op->high.count +
+						 op->low.sum / op->low.count;
+				if (period)
+					fprintf(stderr, " (%llu kHz)",
+							(unsigned long long)(1000000 / period));
+			}
+			fprintf(stderr, "\n");
+			hist_print("high", &op->high);
+			hist_print("low", &op->low);
+			hist_print("gap", &op->gap);
+		}
+	}
+
+	memset(ops, 0, sizeof(ops));
+	last_edge = 0;
+	clk_level = -1;
+}
@@ -0,0 +1,205 @@
+/*
+ * Raspberry Pi PIC Programmer using GPIO connector
+ * https://github.com/WallaceIT/picberry
+ * Copyright 2014 Francesco Valla
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+
+/*
+ * GPIO trace (--trace). Every access to PGC, PGD and MCLR and every mark of
+ * the device class is timestamped into a ring buffer, allocated once when
+ * the option is parsed; when it fills up the oldest records are dropped.
+ * At exit the ring is written as a VCD file (GTKWave, or PulseView and
+ * sigrok-cli with -I vcd): one wire per pin, PGD is 'z' while it is an
+ * input and shows the levels read, and three vectors annotate the ICSP
+ * operation (op), its command or data word (value) and the last row or
+ * block done (row).
+ */
+struct trace_rec {
+	uint64_t	t;			// ns, CLOCK_MONOTONIC_RAW
+	uint32_t	value;		// level read, mark value
+	uint8_t		event;		// EV_x
+	uint8_t		arg;		// pin (0 PGC, 1 PGD, 2 MCLR) or mark op
+};
+
+struct trace_struct trace;
+
+static trace_rec	*ring;
+static uint32_t		ring_pos;
+static uint64_t		ring_count;		// records since the start
+
+static const char	pin_id[3] = { '!', '"', '#' };
+static const char	*pin_name[3] = { "PGC", "PGD", "MCLR" };
+
+static void trace_event(int event, int g, int value)
+{
+	trace_rec *r;
+	int arg;
+
+	if (event == EV_MARK)
+		arg = g;
+	else if (g == pic_clk)
+		arg = 0;
+	else if (g == pic_data)
+		arg = 1;
+	else if (g == pic_mclr)
+		arg = 2;
+	else
+		return;
+
+	r = &ring[ring_pos];
+	r->t = now_ns();
+	r->value = value;
+	r->event = event;
+	r->arg = arg;
+	if (++ring_pos == trace.records)
+		ring_pos = 0;
+	ring_count++;
+}
+
+static void vcd_vector(FILE *fp, uint32_t v, char id)
+{
+	int b = 31;
+
+	while (b > 0 && !((v >> b) & 0x01))
+		b--;
+	fputc('b', fp);
+	for (; b >= 0; b--)
+		fputc('0' + ((v >> b) & 0x01), fp);
+	fprintf(fp, " %c\n", id);
+}
+
+/* Write the ring to trace.file as VCD, oldest record first */
+static void trace_write(void)
+{
+	int dir[3] = { -1, -1, -1 };		// 1 output, 0 input, -1 unknown
+	int drv[3] = { -1, -1, -1 };		// level driven, -1 unknown
+	uint64_t n, first, last_t = 0;
+	uint64_t dropped = 0;
+	trace_rec *r;
+	FILE *fp;
+	int p;
+
+	if (ring_count == 0)
+		return;
+
+	fp = fopen(trace.file, "w");
+	if (fp == NULL) {
+		fprintf(stderr, "Error: cannot open trace file %s.\n", trace.file);
+		return;
+	}
+
+	n = ring_count;
+	first = 0;
+	if (ring_count > trace.records) {
+		dropped = ring_count - trace.records;
+		n = trace.records;
+		first = ring_pos;
+	}
+
+	fprintf(fp, "$version picberry $end\n");
+	fprintf(fp, "$comment %llu records, %llu dropped $end\n",
+			(unsigned long long)n, (unsigned long long)dropped);
+	fprintf(fp, "$comment op:");
+	for (int i = 0; i < NUM_OPS; i++)
+		fprintf(fp, " %d=%s", i, gpio_op_name[i]);
+	fprintf(fp, " $end\n");
+	fprintf(fp, "$timescale 1ns $end\n");
+	fprintf(fp, "$scope module picberry $end\n");
+	for (p = 0; p < 3; p++)
+		fprintf(fp, "$var wire 1 %c %s $end\n", pin_id[p], pin_name[p]);
+	fprintf(fp, "$var wire 8 $ op $end\n");
+	fprintf(fp, "$var wire 32 %% value $end\n");
+	fprintf(fp, "$var wire 32 & row $end\n");
+	fprintf(fp, "$upscope $end\n");
+	fprintf(fp, "$enddefinitions $end\n");
+
+	fprintf(fp, "#0\n$dumpvars\nx!\nx\"\nx#\nb0 $\nb0 %%\nb0 &\n$end\n");
+
+	for (uint64_t i = 0; i < n; i++) {
+		r = &ring[(first + i) % trace.records];
+		if (i == 0)
+			last_t = r->t;
+		else if (r->t != last_t) {
+			fprintf(fp, "#%llu\n",
+					(unsigned long long)(r->t - ring[first].t));
+			last_t = r->t;
+		}
+
+		p = r->arg;
+		switch (r->event) {
+			case EV_SET:
+			case EV_CLR:
+				drv[p] = r->event == EV_SET;
+				if (dir[p])
+					fprintf(fp, "%d%c\n", drv[p], pin_id[p]);
+				break;
+			case EV_IN:
+				dir[p] = 0;
+				fprintf(fp, "z%c\n", pin_id[p]);
+				break;
+			case EV_OUT:
+				dir[p] = 1;
+				if (drv[p] < 0)
+					fprintf(fp, "x%c\n", pin_id[p]);
+				else
+					fprintf(fp, "%d%c\n", drv[p], pin_id[p]);
+				break;
+			case EV_LEV:
+				if (dir[p] == 0)
+					fprintf(fp, "%d%c\n", r->value & 0x01, pin_id[p]);
+				break;
+			case EV_MARK:
+				if (p == OP_ROW)
+					vcd_vector(fp, r->value, '&');
+				else {
+					vcd_vector(fp, p, '$');
+					vcd_vector(fp, r->value, '%');
+				}
+				break;
+		}
+	}
+
+	if (fclose(fp))
+		fprintf(stderr, "Error: cannot write trace file %s.\n", trace.file);
+	else
+		fprintf(stderr, "Trace: %llu records (%llu dropped) in %s\n",
+				(unsigned long long)n, (unsigned long long)dropped,
+				trace.file);
+}
+
+/* Allocate the ring and register the hook, before the device class is created */
+void trace_init(void)
+{
+	if (trace.records == 0)
+		trace.records = 1;
+	ring = (trace_rec *) malloc(trace.records * sizeof(trace_rec));
+	if (ring == NULL) {
+		fprintf(stderr, "Error: cannot allocate %u trace records.\n",
+				trace.records);
+		exit(1);
+	}
+	/* fault the pages in now, not while tracing */
+	memset(ring, 0, trace.records * sizeof(trace_rec));
+	gpio_add_hook(trace_event);
+	atexit(trace_write);
+}
@@ -0,0 +1,110 @@
+/*
+ * Raspberry Pi PIC Programmer using GPIO connector
+ * https://github.com/WallaceIT/picberry
+ * Copyright 2014 Francesco Valla
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "common.h"
+#include "wave.h"
+
+#define WAVE_CHUNK		1024	// ops
+
+/* Empty the waveform, keeping its buffer */
+void wave_reset(wave *w)
+{
+	w->len = 0;
+	w->results = 0;
+	w->pgd = -1;
+}
+
+void wave_free(wave *w)
+{
+	free(w->op);
+	w->op = 0;
+	w->size = 0;
+	wave_reset(w);
+}
+
+void wave_emit(wave *w, int code, int a, int b, int word, int bit)
+{
+	wave_op *op;
+
+	if (w->len == w->size) {
+		w->size += WAVE_CHUNK;
+		w->op = (wave_op *) realloc(w->op, w->size * sizeof(wave_op));
+		if (w->op == NULL) {
+			fprintf(stderr, "Error: out of memory compiling waveform.\n");
+			exit(1);
+		}
+	}
+
+	op = &w->op[w->len++];
+	op->code = code;
+	op->word = word;
+	op->bit = bit;
+	op->a = a;
+	op->b = b;
+	op->delay = 0;
+
+	if (code == WAVE_LEV && word >= w->results)
+		w->results = word + 1;
+}
+
+/* Wait ns after the last operation; consecutive waits are merged */
+void wave_delay(wave *w, unsigned int ns)
+{
+	if (w->len)
+		w->op[w->len - 1].delay += ns;
+}
+
+/* Drive PGD to bit, if not already there (pgd_write) */
+void wave_write(wave *w, int pgd_pin, int bit)
+{
+	bit = bit ? 1 : 0;
+	if (w->pgd != bit)
+		wave_emit(w, bit ? WAVE_SET : WAVE_CLR, pgd_pin);
+	w->pgd = bit;
+}
+
+/* Raise PGC with PGD at bit (pgc_rise) */
+void wave_rise(wave *w, int pgc, int pgd_pin, int bit)
+{
+	if (bit && w->pgd != 1) {
+		wave_emit(w, WAVE_SET2, pgd_pin, pgc);
+		w->pgd = 1;
+	}
+	else {
+		wave_write(w, pgd_pin, bit);
+		wave_emit(w, WAVE_SET, pgc);
+	}
+}
+
+/* Raise PGC with PGD at bit of patch word */
+void wave_rise_patch(wave *w, int pgc, int pgd_pin, int word, int bit)
+{
+	wave_emit(w, WAVE_BIT, pgc, pgd_pin, word, bit);
+	w->pgd = -1;
+}
+
+/* Sample pin into bit of result word */
+void wave_lev(wave *w, int pin, int word, int bit)
+{
+	wave_emit(w, WAVE_LEV, pin, 0, word, bit);
+}
@@ -0,0 +1,146 @@
+/*
+ * Raspberry Pi PIC Programmer using GPIO connector
+ * https://github.com/WallaceIT/picberry
+ * Copyright 2014 Francesco Valla
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WAVE_H_
+#define WAVE_H_
+
+#include <stdint.h>
+
+/*
+ * Compiled waveforms. A fixed ICSP command sequence is compiled once into
+ * a flat array of pin operations, each followed by its delay, and then
+ * replayed by wave_play() with no per-bit shifts or tests. The compiler
+ * tracks the PGD level, so redundant data stores are dropped and the
+ * combined PGC/PGD edges of pgc_rise() are resolved at compile time.
+ * Data-bearing fields (e.g. the literal of a MOV) are left as WAVE_BIT
+ * ops, taking their bit from a patch word passed to wave_play(); REGOUT
+ * bits are collected into result words.
+ *
+ * Waveforms embed the resolved delays: reset them whenever the timings
+ * are resolved again (i.e. in enter_program_mode).
+ */
+enum wave_code {
+	WAVE_SET,			// set a
+	WAVE_CLR,			// clear a
+	WAVE_SET2,			// set a and b
+	WAVE_CLR2,			// clear a and b
+	WAVE_IN,			// a as input
+	WAVE_OUT,			// a as output
+	WAVE_LEV,			// result[word] |= level of a << bit
+	WAVE_BIT,			// drive b to bit of patch[word], set a
+	WAVE_MARK			// io::mark(word, a)
+};
+
+struct wave_op {
+	uint8_t			code;
+	uint8_t			word;
+	uint8_t			bit;
+	int				a, b;
+	unsigned int	delay;		// ns, after the operation
+};
+
+struct wave {
+	wave_op			*op;
+	int				len;
+	int				size;
+	int				results;	// result words written by WAVE_LEV
+	int				pgd;		// compiler: PGD level, -1 if unknown
+};
+
+/* compiler, wave.cpp */
+void wave_reset(wave *w);
+void wave_free(wave *w);
+void wave_emit(wave *w, int code, int a, int b = 0, int word = 0, int bit = 0);
+void wave_delay(wave *w, unsigned int ns);
+void wave_write(wave *w, int pgd_pin, int bit);
+void wave_rise(wave *w, int pgc, int pgd_pin, int bit);
+void wave_rise_patch(wave *w, int pgc, int pgd_pin, int word, int bit);
+void wave_lev(wave *w, int pin, int word, int bit);
+
+/* Replay a compiled waveform */
+template<class io>
+static inline void wave_play(const wave *w, const uint16_t *patch,
+							 uint16_t *result)
+{
+	const wave_op *op = w->op, *end = w->op + w->len;
+
+	for (int i = 0; i < w->results; i++)
+		result[i] = 0;
+
+	for (; op < end; op++) {
+		switch (op->code) {
+			case WAVE_SET:	io::set(op->a); break;
+			case WAVE_CLR:	io::clr(op->a); break;
+			case WAVE_SET2:	io::set2(op->a, op->b); break;
+			case WAVE_CLR2:	io::clr2(op->a, op->b); break;
+			case WAVE_IN:	io::in(op->a); break;
+			case WAVE_OUT:	io::out(op->a); break;
+			case WAVE_LEV:
+				result[op->word] |= (io::lev(op->a) & 0x01) << op->bit;
+				break;
+			case WAVE_BIT:
+				if ((patch[op->word] >> op->bit) & 0x01)
+					io::set2(op->b, op->a);
+				else {
+					io::clr(op->b);
+					io::set(op->a);
+				}
+				break;
+			case WAVE_MARK:	io::mark(op->word, op->a); break;
+		}
+		if (op->delay)
+			delay_ns(op->delay);
+	}
+}
+
+/*
+ * Replay a compiled waveform bit-sliced on a gang (gang_slice<io>): a
+ * WAVE_BIT op drives the PGD mask mask[word][bit], a WAVE_LEV op stores
+ * the whole level register in level[word][bit]. The other ops are the same
+ * on every target.
+ */
+template<class io>
+static inline void wave_play_gang(const wave *w, const uint32_t (*mask)[16],
+								  uint32_t (*level)[16])
+{
+	const wave_op *op = w->op, *end = w->op + w->len;
+
+	for (; op < end; op++) {
+		switch (op->code) {
+			case WAVE_SET:	io::set(op->a); break;
+			case WAVE_CLR:	io::clr(op->a); break;
+			case WAVE_SET2:	io::set2(op->a, op->b); break;
+			case WAVE_CLR2:	io::clr2(op->a, op->b); break;
+			case WAVE_IN:	io::in(op->a); break;
+			case WAVE_OUT:	io::out(op->a); break;
+			case WAVE_LEV:
+				level[op->word][op->bit] = gang_slice<io>::levm(op->a);
+				break;
+			case WAVE_BIT:
+				gang_slice<io>::rise(op->a, mask[op->word][op->bit]);
+				break;
+			case WAVE_MARK:	io::mark(op->word, op->a); break;
+		}
+		if (op->delay)
+			delay_ns(op->delay);
+	}
+}
+
+#endif /* WAVE_H_ */